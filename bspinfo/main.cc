@@ -100,6 +100,8 @@ int main(int argc, char **argv)
             fs::path source = DefaultExtension(argv[i], ".bsp");
             fmt::print("{}\n", source);
 
+            // every lump ends up in the .json, so unlike bsputil's read-only
+            // operations there's nothing to save by loading only some of them
             bspdata_t bsp;
             LoadBSPFile(source, &bsp);
 
@@ -808,6 +808,16 @@ struct planelist_t
     }
 };
 
+// the lumps read by the operations that don't need the whole BSP
+static const std::map<std::string, std::vector<std::string_view>> lumps_read_by_operation{
+    {"extract-entities", {}},
+    {"extract-bspx-lump", {}},
+    {"extract-textures", {"texture"}},
+    {"modelinfo", {"models"}},
+    {"findleaf", {"models", "nodes", "planes", "leafs"}},
+    {"findfaces", {"models", "nodes", "planes", "faces", "vertexes", "edges", "surfedges", "texinfos", "texture"}},
+};
+
 int bsputil_main(int _argc, const char **_argv)
 {
     logging::preinitialize();
@@ -836,7 +846,38 @@ int bsputil_main(int _argc, const char **_argv)
 
     map_file_t map_file;
 
-    if (string_iequals(source.extension().string(), ".bsp")) {
+    // if every operation only reads a few lumps, only those are converted;
+    // the entities and BSPX lumps are used straight from the file
+    std::vector<std::string_view> lumps_read;
+    const bool lumps_only = std::all_of(
+        bsputil_options.operations.begin(), bsputil_options.operations.end(), [&lumps_read](const auto &operation) {
+            auto it = lumps_read_by_operation.find(operation->primary_name());
+            if (it == lumps_read_by_operation.end()) {
+                return false;
+            }
+            for (std::string_view lump : it->second) {
+                if (std::find(lumps_read.begin(), lumps_read.end(), lump) == lumps_read.end()) {
+                    lumps_read.push_back(lump);
+                }
+            }
+            return true;
+        });
+    std::optional<bspfile_view_t> bspfile;
+
+    if (string_iequals(source.extension().string(), ".bsp") && lumps_only) {
+        bspfile = OpenBSPFile(source);
+
+        bspdata.file = source;
+        source = fs::resolveArchivePath(source);
+
+        if (!lumps_read.empty()) {
+            LoadBSPLumps(*bspfile, &bspdata, lumps_read);
+
+            bspdata.version->game->init_filesystem(source, bsputil_options);
+
+            ConvertBSPFormat(&bspdata, &bspver_generic);
+        }
+    } else if (string_iequals(source.extension().string(), ".bsp")) {
         LoadBSPFile(source, &bspdata);
 
         bspdata.version->game->init_filesystem(source, bsputil_options);
@@ -1266,9 +1307,8 @@ int bsputil_main(int _argc, const char **_argv)
                 }
             }
 
-            ConvertBSPFormat(&bspdata, bspdata.loadversion);
-
-            WriteBSPFile(source.replace_filename(source.stem().string() + "-scaled.bsp"), &bspdata);
+            WriteBSPFile(
+                source.replace_filename(source.stem().string() + "-scaled.bsp"), &bspdata, bspdata.loadversion);
 
         } else if (operation->primary_name() == "replace-entities") {
             fs::path dest = operation->string_value();
@@ -1286,9 +1326,7 @@ int bsputil_main(int _argc, const char **_argv)
 
                 bsp.dentdata = std::string(reinterpret_cast<char *>(ent->data()), ent->size());
 
-                ConvertBSPFormat(&bspdata, bspdata.loadversion);
-
-                WriteBSPFile(source, &bspdata);
+                WriteBSPFile(source, &bspdata, bspdata.loadversion);
             } else {
                 map_file_t ents = LoadMapOrEntFile(dest);
 
@@ -1371,13 +1409,12 @@ int bsputil_main(int _argc, const char **_argv)
                 Error("Unsupported format {}", format);
             }
 
-            ConvertBSPFormat(&bspdata, fmt);
-
-            WriteBSPFile(source.replace_filename(source.stem().string() + "-" + fmt->short_name), &bspdata);
+            WriteBSPFile(source.replace_filename(source.stem().string() + "-" + fmt->short_name), &bspdata, fmt);
         } else if (operation->primary_name() == "extract-entities") {
-            mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
+            const std::string_view dentdata =
+                bspfile ? bspfile->entities() : std::string_view(std::get<mbsp_t>(bspdata.bsp).dentdata);
 
-            uint32_t crc = CRC_Block((unsigned char *)bsp.dentdata.data(), bsp.dentdata.size() - 1);
+            uint32_t crc = CRC_Block((const unsigned char *)dentdata.data(), dentdata.size() - 1);
 
             source.replace_extension(".ent");
             logging::print("-> writing {} [CRC: {:04x}]... ", source, crc);
@@ -1386,7 +1423,7 @@ int bsputil_main(int _argc, const char **_argv)
             if (!f)
                 Error("couldn't open {} for writing\n", source);
 
-            f << bsp.dentdata;
+            f << dentdata;
 
             if (!f)
                 Error("{}", strerror(errno));
@@ -1412,8 +1449,7 @@ int bsputil_main(int _argc, const char **_argv)
 
                 mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
                 ReplaceTexturesFromWad(bsp);
-                ConvertBSPFormat(&bspdata, bspdata.loadversion);
-                WriteBSPFile(source, &bspdata);
+                WriteBSPFile(source, &bspdata, bspdata.loadversion);
             } else {
                 Error("couldn't load .wad file {}\n", wad_source);
             }
@@ -1454,10 +1490,8 @@ int bsputil_main(int _argc, const char **_argv)
             mface_t *face = BSP_GetFace(&bsp, fnum);
             face->texinfo = texinfonum;
 
-            ConvertBSPFormat(&bspdata, bspdata.loadversion);
-
             // Overwrite source bsp!
-            WriteBSPFile(source, &bspdata);
+            WriteBSPFile(source, &bspdata, bspdata.loadversion);
         } else if (operation->primary_name().starts_with("decompile")) {
             const bool geomOnly = operation->primary_name() == "decompile-geomonly";
             const bool ignoreBrushes = operation->primary_name() == "decompile-ignore-brushes";
@@ -1500,12 +1534,22 @@ int bsputil_main(int _argc, const char **_argv)
             std::string lump_name = setting->get<settings::setting_string>(0)->value();
             fs::path output_file_name = setting->get<settings::setting_string>(1)->value();
 
-            const auto &entries = bspdata.bspx.entries;
-            if (entries.find(lump_name) == entries.end()) {
-                FError("couldn't find bspx lump {}", lump_name);
-            }
+            std::span<const uint8_t> entry;
 
-            const std::vector<uint8_t> &entry = entries.at(lump_name);
+            if (bspfile) {
+                if (auto it = bspfile->bspx.find(lump_name); it != bspfile->bspx.end()) {
+                    entry = it->second;
+                } else {
+                    FError("couldn't find bspx lump {}", lump_name);
+                }
+            } else {
+                const auto &entries = bspdata.bspx.entries;
+                if (entries.find(lump_name) == entries.end()) {
+                    FError("couldn't find bspx lump {}", lump_name);
+                }
+
+                entry = entries.at(lump_name);
+            }
 
             logging::print("-> writing {} BSPX lump data to {}... ", lump_name, output_file_name);
             std::ofstream f(output_file_name, std::ios_base::out | std::ios_base::binary);
@@ -1535,8 +1579,7 @@ int bsputil_main(int _argc, const char **_argv)
             entries[lump_name] = std::move(*data);
 
             // Overwrite source bsp!
-            ConvertBSPFormat(&bspdata, bspdata.loadversion);
-            WriteBSPFile(source, &bspdata);
+            WriteBSPFile(source, &bspdata, bspdata.loadversion);
 
             logging::print("done.\n");
         } else if (operation->primary_name() == "remove-bspx-lump") {
@@ -1553,8 +1596,7 @@ int bsputil_main(int _argc, const char **_argv)
             entries.erase(it);
 
             // Overwrite source bsp!
-            ConvertBSPFormat(&bspdata, bspdata.loadversion);
-            WriteBSPFile(source, &bspdata);
+            WriteBSPFile(source, &bspdata, bspdata.loadversion);
 
             logging::print("done.\n");
         } else {
@@ -26,6 +26,7 @@
 #include <common/settings.hh>
 #include <common/numeric_cast.hh>
 
+#include <cerrno>
 #include <cstdint>
 #include <limits.h>
 
@@ -1988,6 +1989,32 @@ inline T ConvertGenericToQ2BSP(mbsp_t &mbsp, const bspversion_t *to_version)
     return bsp;
 }
 
+template<typename T>
+struct is_std_array : std::false_type
+{
+};
+
+template<typename T, size_t N>
+struct is_std_array<std::array<T, N>> : std::true_type
+{
+};
+
+// convert a single element, the same way CopyArray does
+template<typename T, typename F>
+inline T ConvertElement(const F &v)
+{
+    if constexpr (std::is_arithmetic_v<T> && std::is_arithmetic_v<F>) {
+        return numeric_cast<T>(v);
+    } else if constexpr (is_std_array<T>::value && is_std_array<F>::value) {
+        if constexpr (std::is_arithmetic_v<typename T::value_type> && std::is_arithmetic_v<typename F::value_type>)
+            return array_cast<T>(v);
+        else
+            return v;
+    } else {
+        return static_cast<T>(v);
+    }
+}
+
 /*
  * =========================================================================
  * ConvertBSPFormat
@@ -2119,12 +2146,18 @@ struct lump_reader
     std::istream &s;
     const bspversion_t *version;
     const std::vector<lump_t> &lumps;
+    // lumps to read, by number; empty reads all of them
+    std::vector<bool> wanted = {};
+
+    inline bool skip(size_t lump_num) const { return !wanted.empty() && !wanted[lump_num]; }
 
     // read structured lump data from stream into vector
     template<typename T>
     void read(size_t lump_num, std::vector<T> &buffer)
     {
         Q_assert(version->lumps.size() > lump_num);
+        if (skip(lump_num))
+            return;
         const lumpspec_t &lumpspec = version->lumps.begin()[lump_num];
         const lump_t &lump = lumps[lump_num];
         size_t length;
@@ -2163,6 +2196,8 @@ struct lump_reader
     void read(size_t lump_num, std::string &buffer)
     {
         Q_assert(version->lumps.size() > lump_num);
+        if (skip(lump_num))
+            return;
         const lumpspec_t &lumpspec = version->lumps.begin()[lump_num];
         const lump_t &lump = lumps[lump_num];
 
@@ -2194,6 +2229,8 @@ struct lump_reader
     void read(size_t lump_num, T &buffer)
     {
         Q_assert(version->lumps.size() > lump_num);
+        if (skip(lump_num))
+            return;
         const lumpspec_t &lumpspec = version->lumps.begin()[lump_num];
         const lump_t &lump = lumps[lump_num];
 
@@ -2267,35 +2304,72 @@ void bspdata_t::bspxentries::transfer(const char *xname, std::vector<uint8_t> &&
     entries.insert_or_assign(xname, xdata);
 }
 
+std::span<const uint8_t> bspfile_view_t::data() const
+{
+    if (mapped.is_open()) {
+        return {mapped.data(), mapped.size()};
+    } else if (loaded) {
+        return {loaded->data(), loaded->size()};
+    }
+
+    return {};
+}
+
+std::span<const uint8_t> bspfile_view_t::lump(size_t lump_num) const
+{
+    Q_assert(version->lumps.size() > lump_num);
+    const lump_t &lump = lumps[lump_num];
+    const auto file = data();
+
+    if (lump.fileofs < 0 || lump.filelen < 0 ||
+        static_cast<size_t>(lump.fileofs) + static_cast<size_t>(lump.filelen) > file.size()) {
+        FError("{} lump lies outside the file", version->lumps.begin()[lump_num].name);
+    }
+
+    return file.subspan(lump.fileofs, lump.filelen);
+}
+
+std::string_view bspfile_view_t::entities() const
+{
+    const auto lump_data = lump(version->version.has_value() ? Q2_LUMP_ENTITIES : LUMP_ENTITIES);
+    std::string_view ents(reinterpret_cast<const char *>(lump_data.data()), lump_data.size());
+
+    // same as the logical string LoadBSPFile produces
+    if (!ents.empty() && ents.back() == '\0') {
+        ents.remove_suffix(1);
+    }
+
+    return ents;
+}
+
 /*
  * =============
- * LoadBSPFile
+ * OpenBSPFile
  * =============
  */
-void LoadBSPFile(fs::path &filename, bspdata_t *bspdata)
+bspfile_view_t OpenBSPFile(const fs::path &filename)
 {
-    int i;
+    bspfile_view_t view;
 
-    logging::funcprint("'{}'\n", filename);
+    // loose files are mapped; BSPs inside archives have to be loaded
+    if (fs::is_regular_file(filename)) {
+        view.mapped = mapped_file_t(filename);
+    }
 
-    bspdata->file = filename;
+    if (!view.mapped.is_open()) {
+        view.loaded = fs::load(filename);
+    }
 
-    /* load the file header */
-    fs::data file_data = fs::load(filename);
+    const auto file = view.data();
 
-    if (!file_data) {
+    if (file.empty()) {
         FError("Unable to load \"{}\"\n", filename);
     }
 
-    filename = fs::resolveArchivePath(filename);
-
-    imemstream stream(file_data->data(), file_data->size());
+    imemstream stream(file.data(), file.size());
 
     stream >> endianness<std::endian::little>;
 
-    /* transfer the header data to this */
-    std::vector<lump_t> lumps;
-
     /* check for IBSP */
     bspversion_t temp_version{};
     stream >= temp_version.ident;
@@ -2306,63 +2380,46 @@ void LoadBSPFile(fs::path &filename, bspdata_t *bspdata)
         stream >= q2header;
 
         temp_version.version = q2header.version;
-        std::copy(q2header.lumps.begin(), q2header.lumps.end(), std::back_inserter(lumps));
+        std::copy(q2header.lumps.begin(), q2header.lumps.end(), std::back_inserter(view.lumps));
     } else {
         dheader_t q1header;
         stream >= q1header;
 
         temp_version.version = std::nullopt;
-        std::copy(q1header.lumps.begin(), q1header.lumps.end(), std::back_inserter(lumps));
+        std::copy(q1header.lumps.begin(), q1header.lumps.end(), std::back_inserter(view.lumps));
     }
 
     /* check the file version */
-    if (!BSPVersionSupported(temp_version.ident, temp_version.version, &bspdata->version)) {
+    if (!BSPVersionSupported(temp_version.ident, temp_version.version, &view.version)) {
         logging::print("BSP is version {}\n", temp_version);
         Error("Sorry, this bsp version is not supported.");
     } else {
         // special case handling for Hexen II
-        if (bspdata->version->game->id == GAME_QUAKE && isHexen2((dheader_t *)file_data->data(), bspdata->version)) {
-            if (bspdata->version == &bspver_q1) {
-                bspdata->version = &bspver_h2;
-            } else if (bspdata->version == &bspver_bsp2) {
-                bspdata->version = &bspver_h2bsp2;
-            } else if (bspdata->version == &bspver_bsp2rmq) {
-                bspdata->version = &bspver_h2bsp2rmq;
+        if (view.version->game->id == GAME_QUAKE && isHexen2((const dheader_t *)file.data(), view.version)) {
+            if (view.version == &bspver_q1) {
+                view.version = &bspver_h2;
+            } else if (view.version == &bspver_bsp2) {
+                view.version = &bspver_h2bsp2;
+            } else if (view.version == &bspver_bsp2rmq) {
+                view.version = &bspver_h2bsp2rmq;
             }
         }
 
-        logging::print("BSP is version {}\n", *bspdata->version);
-    }
-
-    lump_reader reader{stream, bspdata->version, lumps};
-
-    /* copy the data */
-    if (bspdata->version == &bspver_q2) {
-        ReadQ2BSP(reader, bspdata->bsp.emplace<q2bsp_t>());
-    } else if (bspdata->version == &bspver_qbism) {
-        ReadQ2BSP(reader, bspdata->bsp.emplace<q2bsp_qbism_t>());
-    } else if (bspdata->version == &bspver_q1 || bspdata->version == &bspver_h2 || bspdata->version == &bspver_hl) {
-        ReadQ1BSP(reader, bspdata->bsp.emplace<bsp29_t>());
-    } else if (bspdata->version == &bspver_bsp2rmq || bspdata->version == &bspver_h2bsp2rmq) {
-        ReadQ1BSP(reader, bspdata->bsp.emplace<bsp2rmq_t>());
-    } else if (bspdata->version == &bspver_bsp2 || bspdata->version == &bspver_h2bsp2) {
-        ReadQ1BSP(reader, bspdata->bsp.emplace<bsp2_t>());
-    } else {
-        FError("Unknown format");
+        logging::print("BSP is version {}\n", *view.version);
     }
 
-    size_t bspxofs;
+    size_t bspxofs = 0;
 
     // detect BSPX
     /*bspx header is positioned exactly+4align at the end of the last lump position (regardless of order)*/
-    for (i = 0, bspxofs = 0; i < lumps.size(); i++) {
-        bspxofs = std::max(bspxofs, static_cast<size_t>(lumps[i].fileofs + lumps[i].filelen));
+    for (auto &lump : view.lumps) {
+        bspxofs = std::max(bspxofs, static_cast<size_t>(lump.fileofs + lump.filelen));
     }
 
     bspxofs = (bspxofs + 3) & ~3;
 
     /*okay, so that's where it *should* be if it exists */
-    if (bspxofs + sizeof(bspx_header_t) <= file_data->size()) {
+    if (bspxofs + sizeof(bspx_header_t) <= file.size()) {
         stream.seekg(bspxofs);
 
         bspx_header_t bspx;
@@ -2370,7 +2427,7 @@ void LoadBSPFile(fs::path &filename, bspdata_t *bspdata)
 
         if (!stream || memcmp(bspx.id.data(), "BSPX", 4)) {
             logging::print("WARNING: invalid BSPX header\n");
-            return;
+            return view;
         }
 
         for (size_t i = 0; i < bspx.numlumps; i++) {
@@ -2378,18 +2435,85 @@ void LoadBSPFile(fs::path &filename, bspdata_t *bspdata)
 
             if (!(stream >= xlump)) {
                 logging::print("WARNING: invalid BSPX lump at index {}\n", i);
-                return;
+                return view;
             }
 
-            if (xlump.fileofs > file_data->size() || (xlump.fileofs + xlump.filelen) > file_data->size()) {
+            if (xlump.fileofs > file.size() || (xlump.fileofs + xlump.filelen) > file.size()) {
                 logging::print("WARNING: invalid BSPX lump at index {}\n", i);
-                return;
+                return view;
             }
 
-            bspdata->bspx.transfer(xlump.lumpname.data(), std::vector<uint8_t>(file_data->begin() + xlump.fileofs,
-                                                              file_data->begin() + xlump.fileofs + xlump.filelen));
+            view.bspx.insert_or_assign(xlump.lumpname.data(), file.subspan(xlump.fileofs, xlump.filelen));
         }
     }
+
+    return view;
+}
+
+static void ReadBSPLumps(const bspfile_view_t &view, bspdata_t *bspdata, std::vector<bool> wanted)
+{
+    bspdata->version = view.version;
+
+    const auto file = view.data();
+    imemstream stream(file.data(), file.size());
+
+    stream >> endianness<std::endian::little>;
+
+    lump_reader reader{stream, bspdata->version, view.lumps, std::move(wanted)};
+
+    /* copy the data */
+    if (bspdata->version == &bspver_q2) {
+        ReadQ2BSP(reader, bspdata->bsp.emplace<q2bsp_t>());
+    } else if (bspdata->version == &bspver_qbism) {
+        ReadQ2BSP(reader, bspdata->bsp.emplace<q2bsp_qbism_t>());
+    } else if (bspdata->version == &bspver_q1 || bspdata->version == &bspver_h2 || bspdata->version == &bspver_hl) {
+        ReadQ1BSP(reader, bspdata->bsp.emplace<bsp29_t>());
+    } else if (bspdata->version == &bspver_bsp2rmq || bspdata->version == &bspver_h2bsp2rmq) {
+        ReadQ1BSP(reader, bspdata->bsp.emplace<bsp2rmq_t>());
+    } else if (bspdata->version == &bspver_bsp2 || bspdata->version == &bspver_h2bsp2) {
+        ReadQ1BSP(reader, bspdata->bsp.emplace<bsp2_t>());
+    } else {
+        FError("Unknown format");
+    }
+}
+
+/*
+ * =============
+ * LoadBSPLumps
+ * =============
+ */
+void LoadBSPLumps(const bspfile_view_t &view, bspdata_t *bspdata, const std::vector<std::string_view> &lump_names)
+{
+    std::vector<bool> wanted(view.version->lumps.size());
+
+    for (size_t i = 0; i < wanted.size(); i++) {
+        const std::string_view name = view.version->lumps.begin()[i].name;
+        wanted[i] = std::find(lump_names.begin(), lump_names.end(), name) != lump_names.end();
+    }
+
+    ReadBSPLumps(view, bspdata, std::move(wanted));
+}
+
+/*
+ * =============
+ * LoadBSPFile
+ * =============
+ */
+void LoadBSPFile(fs::path &filename, bspdata_t *bspdata)
+{
+    logging::funcprint("'{}'\n", filename);
+
+    bspdata->file = filename;
+
+    const bspfile_view_t view = OpenBSPFile(filename);
+
+    filename = fs::resolveArchivePath(filename);
+
+    ReadBSPLumps(view, bspdata, {});
+
+    for (auto &[name, xdata] : view.bspx) {
+        bspdata->bspx.transfer(name.c_str(), std::vector<uint8_t>(xdata.begin(), xdata.end()));
+    }
 }
 
 /* ========================================================================= */
@@ -2406,12 +2530,38 @@ struct bspfile_t
         q2_dheader_t q2header;
     };
 
-    std::ofstream stream;
+    std::ostream &stream;
+
+    inline bspfile_t(std::ostream &stream, const bspversion_t *version)
+        : version(version),
+          q2header{},
+          stream(stream)
+    {
+        // headers are union'd, so this sets both
+        q2header.ident = version->ident;
+
+        if (version->version.has_value()) {
+            q2header.version = version->version.value();
+        }
+    }
+
+    inline void write_header()
+    {
+        if (version->version.has_value()) {
+            stream <= q2header;
+        } else {
+            stream <= q1header;
+        }
+    }
 
 private:
-    // write structured lump data from vector
-    template<typename T>
-    inline void write_lump(size_t lump_num, const std::vector<T> &data)
+    template<typename V>
+    using element_t = typename V::value_type;
+
+    // write structured lump data from vector, converting each element
+    // to T as it's written
+    template<typename T, typename F>
+    inline void write_lump_as(size_t lump_num, const std::vector<F> &data)
     {
         Q_assert(version->lumps.size() > lump_num);
         const lumpspec_t &lumpspec = version->lumps.begin()[lump_num];
@@ -2427,8 +2577,12 @@ private:
 
         lump.fileofs = stream.tellp();
 
-        for (auto &v : data)
-            stream <= v;
+        for (auto &v : data) {
+            if constexpr (std::is_same_v<T, F>)
+                stream <= v;
+            else
+                stream <= ConvertElement<T>(v);
+        }
 
         auto written = static_cast<int32_t>(stream.tellp()) - lump.fileofs;
 
@@ -2441,6 +2595,13 @@ private:
             stream <= padding_n(4 - (written % 4));
     }
 
+    // write structured lump data from vector
+    template<typename T>
+    inline void write_lump(size_t lump_num, const std::vector<T> &data)
+    {
+        write_lump_as<T>(lump_num, data);
+    }
+
     // this is only here to satisfy std::visit
     constexpr void write_lump(size_t, const std::monostate &) { }
 
@@ -2553,6 +2714,74 @@ public:
         write_lump(Q2_LUMP_ENTITIES, bsp.dentdata);
     }
 
+    // write a generic BSP in the layout of T, converting one lump at a
+    // time instead of building a whole T first
+    template<typename T, typename std::enable_if_t<std::is_base_of_v<q1bsp_tag_t, T>, int> = 0>
+    inline void write_bsp_as(const mbsp_t &bsp)
+    {
+        write_lump_as<element_t<decltype(T::dplanes)>>(LUMP_PLANES, bsp.dplanes);
+        write_lump_as<element_t<decltype(T::dleafs)>>(LUMP_LEAFS, bsp.dleafs);
+        write_lump_as<element_t<decltype(T::dvertexes)>>(LUMP_VERTEXES, bsp.dvertexes);
+        write_lump_as<element_t<decltype(T::dnodes)>>(LUMP_NODES, bsp.dnodes);
+        write_lump_as<element_t<decltype(T::texinfo)>>(LUMP_TEXINFO, bsp.texinfo);
+        write_lump_as<element_t<decltype(T::dfaces)>>(LUMP_FACES, bsp.dfaces);
+        write_lump_as<element_t<decltype(T::dclipnodes)>>(LUMP_CLIPNODES, bsp.dclipnodes);
+        write_lump_as<element_t<decltype(T::dmarksurfaces)>>(LUMP_MARKSURFACES, bsp.dleaffaces);
+        write_lump_as<element_t<decltype(T::dsurfedges)>>(LUMP_SURFEDGES, bsp.dsurfedges);
+        write_lump_as<element_t<decltype(T::dedges)>>(LUMP_EDGES, bsp.dedges);
+        if (version->game->id == GAME_HEXEN_II) {
+            write_lump_as<element_t<dmodelh2_vector>>(LUMP_MODELS, bsp.dmodels);
+        } else {
+            write_lump_as<element_t<dmodelq1_vector>>(LUMP_MODELS, bsp.dmodels);
+        }
+
+        write_lump(LUMP_LIGHTING, bsp.dlightdata);
+        write_lump(LUMP_VISIBILITY, bsp.dvis.bits);
+        write_lump(LUMP_ENTITIES, bsp.dentdata);
+        write_lump(LUMP_TEXTURES, bsp.dtex);
+    }
+
+    template<typename T, typename std::enable_if_t<std::is_base_of_v<q2bsp_tag_t, T>, int> = 0>
+    inline void write_bsp_as(const mbsp_t &bsp)
+    {
+        write_lump_as<element_t<decltype(T::dplanes)>>(Q2_LUMP_PLANES, bsp.dplanes);
+        write_lump_as<element_t<decltype(T::dleafs)>>(Q2_LUMP_LEAFS, bsp.dleafs);
+        write_lump_as<element_t<decltype(T::dvertexes)>>(Q2_LUMP_VERTEXES, bsp.dvertexes);
+        write_lump_as<element_t<decltype(T::dnodes)>>(Q2_LUMP_NODES, bsp.dnodes);
+        write_lump_as<element_t<decltype(T::texinfo)>>(Q2_LUMP_TEXINFO, bsp.texinfo);
+        write_lump_as<element_t<decltype(T::dfaces)>>(Q2_LUMP_FACES, bsp.dfaces);
+        write_lump_as<element_t<decltype(T::dleaffaces)>>(Q2_LUMP_LEAFFACES, bsp.dleaffaces);
+        write_lump_as<element_t<decltype(T::dsurfedges)>>(Q2_LUMP_SURFEDGES, bsp.dsurfedges);
+        write_lump_as<element_t<decltype(T::dedges)>>(Q2_LUMP_EDGES, bsp.dedges);
+        write_lump_as<element_t<decltype(T::dmodels)>>(Q2_LUMP_MODELS, bsp.dmodels);
+        write_lump_as<element_t<decltype(T::dleafbrushes)>>(Q2_LUMP_LEAFBRUSHES, bsp.dleafbrushes);
+        write_lump_as<element_t<decltype(T::dbrushes)>>(Q2_LUMP_BRUSHES, bsp.dbrushes);
+        write_lump_as<element_t<decltype(T::dbrushsides)>>(Q2_LUMP_BRUSHSIDES, bsp.dbrushsides);
+        write_lump_as<element_t<decltype(T::dareas)>>(Q2_LUMP_AREAS, bsp.dareas);
+        write_lump_as<element_t<decltype(T::dareaportals)>>(Q2_LUMP_AREAPORTALS, bsp.dareaportals);
+
+        write_lump(Q2_LUMP_LIGHTING, bsp.dlightdata);
+        write_lump(Q2_LUMP_VISIBILITY, bsp.dvis);
+        write_lump(Q2_LUMP_ENTITIES, bsp.dentdata);
+    }
+
+    inline void write_bsp_as(const mbsp_t &bsp)
+    {
+        if (version == &bspver_q1 || version == &bspver_h2 || version == &bspver_hl) {
+            write_bsp_as<bsp29_t>(bsp);
+        } else if (version == &bspver_q2) {
+            write_bsp_as<q2bsp_t>(bsp);
+        } else if (version == &bspver_qbism) {
+            write_bsp_as<q2bsp_qbism_t>(bsp);
+        } else if (version == &bspver_bsp2rmq || version == &bspver_h2bsp2rmq) {
+            write_bsp_as<bsp2rmq_t>(bsp);
+        } else if (version == &bspver_bsp2 || version == &bspver_h2bsp2) {
+            write_bsp_as<bsp2_t>(bsp);
+        } else {
+            FError("Can't write generic BSP as {}", *version);
+        }
+    }
+
     inline void write_bspx(const bspdata_t &bspdata)
     {
         if (!bspdata.bspx.entries.size())
@@ -2592,53 +2821,146 @@ public:
     }
 };
 
+// reserves the header, lets write_lumps fill in the lumps, then appends
+// BSPX and goes back to write the real header. lumps are converted as they're
+// written and can still fail with "LIMITS EXCEEDED", so this writes to a
+// temporary file and only replaces `filename` (often the input .bsp) once
+// the whole file has been written.
+template<typename F>
+static void WriteBSPFileLumps(
+    const fs::path &filename, const bspdata_t &bspdata, const bspversion_t *version, F &&write_lumps)
+{
+    logging::print("Writing {} as {}\n", filename, *version);
+
+    fs::path tmpfilename = filename;
+    tmpfilename += ".tmp";
+
+    std::ofstream stream(tmpfilename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+
+    if (!stream)
+        FError("unable to open {} for writing", tmpfilename);
+
+    try {
+        stream << endianness<std::endian::little>;
+
+        bspfile_t bspfile(stream, version);
+
+        /* Save header space, updated after adding the lumps */
+        bspfile.write_header();
+
+        write_lumps(bspfile);
+
+        /*BSPX lumps are at a 4-byte alignment after the last of any official lump*/
+        bspfile.write_bspx(bspdata);
+
+        stream.seekp(0);
+
+        // write the real header
+        bspfile.write_header();
+
+        if (!stream)
+            FError("error writing {}", tmpfilename);
+
+        stream.close();
+    } catch (...) {
+        stream.close();
+        fs::remove(tmpfilename);
+        throw;
+    }
+
+    std::error_code ec;
+
+    fs::remove(filename, ec);
+    if (ec && ec.value() != ENOENT)
+        FError("error removing old {} ({})", filename, ec.message());
+
+    fs::rename(tmpfilename, filename, ec);
+    if (ec)
+        FError("error renaming {} to {} ({})", tmpfilename, filename, ec.message());
+}
+
 /*
  * =============
  * WriteBSPFile
- * Swaps the bsp file in place, so it should not be referenced again
  * =============
  */
 void WriteBSPFile(const fs::path &filename, bspdata_t *bspdata)
 {
-    bspfile_t bspfile{};
-
-    bspfile.version = bspdata->version;
+    WriteBSPFileLumps(filename, *bspdata, bspdata->version,
+        [bspdata](bspfile_t &bspfile) { std::visit([&bspfile](auto &&arg) { bspfile.write_bsp(arg); }, bspdata->bsp); });
+}
 
-    // headers are union'd, so this sets both
-    bspfile.q2header.ident = bspfile.version->ident;
+// throws away everything written to it, but keeps track of the position
+struct discardbuf_t : std::streambuf
+{
+    std::streamoff pos = 0;
 
-    if (bspfile.version->version.has_value()) {
-        bspfile.q2header.version = bspfile.version->version.value();
+protected:
+    std::streamsize xsputn(const char_type *, std::streamsize n) override
+    {
+        pos += n;
+        return n;
     }
 
-    logging::print("Writing {} as {}\n", filename, *bspdata->version);
-    bspfile.stream.open(filename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
-
-    if (!bspfile.stream)
-        FError("unable to open {} for writing", filename);
+    int_type overflow(int_type ch) override
+    {
+        pos++;
+        return traits_type::not_eof(ch);
+    }
 
-    bspfile.stream << endianness<std::endian::little>;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override
+    {
+        if (dir == std::ios_base::cur)
+            pos += off;
+        else if (dir == std::ios_base::beg)
+            pos = off;
+        else
+            return pos_type(off_type(-1));
 
-    /* Save header space, updated after adding the lumps */
-    if (bspfile.version->version.has_value()) {
-        bspfile.stream <= bspfile.q2header;
-    } else {
-        bspfile.stream <= bspfile.q1header;
+        return pos;
     }
 
-    std::visit([&bspfile](auto &&arg) { bspfile.write_bsp(arg); }, bspdata->bsp);
+    pos_type seekpos(pos_type off, std::ios_base::openmode) override { return pos = off; }
+};
 
-    /*BSPX lumps are at a 4-byte alignment after the last of any official lump*/
-    bspfile.write_bspx(*bspdata);
+/*
+ * =============
+ * BSPFitsFormat
+ * =============
+ */
+bool BSPFitsFormat(const bspdata_t *bspdata, const bspversion_t *to_version)
+{
+    // convert everything without keeping any of it
+    discardbuf_t buf;
+    std::ostream stream(&buf);
+    stream << endianness<std::endian::little>;
 
-    bspfile.stream.seekp(0);
+    bspfile_t bspfile(stream, to_version);
 
-    // write the real header
-    if (bspfile.version->version.has_value()) {
-        bspfile.stream <= bspfile.q2header;
-    } else {
-        bspfile.stream <= bspfile.q1header;
+    try {
+        bspfile.write_bsp_as(std::get<mbsp_t>(bspdata->bsp));
+    } catch (std::overflow_error e) {
+        logging::print("LIMITS EXCEEDED ON {}\n", e.what());
+        return false;
     }
+
+    return true;
+}
+
+/*
+ * =============
+ * WriteBSPFile
+ * =============
+ */
+void WriteBSPFile(const fs::path &filename, const bspdata_t *bspdata, const bspversion_t *to_version)
+{
+    WriteBSPFileLumps(filename, *bspdata, to_version, [bspdata](bspfile_t &bspfile) {
+        try {
+            bspfile.write_bsp_as(std::get<mbsp_t>(bspdata->bsp));
+        } catch (std::overflow_error e) {
+            FError("LIMITS EXCEEDED ON {}", e.what());
+        }
+    });
 }
 
 /* ========================================================================= */
@@ -2697,6 +3019,58 @@ inline void PrintQ2BSPLumps(const std::initializer_list<lumpspec_t> &lumpspec, c
     logging::print("{:7} {:<12} {:10}\n", "", "entdata", bsp.dentdata.size() + 1); // include the null terminator
 }
 
+inline void PrintGenericBSPLumps(const bspversion_t *version, const mbsp_t &bsp)
+{
+    const auto &lumpspec = version->lumps;
+
+    if (version->game->id != GAME_QUAKE_II) {
+        PrintLumpSize(lumpspec.begin()[LUMP_MODELS], bsp.dmodels.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_PLANES], bsp.dplanes.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_VERTEXES], bsp.dvertexes.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_NODES], bsp.dnodes.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_TEXINFO], bsp.texinfo.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_FACES], bsp.dfaces.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_CLIPNODES], bsp.dclipnodes.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_LEAFS], bsp.dleafs.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_MARKSURFACES], bsp.dleaffaces.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_EDGES], bsp.dedges.size());
+        PrintLumpSize(lumpspec.begin()[LUMP_SURFEDGES], bsp.dsurfedges.size());
+
+        logging::print("{:7} {:<12} {:10}\n", bsp.dtex.textures.size(), "textures", bsp.dtex.stream_size());
+    } else {
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_MODELS], bsp.dmodels.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_PLANES], bsp.dplanes.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_VERTEXES], bsp.dvertexes.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_NODES], bsp.dnodes.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_TEXINFO], bsp.texinfo.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_FACES], bsp.dfaces.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_LEAFS], bsp.dleafs.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_LEAFFACES], bsp.dleaffaces.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_LEAFBRUSHES], bsp.dleafbrushes.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_EDGES], bsp.dedges.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_SURFEDGES], bsp.dsurfedges.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_BRUSHES], bsp.dbrushes.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_BRUSHSIDES], bsp.dbrushsides.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_AREAS], bsp.dareas.size());
+        PrintLumpSize(lumpspec.begin()[Q2_LUMP_AREAPORTALS], bsp.dareaportals.size());
+    }
+
+    logging::print("{:7} {:<12} {:10}\n", "", "lightdata", bsp.dlightdata.size());
+    logging::print("{:7} {:<12} {:10}\n", "", "visdata", bsp.dvis.bits.size());
+    logging::print("{:7} {:<12} {:10}\n", "", "entdata", bsp.dentdata.size() + 1); // include the null terminator
+}
+
+static void PrintBSPXSizes(const bspdata_t *bspdata)
+{
+    if (bspdata->bspx.entries.size()) {
+        logging::print("\n{:<16} {:10}\n", "BSPX lump name", "byte size");
+
+        for (auto &x : bspdata->bspx.entries) {
+            logging::print("{:<16} {:10}\n", x.first, x.second.size());
+        }
+    }
+}
+
 /*
  * =============
  * PrintBSPFileSizes
@@ -2723,11 +3097,14 @@ void PrintBSPFileSizes(const bspdata_t *bspdata)
         Error("Unsupported BSP version: {}", *bspdata->version);
     }
 
-    if (bspdata->bspx.entries.size()) {
-        logging::print("\n{:<16} {:10}\n", "BSPX lump name", "byte size");
+    PrintBSPXSizes(bspdata);
+}
 
-        for (auto &x : bspdata->bspx.entries) {
-            logging::print("{:<16} {:10}\n", x.first, x.second.size());
-        }
-    }
+void PrintBSPFileSizes(const bspdata_t *bspdata, const bspversion_t *as_version)
+{
+    logging::print("\n{:7} {:<12} {:10}\n", "count", "lump name", "byte size");
+
+    PrintGenericBSPLumps(as_version, std::get<mbsp_t>(bspdata->bsp));
+
+    PrintBSPXSizes(bspdata);
 }
@@ -34,6 +34,7 @@
 #include <common/log.hh>
 #include <common/settings.hh>
 #include <common/cmdlib.hh>
+#include <common/profile.hh>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -95,6 +96,8 @@ void init(std::optional<fs::path> filename, const settings::common_settings &set
 
 void close()
 {
+    profile::end_trace();
+
     if (logfile) {
         fmt::print(logfile, "\n\n");
         logfile.close();
@@ -109,12 +112,50 @@ void set_print_callback(print_callback_t cb)
     active_print_callback = cb;
 }
 
+static thread_local buffer_t *thread_buffer = nullptr;
+
+buffer_scope::buffer_scope(buffer_t *buffer)
+    : previous(thread_buffer)
+{
+    thread_buffer = buffer;
+}
+
+buffer_scope::~buffer_scope()
+{
+    thread_buffer = previous;
+}
+
+buffer_t *current_buffer()
+{
+    return thread_buffer;
+}
+
+void buffer_t::flush(bitflags<flag> allowed)
+{
+    std::unique_lock lock(mutex);
+    auto flushed = std::move(lines);
+    lines.clear();
+    lock.unlock();
+
+    for (auto &[logflag, str] : flushed) {
+        if (allowed & logflag) {
+            print(logflag, str.c_str());
+        }
+    }
+}
+
 void print(flag logflag, const char *str)
 {
     if (!(mask & logflag)) {
         return;
     }
 
+    if (thread_buffer) {
+        std::scoped_lock lock(thread_buffer->mutex);
+        thread_buffer->lines.emplace_back(logflag, str);
+        return;
+    }
+
     if (active_print_callback) {
         active_print_callback(logflag, str);
     }
@@ -235,6 +276,33 @@ void set_percent_callback(percent_callback_t cb)
     active_percent_callback = cb;
 }
 
+// percent() for a buffered thread; the progress itself is dropped,
+// only the time elapsed makes it into the buffer
+static void buffered_percent(buffer_t &buffer, uint64_t count, uint64_t max, bool displayElapsed)
+{
+    if (count != max) {
+        if (!buffer.is_timing.load(std::memory_order_relaxed)) {
+            std::scoped_lock lock(buffer.mutex);
+            if (!buffer.is_timing) {
+                buffer.start_time = I_FloatTime();
+                buffer.is_timing = true;
+            }
+        }
+        return;
+    }
+
+    std::unique_lock lock(buffer.mutex);
+    duration elapsed{};
+    if (buffer.is_timing.exchange(false)) {
+        elapsed = I_FloatTime() - buffer.start_time;
+    }
+    lock.unlock();
+
+    if (displayElapsed) {
+        print(flag::PERCENT, "{} time elapsed: {:%H:%M:%S}\n", max == indeterminate ? "[done]" : "[100%]", elapsed);
+    }
+}
+
 void percent(uint64_t count, uint64_t max, bool displayElapsed)
 {
     bool expected = false;
@@ -243,6 +311,11 @@ void percent(uint64_t count, uint64_t max, bool displayElapsed)
         displayElapsed = false;
     }
 
+    if (thread_buffer) {
+        buffered_percent(*thread_buffer, count, max, displayElapsed);
+        return;
+    }
+
     if (count == max) {
         while (!locked.compare_exchange_weak(expected, true))
             ; // wait until everybody else is done
@@ -345,6 +418,7 @@ void percent_clock::increase()
     }
 #endif
 
+    buffer_scope scope(buffer);
     percent(count++, max, displayElapsed);
 }
 
@@ -374,6 +448,7 @@ void percent_clock::print()
     }
 #endif
 
+    buffer_scope scope(buffer);
     percent(max, max, displayElapsed);
 }
 
@@ -0,0 +1,175 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <common/profile.hh>
+#include <common/log.hh>
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <fmt/ostream.h>
+
+namespace profile
+{
+std::atomic_bool enabled = false;
+
+// events kept per thread; older ones are overwritten
+static constexpr size_t RING_SIZE = 1 << 16;
+
+struct thread_buffer_t
+{
+    std::thread::id thread;
+    uint32_t tid;
+    std::vector<event_t> events = std::vector<event_t>(RING_SIZE);
+    // total events recorded; the next one goes in events[count % RING_SIZE]
+    size_t count = 0;
+
+    std::vector<event_t> ordered() const
+    {
+        std::vector<event_t> result;
+
+        if (count <= RING_SIZE) {
+            result.assign(events.begin(), events.begin() + count);
+        } else {
+            size_t head = count % RING_SIZE;
+            result.assign(events.begin() + head, events.end());
+            result.insert(result.end(), events.begin(), events.begin() + head);
+        }
+
+        return result;
+    }
+};
+
+// buffers are never freed, since worker threads hold on to theirs
+// for their whole lifetime
+static std::mutex buffers_mutex;
+static std::vector<std::unique_ptr<thread_buffer_t>> buffers;
+static thread_local thread_buffer_t *local_buffer = nullptr;
+
+static std::chrono::steady_clock::time_point trace_start;
+static std::thread::id trace_thread;
+static fs::path trace_filename;
+
+static thread_buffer_t &get_local_buffer()
+{
+    if (!local_buffer) {
+        std::scoped_lock lock(buffers_mutex);
+        auto &buffer = buffers.emplace_back(std::make_unique<thread_buffer_t>());
+        buffer->thread = std::this_thread::get_id();
+        buffer->tid = static_cast<uint32_t>(buffers.size() - 1);
+        local_buffer = buffer.get();
+    }
+
+    return *local_buffer;
+}
+
+void begin_trace(const fs::path &filename)
+{
+    std::scoped_lock lock(buffers_mutex);
+
+    for (auto &buffer : buffers) {
+        buffer->count = 0;
+    }
+
+    trace_filename = filename;
+    trace_thread = std::this_thread::get_id();
+    trace_start = std::chrono::steady_clock::now();
+    enabled = true;
+}
+
+uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_start)
+        .count();
+}
+
+void record(const char *name, uint64_t begin, uint64_t end)
+{
+    thread_buffer_t &buffer = get_local_buffer();
+    buffer.events[buffer.count % RING_SIZE] = {name, begin, end};
+    buffer.count++;
+}
+
+std::vector<event_t> thread_events()
+{
+    return get_local_buffer().ordered();
+}
+
+void end_trace()
+{
+    if (!enabled) {
+        return;
+    }
+
+    enabled = false;
+
+    std::scoped_lock lock(buffers_mutex);
+
+    std::ofstream f(trace_filename);
+
+    if (!f) {
+        logging::print("WARNING: can't write trace to {}\n", trace_filename.string());
+        return;
+    }
+
+    size_t num_events = 0, num_dropped = 0;
+    bool first = true;
+
+    auto separator = [&]() -> const char * {
+        if (first) {
+            first = false;
+            return "\n";
+        }
+        return ",\n";
+    };
+
+    fmt::print(f, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for (auto &buffer : buffers) {
+        if (!buffer->count) {
+            continue;
+        }
+
+        const bool is_main = buffer->thread == trace_thread;
+
+        fmt::print(f, "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+            separator(), buffer->tid, is_main ? "main" : fmt::format("worker {}", buffer->tid));
+        fmt::print(f, ",\n{{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"sort_index\":{}}}}}",
+            buffer->tid, is_main ? -1 : static_cast<int>(buffer->tid));
+
+        for (const event_t &e : buffer->ordered()) {
+            fmt::print(f, ",\n{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}", e.name,
+                buffer->tid, e.begin / 1000.0, (e.end - e.begin) / 1000.0);
+        }
+
+        num_events += std::min(buffer->count, RING_SIZE);
+        num_dropped += buffer->count - std::min(buffer->count, RING_SIZE);
+    }
+
+    fmt::print(f, "\n]}}\n");
+
+    logging::print("wrote {} trace events to {}\n", num_events, trace_filename.string());
+
+    if (num_dropped) {
+        logging::print("WARNING: {} older trace events were dropped\n", num_dropped);
+    }
+}
+} // namespace profile
@@ -24,6 +24,14 @@
 #include <common/bspfile.hh>
 #include <common/ostream.hh>
 
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <map>
 
@@ -31,17 +39,114 @@ constexpr const char *PORTALFILE = "PRT1";
 constexpr const char *PORTALFILE2 = "PRT2";
 constexpr const char *PORTALFILEAM = "PRT1-AM";
 
+/*
+ * Binary portal file, little endian:
+ *
+ * char[4]  magic "PRTB"
+ * uint32   version
+ * int32    portalleafs
+ * int32    portalleafs_real (== portalleafs when there is no cluster map)
+ * uint32   numportals
+ * uint32   numpoints, total over all portals
+ * numportals x { uint32 numpoints; int32 leafnums[2]; }
+ * numpoints x double[3], the portal windings back to back
+ * uint32   cluster map size (0 or portalleafs_real)
+ * cluster map size x int32 cluster, for each leaf
+ */
+constexpr const char PORTALFILEBINARY[4] = {'P', 'R', 'T', 'B'};
+constexpr uint32_t PORTALFILEBINARY_VERSION = 1;
+
 constexpr size_t PRT_MAX_WINDING = 64;
 
-prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion)
+/*
+ * Tokenizer for the text formats; integers are parsed in place with
+ * std::from_chars, coordinates with strtod (floating point from_chars is
+ * missing from older libc++), so the text must be followed by a NUL.
+ */
+struct prt_text_parser_t
+{
+    const char *pos, *end;
+
+    void skip_whitespace()
+    {
+        while (pos < end && std::isspace(static_cast<unsigned char>(*pos)))
+            pos++;
+    }
+
+    std::string_view line()
+    {
+        const char *start = pos;
+        pos = std::find(pos, end, '\n');
+        std::string_view result(start, pos - start);
+        if (pos < end)
+            pos++;
+        if (!result.empty() && result.back() == '\r')
+            result.remove_suffix(1);
+        return result;
+    }
+
+    bool parse(int &value)
+    {
+        skip_whitespace();
+        auto [ptr, ec] = std::from_chars(pos, end, value);
+        if (ec != std::errc())
+            return false;
+        pos = ptr;
+        return true;
+    }
+
+    bool parse(double &value)
+    {
+        skip_whitespace();
+        if (pos == end)
+            return false;
+        char *ptr;
+        value = strtod(pos, &ptr);
+        if (ptr == pos || ptr > end)
+            return false;
+        pos = ptr;
+        return true;
+    }
+
+    // moves past the next `c`
+    bool skip_past(char c)
+    {
+        pos = std::find(pos, end, c);
+        if (pos == end)
+            return false;
+        pos++;
+        return true;
+    }
+};
+
+static void CheckPortal(const prtfile_t &result, const prtfile_portal_t &p, size_t numpoints, size_t i)
 {
-    std::ifstream f(name);
+    if (numpoints > PRT_MAX_WINDING)
+        FError("portal {} has too many points", i);
+    if ((unsigned)p.leafnums[0] > (unsigned)result.portalleafs ||
+        (unsigned)p.leafnums[1] > (unsigned)result.portalleafs)
+        FError("out of bounds leaf in portal {}", i);
+}
+
+// No clusters, e.g. Quake 1, PRT1 (no func_detail).
+// Assign the identity cluster numbers for consistency
+static void SetIdentityClusters(prtfile_t &result)
+{
+    result.dleafinfos.resize(result.portalleafs + 1);
+
+    for (int i = 0; i < result.portalleafs; i++) {
+        result.dleafinfos[i + 1].cluster = i;
+    }
+}
+
+static prtfile_t LoadTextPrtFile(const fs::path &name, std::string_view contents, const bspversion_t *loadversion)
+{
+    prt_text_parser_t f{contents.data(), contents.data() + contents.size()};
 
     /*
      * Parse the portal file header
      */
-    std::string magic;
-    std::getline(f, magic);
+    const std::string_view magic = f.line();
     if (magic.empty()) {
         FError("unknown header/empty portal file {}\n", name);
     }
@@ -50,9 +155,7 @@ prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion)
     int numportals;
 
     if (magic == PORTALFILE) {
-        f >> result.portalleafs >> numportals;
-
-        if (f.bad())
+        if (!f.parse(result.portalleafs) || !f.parse(numportals))
             FError("unable to parse {} header\n", PORTALFILE);
 
         if (loadversion->game->id == GAME_QUAKE_II) {
@@ -65,48 +168,34 @@ prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion)
         if (loadversion->game->id == GAME_QUAKE_II) {
             FError("{} can not be used with Q2\n", PORTALFILE2);
         }
-        f >> result.portalleafs_real >> result.portalleafs >> numportals;
-
-        if (f.bad())
-            FError("unable to parse {} header\n", PORTALFILE);
+        if (!f.parse(result.portalleafs_real) || !f.parse(result.portalleafs) || !f.parse(numportals))
+            FError("unable to parse {} header\n", PORTALFILE2);
     } else if (magic == PORTALFILEAM) {
         if (loadversion->game->id == GAME_QUAKE_II) {
             FError("{} can not be used with Q2\n", PORTALFILEAM);
         }
-        f >> result.portalleafs >> numportals >> result.portalleafs_real;
-
-        if (f.bad())
-            FError("unable to parse {} header\n", PORTALFILE);
+        if (!f.parse(result.portalleafs) || !f.parse(numportals) || !f.parse(result.portalleafs_real))
+            FError("unable to parse {} header\n", PORTALFILEAM);
     } else {
         FError("unknown header: {}\n", magic);
     }
 
+    result.portals.reserve(std::max(numportals, 0));
+
     for (int i = 0; i < numportals; i++) {
         prtfile_portal_t p;
         int numpoints;
 
-        f >> numpoints >> p.leafnums[0] >> p.leafnums[1];
-        if (f.bad())
+        if (!f.parse(numpoints) || !f.parse(p.leafnums[0]) || !f.parse(p.leafnums[1]))
             FError("reading portal {}", i);
-        if (numpoints > PRT_MAX_WINDING)
-            FError("portal {} has too many points", i);
-        if ((unsigned)p.leafnums[0] > (unsigned)result.portalleafs ||
-            (unsigned)p.leafnums[1] > (unsigned)result.portalleafs)
-            FError("out of bounds leaf in portal {}", i);
+        CheckPortal(result, p, static_cast<size_t>(numpoints), i);
 
         auto &w = p.winding;
         w.resize(numpoints);
 
         for (int j = 0; j < numpoints; j++) {
-            while (!f.bad() && f.get() != '(')
-                ;
-
-            f >> w[j][0] >> w[j][1] >> w[j][2];
-
-            while (!f.bad() && f.get() != ')')
-                ;
-
-            if (f.bad())
+            if (!f.skip_past('(') || !f.parse(w[j][0]) || !f.parse(w[j][1]) || !f.parse(w[j][2]) ||
+                !f.skip_past(')'))
                 FError("reading portal {}", i);
         }
 
@@ -120,14 +209,7 @@ prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion)
 
     // No clusters
     if (result.portalleafs == result.portalleafs_real) {
-        // e.g. Quake 1, PRT1 (no func_detail).
-        // Assign the identity cluster numbers for consistency
-
-        result.dleafinfos.resize(result.portalleafs + 1);
-
-        for (int i = 0; i < result.portalleafs; i++) {
-            result.dleafinfos[i + 1].cluster = i;
-        }
+        SetIdentityClusters(result);
         return result;
     }
 
@@ -136,18 +218,18 @@ prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion)
 
         int i;
         for (i = 0; i < result.portalleafs; i++) {
-            while (1) {
-                int leafnum;
-                f >> leafnum;
-                if (f.bad() || f.eof())
-                    break;
-                if (leafnum < 0)
+            bool terminated = false;
+            int leafnum;
+            while (f.parse(leafnum)) {
+                if (leafnum < 0) {
+                    terminated = true;
                     break;
+                }
                 if (leafnum >= result.portalleafs_real)
                     FError("Invalid leaf number in cluster map ({} >= {})", leafnum, result.portalleafs_real);
                 result.dleafinfos[leafnum + 1].cluster = i;
             }
-            if (f.bad() || f.eof())
+            if (!terminated)
                 break;
         }
         if (i < result.portalleafs)
@@ -157,8 +239,7 @@ prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion)
 
         for (int i = 0; i < result.portalleafs_real; i++) {
             int clusternum;
-            f >> clusternum;
-            if (f.bad() || f.eof()) {
+            if (!f.parse(clusternum)) {
                 Error("Unexpected end of cluster map\n");
             }
             if (clusternum < 0 || clusternum >= result.portalleafs) {
@@ -174,6 +255,109 @@ prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion)
     return result;
 }
 
+static prtfile_t LoadBinaryPrtFile(const fs::path &name, std::string_view contents, const bspversion_t *loadversion)
+{
+    imemstream stream(contents.data(), contents.size());
+    stream >> endianness<std::endian::little>;
+
+    std::array<char, 4> magic;
+    uint32_t version, numportals, numpoints;
+    prtfile_t result{};
+
+    stream >= std::tie(magic, version, result.portalleafs, result.portalleafs_real, numportals, numpoints);
+
+    if (!stream)
+        FError("unable to parse {} header\n", name);
+    if (version != PORTALFILEBINARY_VERSION)
+        FError("{} has unsupported version {} (expected {})\n", name, version, PORTALFILEBINARY_VERSION);
+
+    // check the counts fit in the file before allocating for them
+    constexpr size_t header_size = 24, portal_size = 12, point_size = 24, clustermap_header_size = 4;
+    if (contents.size() <
+        header_size + numportals * uint64_t(portal_size) + numpoints * uint64_t(point_size) + clustermap_header_size)
+        FError("{} is truncated\n", name);
+
+    result.portals.resize(numportals);
+
+    size_t totalpoints = 0;
+    for (uint32_t i = 0; i < numportals; i++) {
+        prtfile_portal_t &p = result.portals[i];
+        uint32_t portalpoints;
+
+        stream >= std::tie(portalpoints, p.leafnums[0], p.leafnums[1]);
+        CheckPortal(result, p, portalpoints, i);
+
+        p.winding.resize(portalpoints);
+        totalpoints += portalpoints;
+    }
+
+    if (totalpoints != numpoints)
+        FError("{} has {} points, header says {}\n", name, totalpoints, numpoints);
+
+    for (auto &p : result.portals) {
+        for (auto &point : p.winding) {
+            stream >= std::tie(point[0], point[1], point[2]);
+        }
+    }
+
+    uint32_t numclusters;
+    stream >= numclusters;
+
+    if (!stream)
+        FError("{} is truncated\n", name);
+
+    if (loadversion->game->id == GAME_QUAKE_II) {
+        // since q2bsp has native cluster support, we shouldn't look at portalleafs_real at all.
+        result.portalleafs_real = 0;
+        return result;
+    }
+
+    if (result.portalleafs == result.portalleafs_real) {
+        SetIdentityClusters(result);
+        return result;
+    }
+
+    if (numclusters != result.portalleafs_real)
+        FError("{} cluster map has {} leafs, expected {}\n", name, numclusters, result.portalleafs_real);
+
+    result.dleafinfos.resize(result.portalleafs_real + 1);
+
+    for (int i = 0; i < result.portalleafs_real; i++) {
+        int32_t clusternum;
+        stream >= clusternum;
+
+        if (!stream) {
+            Error("Unexpected end of cluster map\n");
+        }
+        if (clusternum < 0 || clusternum >= result.portalleafs) {
+            FError("Invalid cluster number {} in cluster map, number of clusters: {}\n", clusternum,
+                result.portalleafs);
+        }
+        result.dleafinfos[i + 1].cluster = clusternum;
+    }
+
+    return result;
+}
+
+prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion)
+{
+    std::ifstream f(name, std::ios_base::in | std::ios_base::binary);
+    if (!f)
+        FError("couldn't open portal file {}: {}\n", name, strerror(errno));
+
+    // std::string keeps a NUL after the contents, which prt_text_parser_t relies on
+    std::string contents(fs::file_size(name), '\0');
+    if (!f.read(contents.data(), contents.size()))
+        FError("couldn't read portal file {}: {}\n", name, strerror(errno));
+
+    if (contents.size() >= sizeof(PORTALFILEBINARY) &&
+        !memcmp(contents.data(), PORTALFILEBINARY, sizeof(PORTALFILEBINARY))) {
+        return LoadBinaryPrtFile(name, contents, loadversion);
+    }
+
+    return LoadTextPrtFile(name, contents, loadversion);
+}
+
 static void WriteDebugPortal(const polylib::winding_t &w, std::ofstream &portalFile)
 {
     ewt::print(portalFile, "{} {} {} ", w.size(), 0, 0);
@@ -207,18 +391,18 @@ PORTAL FILE GENERATION
 ==============================================================================
 */
 
-static void WritePortal(std::ofstream &portalFile, const prtfile_portal_t &portal)
+static void WritePortal(fmt::memory_buffer &portalFile, const prtfile_portal_t &portal)
 {
-    ewt::print(portalFile, "{} {} {} ", portal.winding.size(), portal.leafnums[0], portal.leafnums[1]);
+    fmt::format_to(std::back_inserter(portalFile), "{} {} {} ", portal.winding.size(), portal.leafnums[0], portal.leafnums[1]);
 
     for (auto &point : portal.winding) {
-        ewt::print(portalFile, "({} {} {}) ", point[0], point[1], point[2]);
+        fmt::format_to(std::back_inserter(portalFile), "({} {} {}) ", point[0], point[1], point[2]);
     }
 
-    ewt::print(portalFile, "\n");
+    fmt::format_to(std::back_inserter(portalFile), "\n");
 }
 
-static void WritePTR2ClusterMapping(std::ofstream &portalFile, const prtfile_t &input)
+static void WritePTR2ClusterMapping(fmt::memory_buffer &portalFile, const prtfile_t &input)
 {
     // build cluster -> leafs mapping from dleafinfos
     std::map<int, std::vector<int>> cluster_to_leafs;
@@ -233,31 +417,22 @@ static void WritePTR2ClusterMapping(std::ofstream &portalFile, const prtfile_t &
         auto it = cluster_to_leafs.find(i);
         if (it != cluster_to_leafs.end()) {
             for (int leafnum : it->second) {
-                ewt::print(portalFile, "{} ", leafnum);
+                fmt::format_to(std::back_inserter(portalFile), "{} ", leafnum);
             }
         }
-        ewt::print(portalFile, "-1\n");
+        fmt::format_to(std::back_inserter(portalFile), "-1\n");
     }
 }
 
-/*
-================
-WritePortalfile
-================
-*/
-void WritePortalfile(
-    const fs::path &name, const prtfile_t &prtfile, const bspversion_t *loadversion, bool uses_detail, bool forceprt1)
+static void FormatPortalfile(
+    fmt::memory_buffer &portalFile, const prtfile_t &prtfile, const bspversion_t *loadversion, bool uses_detail, bool forceprt1)
 {
-    std::ofstream portalFile(name, std::ios_base::out); // .prt files are intentionally text mode
-    if (!portalFile)
-        FError("Failed to open {}: {}", name, strerror(errno));
-
     // q2 uses a PRT1 file, but with clusters.
     // (Since q2bsp natively supports clusters, we don't need PRT2.)
     if (loadversion->game->id == GAME_QUAKE_II) {
-        ewt::print(portalFile, "PRT1\n");
-        ewt::print(portalFile, "{}\n", prtfile.portalleafs);
-        ewt::print(portalFile, "{}\n", prtfile.portals.size());
+        fmt::format_to(std::back_inserter(portalFile), "PRT1\n");
+        fmt::format_to(std::back_inserter(portalFile), "{}\n", prtfile.portalleafs);
+        fmt::format_to(std::back_inserter(portalFile), "{}\n", prtfile.portals.size());
         for (auto &portal : prtfile.portals) {
             WritePortal(portalFile, portal);
         }
@@ -266,28 +441,28 @@ void WritePortalfile(
 
     /* If no detail clusters, just use a normal PRT1 format */
     if (!uses_detail) {
-        ewt::print(portalFile, "PRT1\n");
-        ewt::print(portalFile, "{}\n", prtfile.portalleafs);
-        ewt::print(portalFile, "{}\n", prtfile.portals.size());
+        fmt::format_to(std::back_inserter(portalFile), "PRT1\n");
+        fmt::format_to(std::back_inserter(portalFile), "{}\n", prtfile.portalleafs);
+        fmt::format_to(std::back_inserter(portalFile), "{}\n", prtfile.portals.size());
 
         for (auto &portal : prtfile.portals) {
             WritePortal(portalFile, portal);
         }
     } else if (forceprt1) {
         /* Write a PRT1 file for loading in the map editor. Vis will reject it. */
-        ewt::print(portalFile, "PRT1\n");
-        ewt::print(portalFile, "{}\n", prtfile.portalleafs);
-        ewt::print(portalFile, "{}\n", prtfile.portals.size());
+        fmt::format_to(std::back_inserter(portalFile), "PRT1\n");
+        fmt::format_to(std::back_inserter(portalFile), "{}\n", prtfile.portalleafs);
+        fmt::format_to(std::back_inserter(portalFile), "{}\n", prtfile.portals.size());
 
         for (auto &portal : prtfile.portals) {
             WritePortal(portalFile, portal);
         }
     } else {
         /* Write a PRT2 */
-        ewt::print(portalFile, "PRT2\n");
-        ewt::print(portalFile, "{}\n", prtfile.portalleafs_real);
-        ewt::print(portalFile, "{}\n", prtfile.portalleafs);
-        ewt::print(portalFile, "{}\n", prtfile.portals.size());
+        fmt::format_to(std::back_inserter(portalFile), "PRT2\n");
+        fmt::format_to(std::back_inserter(portalFile), "{}\n", prtfile.portalleafs_real);
+        fmt::format_to(std::back_inserter(portalFile), "{}\n", prtfile.portalleafs);
+        fmt::format_to(std::back_inserter(portalFile), "{}\n", prtfile.portals.size());
 
         for (auto &portal : prtfile.portals) {
             WritePortal(portalFile, portal);
@@ -296,3 +471,73 @@ void WritePortalfile(
         WritePTR2ClusterMapping(portalFile, prtfile);
     }
 }
+
+/*
+================
+WritePortalfile
+================
+*/
+void WritePortalfile(
+    const fs::path &name, const prtfile_t &prtfile, const bspversion_t *loadversion, bool uses_detail, bool forceprt1)
+{
+    std::ofstream portalFile(name, std::ios_base::out); // .prt files are intentionally text mode
+    if (!portalFile)
+        FError("Failed to open {}: {}", name, strerror(errno));
+
+    // formatted in memory and written in one go; going through the stream a token at a time is slow
+    fmt::memory_buffer buffer;
+    FormatPortalfile(buffer, prtfile, loadversion, uses_detail, forceprt1);
+    portalFile.write(buffer.data(), buffer.size());
+}
+
+/*
+================
+WriteBinaryPortalfile
+
+Same leafs/clusters as WritePortalfile, in the binary format
+================
+*/
+void WriteBinaryPortalfile(
+    const fs::path &name, const prtfile_t &prtfile, const bspversion_t *loadversion, bool uses_detail, bool forceprt1)
+{
+    std::ofstream portalFile(name, std::ios_base::out | std::ios_base::binary);
+    if (!portalFile)
+        FError("Failed to open {}: {}", name, strerror(errno));
+
+    portalFile << endianness<std::endian::little>;
+
+    // only the PRT2 case has a cluster map
+    const bool write_clusters = loadversion->game->id != GAME_QUAKE_II && uses_detail && !forceprt1;
+    const int32_t portalleafs_real = write_clusters ? prtfile.portalleafs_real : prtfile.portalleafs;
+
+    uint32_t numpoints = 0;
+    for (auto &portal : prtfile.portals) {
+        numpoints += portal.winding.size();
+    }
+
+    portalFile.write(PORTALFILEBINARY, sizeof(PORTALFILEBINARY));
+    portalFile <= std::tie(PORTALFILEBINARY_VERSION, prtfile.portalleafs, portalleafs_real);
+    portalFile <= static_cast<uint32_t>(prtfile.portals.size());
+    portalFile <= numpoints;
+
+    for (auto &portal : prtfile.portals) {
+        portalFile <= static_cast<uint32_t>(portal.winding.size());
+        portalFile <= std::tie(portal.leafnums[0], portal.leafnums[1]);
+    }
+
+    for (auto &portal : prtfile.portals) {
+        for (auto &point : portal.winding) {
+            portalFile <= std::tie(point[0], point[1], point[2]);
+        }
+    }
+
+    if (write_clusters) {
+        portalFile <= static_cast<uint32_t>(portalleafs_real);
+
+        for (int leafnum = 0; leafnum < portalleafs_real; ++leafnum) {
+            portalFile <= static_cast<int32_t>(prtfile.dleafinfos[leafnum + 1].cluster);
+        }
+    } else {
+        portalFile <= static_cast<uint32_t>(0);
+    }
+}
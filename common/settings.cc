@@ -20,6 +20,7 @@
 #include "common/settings.hh"
 #include "common/threads.hh"
 #include "common/fs.hh"
+#include "common/profile.hh"
 #include <common/log.hh>
 
 namespace settings
@@ -746,7 +747,9 @@ common_settings::common_settings()
           "increase texture saturation to match original Q2 tools"},
       logfile{this, "logfile", "auto", "\"path\"", &logging_group,
           "File to output logging data to. If unchanged, it is set by the tool."},
-      logappend{this, "logappend", false, &logging_group, "Whether to append to log file or replace"}
+      logappend{this, "logappend", false, &logging_group, "Whether to append to log file or replace"},
+      tracefile{this, "tracefile", "", "\"path\"", &logging_group,
+          "write a Chrome trace-event JSON file with the time spent in each compile phase, per thread (open in chrome://tracing or ui.perfetto.dev)"}
 {
 }
 
@@ -790,5 +793,9 @@ void common_settings::postinitialize(int argc, const char **argv)
     if (nocolor.value()) {
         logging::enable_color_codes = false;
     }
+
+    if (tracefile.is_changed()) {
+        profile::begin_trace(tracefile.value());
+    }
 }
 } // namespace settings
@@ -23,6 +23,10 @@
 #include <common/bspfile_q1.hh>
 #include <common/bspfile_q2.hh>
 #include <common/bspxfile.hh>
+#include <common/mappedfile.hh>
+
+#include <span>
+#include <string_view>
 
 using bspxentries_t = std::unordered_map<std::string, std::vector<uint8_t>>;
 
@@ -55,9 +59,56 @@ struct bspdata_t
 constexpr const bspversion_t *const bspversions[] = {&bspver_generic, &bspver_q1, &bspver_h2, &bspver_h2bsp2,
     &bspver_h2bsp2rmq, &bspver_bsp2, &bspver_bsp2rmq, &bspver_hl, &bspver_q2, &bspver_qbism};
 
+/**
+ * A BSP file's raw lumps, read in place. Files on disk are memory mapped;
+ * BSPs inside archives are loaded into a buffer. Nothing is copied or
+ * converted until a caller reads it, so tools that only look at a few
+ * lumps don't pay for the rest.
+ */
+struct bspfile_view_t
+{
+    const bspversion_t *version = nullptr;
+    std::vector<lump_t> lumps;
+    // BSPX lumps, pointing into the file
+    std::unordered_map<std::string, std::span<const uint8_t>> bspx;
+
+    std::span<const uint8_t> data() const;
+    // the raw bytes of the given lump; throws if it lies outside the file
+    std::span<const uint8_t> lump(size_t lump_num) const;
+    // the entity lump, without the null terminator
+    std::string_view entities() const;
+
+private:
+    mapped_file_t mapped;
+    fs::data loaded;
+
+    friend bspfile_view_t OpenBSPFile(const fs::path &filename);
+};
+
+// reads the header and BSPX directory; throws if the file can't be loaded
+// or isn't a supported version
+bspfile_view_t OpenBSPFile(const fs::path &filename);
+
+// reads only the named lumps (as in the version's lumpspecs, e.g. "models") into
+// `bspdata`; the others, and the BSPX lumps, are left empty. Names the version
+// doesn't have are ignored.
+void LoadBSPLumps(const bspfile_view_t &view, bspdata_t *bspdata, const std::vector<std::string_view> &lump_names);
+
 void LoadBSPFile(fs::path &filename, bspdata_t *bspdata); // returns the filename as contained inside a bsp
 void WriteBSPFile(const fs::path &filename, bspdata_t *bspdata);
+/**
+ * Writes a generic BSP as `to_version`, converting each lump as it's written
+ * rather than converting the whole BSP first. Limits exceeded while writing
+ * are fatal, so check BSPFitsFormat first if there's a fallback.
+ */
+void WriteBSPFile(const fs::path &filename, const bspdata_t *bspdata, const bspversion_t *to_version);
+/**
+ * Returns false if the generic BSP exceeds the limits of `to_version`.
+ */
+bool BSPFitsFormat(const bspdata_t *bspdata, const bspversion_t *to_version);
 void PrintBSPFileSizes(const bspdata_t *bspdata);
+// for a generic BSP, as it would be written as `as_version`
+void PrintBSPFileSizes(const bspdata_t *bspdata, const bspversion_t *as_version);
 /**
  * Returns false if the conversion failed.
  */
@@ -33,6 +33,10 @@
 #include <stdexcept> // for std::runtime_error
 #include <functional> // for std::function
 #include <optional> // for std::optional
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 #include <fmt/core.h>
 #include <common/bitflags.hh>
 #include <common/fs.hh>
@@ -99,6 +103,41 @@ inline void print(fmt::format_string<T...> format, T &&...args)
     vprint(flag::DEFAULT, format, fmt::make_format_args(args...));
 }
 
+// collects output instead of printing it, so work that runs concurrently
+// can have its log printed afterwards in a deterministic order.
+// see buffer_scope.
+struct buffer_t
+{
+    std::mutex mutex;
+    std::vector<std::pair<flag, std::string>> lines;
+
+    // percent() state while buffering; only the elapsed time is kept
+    std::atomic_bool is_timing = false;
+    time_point start_time;
+
+    // prints everything collected so far, in order, skipping
+    // lines whose flag isn't in `allowed`
+    void flush(bitflags<flag> allowed = flag::ALL);
+};
+
+// while alive, print() and percent() on this thread go to `buffer`
+// instead (or to the regular targets, if it's null). the parallel_for
+// helpers and percent_clock pass the buffer on to their worker threads.
+class buffer_scope
+{
+    buffer_t *previous;
+
+public:
+    explicit buffer_scope(buffer_t *buffer);
+    ~buffer_scope();
+
+    buffer_scope(const buffer_scope &) = delete;
+    buffer_scope &operator=(const buffer_scope &) = delete;
+};
+
+// the buffer print() uses on this thread, if any
+buffer_t *current_buffer();
+
 // set print callback
 using print_callback_t = std::function<void(flag logflag, const char *str)>;
 
@@ -142,6 +181,7 @@ struct percent_clock
     bool displayElapsed = true;
     std::atomic<uint64_t> count = 0;
     bool ready = true;
+    buffer_t *buffer = current_buffer();
 
     // runs a tick immediately to show up on stdout
     // unless max is zero
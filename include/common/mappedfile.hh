@@ -0,0 +1,52 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+#include <common/fs.hh>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Read-only view of a whole file, mapped into memory so it can be read in place
+ * without copying it into a buffer first.
+ */
+class mapped_file_t
+{
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+
+    void close();
+
+public:
+    mapped_file_t() = default;
+    // fails (with is_open() false) if the file can't be opened or is empty
+    explicit mapped_file_t(const fs::path &path);
+    ~mapped_file_t();
+
+    mapped_file_t(mapped_file_t &&other) noexcept;
+    mapped_file_t &operator=(mapped_file_t &&other) noexcept;
+    mapped_file_t(const mapped_file_t &) = delete;
+    mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+    inline bool is_open() const { return m_data != nullptr; }
+    inline const uint8_t *data() const { return m_data; }
+    inline size_t size() const { return m_size; }
+};
@@ -21,53 +21,109 @@
 #pragma once
 
 #include "common/log.hh"
+#include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_for_each.h>
 
 #include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
 
 // parallel extensions to logging
 namespace logging
 {
-template<typename TS, typename TE, typename Body>
-void parallel_for(const TS &start, const TE &end, const Body &func)
+// progress for the parallel_for helpers below. work is counted a chunk at
+// a time, and only the chunk that moves the total into a new percent calls
+// percent(), so neither the counter nor percent()'s lock is touched per item.
+struct parallel_progress_t
+{
+    uint64_t length;
+    std::atomic<uint64_t> count = 0;
+
+    inline parallel_progress_t(uint64_t length)
+        : length(length)
+    {
+        // starts the clock
+        if (length) {
+            percent(0, length);
+        }
+    }
+
+    inline void add(uint64_t n)
+    {
+        const uint64_t before = count.fetch_add(n, std::memory_order_relaxed);
+        const uint64_t after = before + n;
+
+        // the last chunk is reported by finish(), after everything's done
+        if (after != length && (before * 100) / length != (after * 100) / length) {
+            percent(after, length);
+        }
+    }
+
+    inline void finish() { percent(length, length); }
+};
+
+// calls func(begin, end) on subranges of [start, end) in parallel. subranges
+// are at least `grainsize` items, except for the last one.
+template<typename T, typename Body>
+void parallel_for_range(const T &start, const T &end, const Body &func, size_t grainsize = 1)
 {
-    auto length = end - start;
-    std::atomic<uint64_t> progress = 0;
+    parallel_progress_t progress(end - start);
+    buffer_t *buffer = current_buffer();
 
-    tbb::parallel_for(start, end, [&](const auto &it) {
-        percent(progress++, length);
-        func(it);
+    tbb::parallel_for(tbb::blocked_range<T>(start, end, grainsize), [&](const tbb::blocked_range<T> &r) {
+        buffer_scope scope(buffer);
+        func(r.begin(), r.end());
+        progress.add(r.size());
     });
 
-    percent(progress, length);
+    progress.finish();
 }
 
-template<typename Container, typename Body>
-void parallel_for_each(Container &container, const Body &func)
+template<typename TS, typename TE, typename Body>
+void parallel_for(const TS &start, const TE &end, const Body &func, size_t grainsize = 1)
 {
-    auto length = std::size(container);
-    std::atomic<uint64_t> progress = 0;
-
-    tbb::parallel_for_each(container, [&](auto &f) {
-        percent(progress++, length);
-        func(f);
-    });
-
-    percent(progress, length);
+    parallel_for_range(
+        start, static_cast<TS>(end),
+        [&](TS first, TS last) {
+            for (TS i = first; i != last; ++i) {
+                func(i);
+            }
+        },
+        grainsize);
 }
 
+// Container may be const, in which case func gets const references
 template<typename Container, typename Body>
-void parallel_for_each(const Container &container, const Body &func)
+void parallel_for_each(Container &container, const Body &func, size_t grainsize = 1)
 {
-    auto length = std::size(container);
-    std::atomic<uint64_t> progress = 0;
-
-    tbb::parallel_for_each(container, [&](const auto &f) {
-        percent(progress++, length);
-        func(f);
-    });
-
-    percent(progress, length);
+    using iterator = decltype(std::begin(container));
+
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag,
+                      typename std::iterator_traits<iterator>::iterator_category>) {
+        auto first = std::begin(container);
+
+        parallel_for_range(
+            static_cast<size_t>(0), static_cast<size_t>(std::size(container)),
+            [&](size_t begin, size_t end) {
+                for (auto it = first + begin; it != first + end; ++it) {
+                    func(*it);
+                }
+            },
+            grainsize);
+    } else {
+        // no random access, so no ranges either; fall back to counting each item
+        parallel_progress_t progress(std::size(container));
+        buffer_t *buffer = current_buffer();
+
+        tbb::parallel_for_each(container, [&](auto &f) {
+            buffer_scope scope(buffer);
+            func(f);
+            progress.add(1);
+        });
+
+        progress.finish();
+    }
 }
-} // namespace logging
\ No newline at end of file
+} // namespace logging
@@ -0,0 +1,88 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+/*
+ * common/profile.hh
+ *
+ * Scoped timing zones, written out as a Chrome trace-event JSON file
+ * (chrome://tracing, ui.perfetto.dev) when -tracefile is set.
+ */
+
+#pragma once
+
+#include <common/fs.hh>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace profile
+{
+// one finished zone. times are nanoseconds since the trace was started
+struct event_t
+{
+    const char *name;
+    uint64_t begin, end;
+};
+
+// true between begin_trace() and end_trace(); zones are no-ops otherwise
+extern std::atomic_bool enabled;
+
+// start collecting zones; they are written to `filename` by end_trace()
+void begin_trace(const fs::path &filename);
+
+// write the trace file (if one was started) and stop collecting
+void end_trace();
+
+// nanoseconds since the trace was started
+uint64_t now();
+
+// add a finished zone to the calling thread's buffer. each thread keeps the
+// most recent events only, so a long run can't grow the buffers without bound.
+void record(const char *name, uint64_t begin, uint64_t end);
+
+// the events recorded by the calling thread, oldest first
+std::vector<event_t> thread_events();
+
+// times the enclosing scope. `name` must outlive the trace (a string literal
+// or __func__); nested zones show up nested in the trace viewer.
+class zone
+{
+    const char *m_name;
+    uint64_t m_begin;
+
+public:
+    inline explicit zone(const char *name)
+        : m_name(enabled.load(std::memory_order_relaxed) ? name : nullptr),
+          m_begin(m_name ? now() : 0)
+    {
+    }
+
+    inline ~zone()
+    {
+        if (m_name) {
+            record(m_name, m_begin, now());
+        }
+    }
+
+    zone(const zone &) = delete;
+    zone &operator=(const zone &) = delete;
+};
+} // namespace profile
@@ -50,8 +50,11 @@ struct prtfile_t
 };
 
 struct bspversion_t;
+// loads either a text (PRT1, PRT2, PRT1-AM) or binary (PRTB) portal file, detected from its header
 prtfile_t LoadPrtFile(const fs::path &name, const bspversion_t *loadversion);
 void WritePortalfile(
     const fs::path &name, const prtfile_t &prtfile, const bspversion_t *loadversion, bool uses_detail, bool forceprt1);
+void WriteBinaryPortalfile(
+    const fs::path &name, const prtfile_t &prtfile, const bspversion_t *loadversion, bool uses_detail, bool forceprt1);
 
 void WriteDebugPortals(const std::vector<polylib::winding_t> &portals, fs::path name);
@@ -626,6 +626,7 @@ public:
     setting_scalar tex_saturation_boost;
     setting_string logfile;
     setting_bool logappend;
+    setting_string tracefile;
 
     common_settings();
 
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -138,11 +139,55 @@ public:
  *    Stores the RGB values to determine the light color
  */
 
+/**
+ * Bounding volume hierarchy over GetLights(), built at the end of SetupLights().
+ *
+ * Each light is bounded by a sphere of radius LightCullDistance() around its origin;
+ * beyond that distance CullLight() is guaranteed to reject it. Lights that can reach
+ * arbitrarily far are kept in a separate unbounded list.
+ */
+struct light_index_t
+{
+    struct node_t
+    {
+        aabb3f bounds; // union of origin +/- cull distance
+
+        // leafs have num_lights > 0, other nodes have two children
+        uint32_t first_light = 0, num_lights = 0;
+        uint32_t children[2]{};
+    };
+
+    std::vector<float> cull_dists; // per light, in GetLights() order
+    std::vector<uint32_t> unbounded; // lights with an infinite cull distance
+    std::vector<uint32_t> leaf_lights; // indices into GetLights(), grouped by leaf
+    std::vector<node_t> nodes; // nodes[0] is the root
+
+    void clear();
+    void build(const settings::worldspawn_keys &cfg, const std::vector<std::unique_ptr<light_t>> &lights);
+
+    /**
+     * Sets `bits` to one bit per light in `lights`, set if the light might reach the sphere
+     * (origin, radius). Returns the number of bits set.
+     *
+     * If the index wasn't built for `lights`, every bit is set.
+     */
+    size_t query(const std::vector<std::unique_ptr<light_t>> &lights, const qvec3f &origin, float radius,
+        std::vector<uint64_t> &bits) const;
+};
+
 void ResetLightEntities();
 std::string TargetnameForLightStyle(int style);
 std::vector<std::unique_ptr<light_t>> &GetLights();
+const light_index_t &GetLightIndex();
 const std::vector<entdict_t> &GetEntdicts();
 std::vector<sun_t> &GetSuns();
+const std::vector<sun_group_t> &GetSunGroups();
+// groups suns sharing a direction, in order of first appearance
+std::vector<sun_group_t> GroupSuns(const std::vector<sun_t> &suns);
+const std::vector<sun_stratum_t> &GetSunStrata();
+// splits the groups of each sign into at most numstrata strata of neighbouring directions
+// with about equal light; 0 gives every group its own stratum
+std::vector<sun_stratum_t> StratifySuns(const std::vector<sun_group_t> &groups, int numstrata);
 std::vector<entdict_t> &GetRadLights();
 /**
  * Returns the light entity that has "_switchableshadow_target" set to the given value, or nullptr.
@@ -69,6 +69,31 @@ public:
     const img::texture *suntexture_value;
 };
 
+/**
+ * Suns of the same sign shining from the same direction, like the matching samples
+ * of several sky domes. One ray per sample point serves all of them.
+ */
+struct sun_group_t
+{
+    qvec3f incoming; // normalized, pointing towards the suns
+    bool negative;
+    std::vector<const sun_t *> suns;
+};
+
+/**
+ * Sun groups sampled together with one ray per sample point (see -sunstrata). The ray
+ * picks a group with probability proportional to its light and scales it by 1 / that
+ * probability, so the average matches lighting every group. Without -sunstrata each
+ * group is its own stratum.
+ */
+struct sun_stratum_t
+{
+    bool negative;
+    uint32_t seed; // decorrelates the picks of different strata
+    std::vector<const sun_group_t *> groups;
+    std::vector<float> cdf; // cumulative probability of picking each group
+};
+
 class modelinfo_t;
 namespace settings
 {
@@ -86,6 +111,7 @@ public:
 using lightmapdict_t = std::vector<lightmap_t>;
 
 struct surfacelight_t;
+struct surflight_tree_t;
 class raystream_occlusion_t;
 class raystream_intersection_t;
 
@@ -243,6 +269,13 @@ enum class visapprox_t
     RAYS
 };
 
+enum class raypackets_t
+{
+    SINGLE = 1,
+    PACKET8 = 8,
+    PACKET16 = 16
+};
+
 enum class emissivequality_t
 {
     LOW,
@@ -379,6 +412,7 @@ public:
     setting_bool novanilla;
     setting_scalar gate;
     setting_int32 sunsamples;
+    setting_int32 sunstrata;
     setting_bool arghradcompat;
     setting_bool nolighting;
     setting_vec3 debugface;
@@ -390,6 +424,7 @@ public:
     setting_extra extra;
     setting_enum<emissivequality_t> emissivequality;
     setting_enum<visapprox_t> visapprox;
+    setting_enum<raypackets_t> raypackets;
     setting_func lit;
     setting_func lit2;
     setting_func bspxlit;
@@ -408,6 +443,7 @@ public:
     setting_bool lightgrid;
     setting_vec3 lightgrid_dist;
     setting_enum<lightgrid_format_t> lightgrid_format;
+    setting_scalar lightgrid_adaptive;
 
     setting_func dirtdebug;
     setting_func bouncedebug;
@@ -445,6 +481,7 @@ bool IsOutputtingSupplementaryData();
 
 std::span<lightsurf_t> &LightSurfaces();
 std::vector<lightsurf_t *> &EmissiveLightSurfaces();
+const surflight_tree_t *EmissiveLightTree(const std::optional<size_t> &bounce_level);
 
 extern std::vector<surfflags_t> extended_texinfo_flags;
 
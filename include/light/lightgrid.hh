@@ -25,3 +25,5 @@ struct bspdata_t;
 
 std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp, qvec3f world_point);
 void LightGrid(bspdata_t *bspdata);
+// number of grid points the last LightGrid() call actually lit (the rest were occluded or interpolated)
+size_t LightGridTracedPoints();
@@ -42,12 +42,19 @@ extern std::atomic<uint32_t> total_light_rays, total_light_ray_hits, total_sampl
 extern std::atomic<uint32_t> total_bounce_rays, total_bounce_ray_hits;
 extern std::atomic<uint32_t> total_surflight_rays, total_surflight_ray_hits; // mxd
 #endif
+extern std::atomic<uint64_t> total_surflight_emitters_traced, total_surflight_emitters_culled;
+extern std::atomic<uint64_t> total_light_entities_tested, total_light_entities_culled;
 extern std::atomic<uint32_t> fully_transparent_lightmaps; // write.cc
 
 void PrintFaceInfo(const mface_t *face, const mbsp_t *bsp);
 void SetupDirt(settings::worldspawn_keys &cfg);
 lightsurf_t CreateLightmapSurface(const mbsp_t *bsp, const mface_t *face, const facesup_t *facesup,
     const bspx_decoupled_lm_perface *facesup_decoupled, const settings::worldspawn_keys &cfg);
+/**
+ * Distance from `entity` beyond which its light value is always within the gate,
+ * or infinity if there is no such distance.
+ */
+float LightCullDistance(const settings::worldspawn_keys &cfg, const light_t *entity);
 bool Face_IsLightmapped(const mbsp_t *bsp, const mface_t *face);
 bool Face_IsEmissive(const mbsp_t *bsp, const mface_t *face);
 void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg);
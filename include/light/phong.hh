@@ -20,8 +20,7 @@
 
 #pragma once
 
-#include <set>
-#include <map>
+#include <span>
 #include <vector>
 
 #include <common/qvec.hh>
@@ -37,18 +36,15 @@ struct neighbour_t
 
 void CalculateVertexNormals(const mbsp_t *bsp);
 const face_normal_t &GetSurfaceVertexNormal(const mbsp_t *bsp, const mface_t *f, const int vertindex);
-bool FacesSmoothed(const mface_t *f1, const mface_t *f2);
-const std::set<const mface_t *> &GetSmoothFaces(const mface_t *face);
-const std::vector<const mface_t *> &GetPlaneFaces(const mface_t *face);
+bool FacesSmoothed(const mbsp_t *bsp, const mface_t *f1, const mface_t *f2);
+// face numbers, ascending
+std::span<const int> GetSmoothFaces(const mbsp_t *bsp, const mface_t *face);
+std::span<const int> GetPlaneFaces(const mface_t *face);
 const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const int edgeindex);
 int Q2_FacePhongValue(const mbsp_t *bsp, const mface_t *face);
 
-/// a directed edge can be used by more than one face, e.g. two cube touching just along an edge
-using edgeToFaceMap_t = std::map<std::pair<int, int>, std::vector<const mface_t *>>;
-
 std::vector<neighbour_t> NeighbouringFaces_new(const mbsp_t *bsp, const mface_t *face);
-std::vector<const mface_t *> FacesUsingVert(int vertnum);
-const edgeToFaceMap_t &GetEdgeToFaceMap();
+std::span<const int> FacesUsingVert(int vertnum);
 
 class face_cache_t
 {
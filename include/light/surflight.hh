@@ -23,6 +23,8 @@ See file, 'COPYING', for details.
 #include <vector>
 #include <optional>
 #include <tuple>
+#include <limits>
+#include <cstdint>
 
 #include <common/qvec.hh>
 #include <common/aabb.hh>
@@ -30,6 +32,7 @@ See file, 'COPYING', for details.
 struct mleaf_t;
 struct mface_t;
 struct mbsp_t;
+struct lightsurf_t;
 namespace settings
 {
 class worldspawn_keys;
@@ -70,6 +73,75 @@ struct surfacelight_t
     std::vector<per_style_t> styles;
 };
 
+/**
+ * Bounding volume hierarchy over the surface light styles of one bounce level,
+ * so LightFace_SurfaceLight can reject whole groups of emitters at once instead
+ * of testing every emissive surface against every face.
+ */
+struct surflight_tree_t
+{
+    struct entry_t
+    {
+        uint32_t surfnum; // index into EmissiveLightSurfaces()
+        uint32_t stylenum; // index into surfacelight_t::styles
+    };
+
+    struct node_t
+    {
+        aabb3f pos_bounds; // bounds of surfacelight_t::pos
+        aabb3f vis_bounds; // union of surfacelight_t::bounds
+
+        // largest max(color) * totalintensity below this node; omnidirectional (sky)
+        // styles are kept separate since they use a different scale
+        float max_power = std::numeric_limits<float>::lowest();
+        float max_sky_power = std::numeric_limits<float>::lowest();
+        float min_atten = std::numeric_limits<float>::max();
+
+        // leafs have num_entries > 0, other nodes have two children
+        uint32_t first_entry = 0, num_entries = 0;
+        uint32_t children[2]{};
+    };
+
+    std::vector<entry_t> entries; // in EmissiveLightSurfaces() order
+    std::vector<uint32_t> leaf_entries; // indices into entries, grouped by leaf
+    std::vector<node_t> nodes; // nodes[0] is the root
+
+    void build(const std::vector<lightsurf_t *> &surfs, const std::optional<size_t> &bounce_level);
+
+    /**
+     * Walks the tree top-down, skipping any node for which `cull(node)` returns true,
+     * and calls `visit(entrynum)` for each entry of the remaining leafs.
+     */
+    template<typename C, typename V>
+    void query(C &&cull, V &&visit) const
+    {
+        if (nodes.empty()) {
+            return;
+        }
+
+        uint32_t stack[64];
+        size_t stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size) {
+            const node_t &node = nodes[stack[--stack_size]];
+
+            if (cull(node)) {
+                continue;
+            }
+
+            if (node.num_entries) {
+                for (uint32_t i = node.first_entry; i < node.first_entry + node.num_entries; i++) {
+                    visit(leaf_entries[i]);
+                }
+            } else {
+                stack[stack_size++] = node.children[1];
+                stack[stack_size++] = node.children[0];
+            }
+        }
+    }
+};
+
 class light_t;
 
 void ResetSurflight();
@@ -92,10 +92,13 @@ public:
 
     void clearPushedRays() { _rays.clear(); }
 
-    inline qvec3f getPushedRayColor(size_t j) const
+    inline qvec3f getPushedRayColor(size_t j) const { return tintPushedRayColor(j, getRay(j).color); }
+
+    // applies any glass ray j passed through to a color it carries
+    inline qvec3f tintPushedRayColor(size_t j, const qvec3f &color) const
     {
         const ray_io &ray = getRay(j);
-        qvec3f result = ray.color;
+        qvec3f result = color;
 
         if (ray.hit_glass) {
             const qvec3f glasscolor = ray.glass_color;
@@ -141,6 +144,9 @@ protected:
 
 extern RTCScene scene;
 
+// 1 traces each ray on its own, 8 or 16 traces SIMD packets of that many rays
+extern int ray_packet_width;
+
 struct ray_source_info : public
 #ifdef HAVE_EMBREE4
                          RTCRayQueryContext
@@ -159,6 +165,10 @@ struct ray_source_info : public
 #endif
 };
 
+// trace `rays` in packets of ray_packet_width neighbouring rays
+void Embree_IntersectPackets(ray_source_info &ctx, aligned_vector<ray_io> &rays);
+void Embree_OccludedPackets(ray_source_info &ctx, aligned_vector<ray_io> &rays);
+
 struct triinfo
 {
     const modelinfo_t *modelinfo;
@@ -233,6 +243,11 @@ public:
 
         ray_source_info ctx2(this, self, shadowmask);
 
+        if (ray_packet_width > 1) {
+            Embree_IntersectPackets(ctx2, _rays);
+            return;
+        }
+
 #ifdef HAVE_EMBREE4
         RTCIntersectArguments embree4_args = ctx2.setup_intersection_arguments();
         for (auto &ray : _rays)
@@ -297,6 +312,12 @@ public:
             return;
 
         ray_source_info ctx2(this, self, shadowmask);
+
+        if (ray_packet_width > 1) {
+            Embree_OccludedPackets(ctx2, _rays);
+            return;
+        }
+
 #ifdef HAVE_EMBREE4
         RTCOccludedArguments embree4_args = ctx2.setup_occluded_arguments();
         for (auto &ray : _rays)
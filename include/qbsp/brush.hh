@@ -23,6 +23,7 @@
 
 #include <qbsp/winding.hh>
 #include <common/aabb.hh>
+#include <cstdint>
 #include <optional>
 #include <list>
 #include <vector>
@@ -42,6 +43,7 @@ struct side_t
     bool onnode; // has this face been used as a BSP node plane yet?
     bool bevel; // don't ever use for bsp splitting
     mapface_t *source; // the mapface we were generated from
+    uint8_t hullnum = 0; // which of source->visible this side reads and writes
 
     bool tested;
 
@@ -69,14 +71,17 @@ struct bspbrush_t
     }
 
     /**
-     * The brushes in main brush vectors are considered originals. Brush fragments created during
-     * the BrushBSP will have this pointing back to the original brush in the list.
+     * The brushes in main brush vectors are considered originals. Brush fragments created by
+     * ChopBrushes and BrushBSP will have this pointing back to the original brush in the list.
      */
+    bspbrush_t *original = nullptr;
+    // ChopBrushes' fragments replace their originals in the brush list, so they keep
+    // them alive through this; BrushBSP's fragments only borrow theirs (see tree_t::create_brush)
     ptr original_ptr;
     mapbrush_t *mapbrush;
 
-    bspbrush_t *original_brush() { return original_ptr ? original_ptr.get() : this; }
-    const bspbrush_t *original_brush() const { return original_ptr ? original_ptr.get() : this; }
+    bspbrush_t *original_brush() { return original ? original : this; }
+    const bspbrush_t *original_brush() const { return original ? original : this; }
 
     aabb3d bounds;
     int side, testside; // side of node during construction
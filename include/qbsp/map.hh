@@ -28,6 +28,7 @@
 #include <common/parser.hh>
 #include "common/cmdlib.hh"
 
+#include <array>
 #include <optional>
 #include <vector>
 #include <utility>
@@ -37,6 +38,8 @@
 #include <shared_mutex>
 #include <string_view>
 
+#include <tbb/concurrent_vector.h>
+
 struct mapface_t
 {
     size_t planenum;
@@ -68,9 +71,11 @@ struct mapface_t
     // with no transformations; this is for conversions only.
     std::optional<extended_texinfo_t> raw_info;
 
-    bool visible; // can any part of this side be seen from non-void parts of the level?
-                  // non-visible means we can discard the brush side
-                  // (avoiding generating a BSP spit, so expanding it outwards)
+    // can any part of this side be seen from non-void parts of the level?
+    // non-visible means we can discard the brush side
+    // (avoiding generating a BSP spit, so expanding it outwards).
+    // tracked per hull, since the clipping hulls are built concurrently.
+    std::array<bool, MAX_MAP_HULLS_H2> visible{};
 
     // this face is a bevel added by AddBrushBevels, and shouldn't be used as a splitter
     // for the main hull.
@@ -180,6 +185,32 @@ struct hashedge_t
     bool has_been_reused;
 };
 
+/**
+ * Edges emitted so far, keyed by their (v1, v2) vertex numbers.
+ * Open addressing with linear probing, so a lookup is a few probes into
+ * one flat array instead of a walk down a tree of separately allocated nodes.
+ */
+class edgehash_t
+{
+    std::vector<hashedge_t> m_edges;
+    // index into m_edges + 1, 0 for an empty slot; size is a power of two
+    std::vector<uint32_t> m_slots;
+
+    size_t slot_for(size_t v1, size_t v2) const;
+    void rehash(size_t num_slots);
+
+public:
+    // makes room for `count` edges without rehashing
+    void reserve(size_t count);
+    // adds the edge unless v1 -> v2 is already present
+    void emplace(const hashedge_t &edge);
+    hashedge_t *find(size_t v1, size_t v2);
+
+    inline bool empty() const { return m_edges.empty(); }
+    inline size_t size() const { return m_edges.size(); }
+    void clear();
+};
+
 struct mapdata_t
 {
     /* Arrays of actual items */
@@ -192,14 +223,19 @@ struct mapdata_t
     // output in the BSP, from the map's own sides. The positive planes
     // come first (are even-numbered, with 0 being even) and the negative
     // planes are odd-numbered.
-    std::vector<mapplane_t> planes;
+    // concurrent_vector keeps references stable, so planes can be read while
+    // other threads add new ones.
+    tbb::concurrent_vector<mapplane_t> planes;
 
     // planes indices (into the `planes` vector)
     std::unique_ptr<planehash_t> plane_hash;
 
     mapdata_t();
 
-    // add the specified plane to the list
+    // add the specified plane to the list. plane numbers are assigned in
+    // insertion order, so callers that need reproducible numbering must
+    // add planes in a deterministic order.
+    // all of the plane functions are thread-safe.
     size_t add_plane(const qplane3d &plane);
 
     std::optional<size_t> find_plane_nonfatal(const qplane3d &plane);
@@ -223,14 +259,16 @@ struct mapdata_t
     // hashed vertices; generated by EmitVertices
     std::unique_ptr<vertexhash_t> hashverts;
 
-    // find output index for specified already-output vector.
-    std::optional<size_t> find_emitted_hash_vector(const qvec3d &vert);
+    // find output index for specified already-output vector; if several
+    // are within epsilon, the lowest-numbered one. safe to call from
+    // several threads as long as no vectors are being added.
+    std::optional<size_t> find_emitted_hash_vector(const qvec3d &vert) const;
 
     // add vector to hash
     void add_hash_vector(const qvec3d &point, size_t num);
 
     // hashed edges; generated by EmitEdges
-    std::map<std::pair<size_t, size_t>, hashedge_t> hashedges;
+    edgehash_t hashedges;
 
     void add_hash_edge(size_t v1, size_t v2, int64_t edge_index, const face_t *face);
 
@@ -339,6 +377,7 @@ size_t EmitFaces(node_t *headnode);
 void EmitVertices(node_t *headnode);
 void ExportClipNodes(mapentity_t &entity, node_t *headnode, hull_index_t::value_type hullnum);
 void ExportDrawNodes(mapentity_t &entity, node_t *headnode, int firstface);
+void WriteBspBrushMap(std::string_view filename_suffix, const std::vector<bspbrush_t *> &list);
 void WriteBspBrushMap(std::string_view filename_suffix, const bspbrush_t::container &list);
 
 bool IsValidTextureProjection(const qvec3f &faceNormal, const qvec3f &s_vec, const qvec3f &t_vec);
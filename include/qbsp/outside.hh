@@ -31,7 +31,21 @@ struct tree_t;
 
 void WriteLeakTrail(std::ofstream &leakfile, qvec3d point1, const qvec3d &point2);
 
-bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes);
+struct portal_t;
+struct mapentity_t;
+
+// a leak found by FillOutside: the occupant that was reached and the portals leading to the void
+struct leak_t
+{
+    mapentity_t *entity = nullptr;
+    std::vector<portal_t *> line;
+};
+
+void WriteLeakFiles(const leak_t &leak);
+
+// if `leak` is given, a leak is recorded in it (if it's still empty) instead of writing
+// the leak files, for hulls built concurrently; see CreateClipHulls
+bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes, leak_t *leak = nullptr);
 void MarkBrushSidesInvisible(bspbrush_t::container &brushes);
 
 void FillBrushEntity(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes);
@@ -68,6 +68,13 @@ enum class conversion_t
     bp
 };
 
+enum class prtformat_t
+{
+    text,
+    binary,
+    both
+};
+
 // data representation of only extended flags
 // used by Q2 format; used by various systems.
 struct extended_texinfo_t
@@ -208,7 +215,9 @@ public:
     setting_scalar worldextent;
     setting_int32 leakdist;
     setting_bool forceprt1;
+    setting_enum<prtformat_t> prtformat;
     setting_tjunc tjunc;
+    setting_bool tjuncbruteforce;
     setting_bool objexport;
     setting_bool noextendedsurfflags;
     setting_bool wrbrushes;
@@ -421,7 +430,7 @@ struct leafdata_t
     int32_t area;
     contentflags_t contents; // leaf nodes (0 for decision nodes)
     std::vector<bspbrush_t *> original_brushes;
-    bspbrush_t::container bsp_brushes;
+    std::vector<bspbrush_t *> bsp_brushes; // owned by the tree
 };
 
 struct node_t
@@ -430,7 +439,7 @@ struct node_t
     aabb3d bounds; // bounding volume, not just points inside
     node_t *parent;
     // this is also a bounding volume like `bounds`
-    bspbrush_t::ptr volume; // one for each leaf/node
+    bspbrush_t *volume = nullptr; // one for each leaf/node; owned by the tree
     std::variant<nodedata_t, leafdata_t> data;
 
     // data for portals and detail separator nodes
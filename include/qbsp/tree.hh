@@ -26,10 +26,12 @@
 #include <qbsp/portals.hh>
 #include <common/qvec.hh>
 
+#include <deque>
 #include <memory>
 #include <vector>
 
 #include <tbb/concurrent_vector.h>
+#include <tbb/enumerable_thread_specific.h>
 
 struct portal_t;
 struct tree_t;
@@ -62,6 +64,25 @@ struct tree_t
     // returns a raw pointer to it
     node_t *create_node();
 
+    // the brushes BrushBSP works on: copies of its input, the fragments it splits
+    // them into, and the node volumes. they're owned here and freed in one go with
+    // the tree; everything else only borrows them. each thread has its own pool.
+    struct brush_pool_t
+    {
+        std::deque<bspbrush_t> brushes;
+        // released brushes, to be reused with their side lists' capacity
+        std::vector<bspbrush_t *> free;
+    };
+
+    // here for ownership/memory management - not intended to be iterated directly
+    tbb::enumerable_thread_specific<brush_pool_t> brush_pools;
+
+    // creates a new, empty brush owned by `this` and returns a raw pointer to it
+    bspbrush_t *create_brush();
+
+    // gives a brush from create_brush back to be reused; it must not be used after this
+    void release_brush(bspbrush_t *brush);
+
     // reset the tree without clearing allocated vector space
     void clear();
 };
@@ -83,6 +83,16 @@ public:
     inline void clear() { memset(bits.get(), 0, byte_size()); }
     inline void setall() { memset(bits.get(), 0xff, byte_size()); }
 
+    // sizes must match
+    inline leafbits_t &operator|=(const leafbits_t &other)
+    {
+        uint32_t *dst = bits.get();
+        const uint32_t *src = other.bits.get();
+        for (size_t i = 0, n = block_size(); i < n; i++)
+            dst[i] |= src[i];
+        return *this;
+    }
+
     inline uint32_t *data() { return bits.get(); }
     inline const uint32_t *data() const { return bits.get(); }
 
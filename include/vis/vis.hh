@@ -26,6 +26,11 @@
 #include <common/prtfile.hh>
 #include <vis/leafbits.hh>
 
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <optional>
+
 constexpr double VIS_ON_EPSILON = 0.1;
 constexpr double VIS_EQUAL_EPSILON = 0.001;
 
@@ -135,6 +140,17 @@ struct visportal_t
     leafbits_t visbits, mightsee;
     int nummightsee;
     int numcansee;
+
+    // status is read and written by several worker threads at once; the release store
+    // of pstat_done publishes visbits to any thread that sees it with an acquire load
+    inline pstatus_t load_status() const
+    {
+        return std::atomic_ref<pstatus_t>(const_cast<pstatus_t &>(status)).load(std::memory_order_acquire);
+    }
+    inline void store_status(pstatus_t value)
+    {
+        std::atomic_ref<pstatus_t>(status).store(value, std::memory_order_release);
+    }
 };
 
 inline float viswinding_t::distFromPortal(visportal_t &p)
@@ -153,6 +169,50 @@ struct leaf_t
     std::vector<visportal_t *> portals;
 };
 
+/**
+ * Hands out portals to the vis worker threads, least complex (lowest nummightsee) first
+ * so later portals can reuse the earlier information.
+ *
+ * Indexed binary min-heap; update() re-prioritizes a queued portal when its nummightsee
+ * drops. Every operation is O(log n) under a short-lived lock, instead of a linear scan
+ * of all portals.
+ */
+class portal_scheduler_t
+{
+    struct entry_t
+    {
+        int key;
+        uint32_t portalnum;
+
+        inline bool operator<(const entry_t &other) const
+        {
+            // ties go to the lower portal number, matching the order of a linear scan
+            return key < other.key || (key == other.key && portalnum < other.portalnum);
+        }
+    };
+
+    std::mutex lock;
+    std::vector<entry_t> heap;
+    std::vector<int32_t> positions; // index in heap, or -1 if not queued
+
+    void set_entry(size_t index, const entry_t &entry);
+    void sift_up(size_t index);
+    void sift_down(size_t index);
+
+public:
+    // queue every portal that hasn't been started yet
+    void reset(const std::vector<visportal_t> &portals);
+    void clear();
+
+    // removes and returns the portal with the lowest key, if any
+    std::optional<size_t> pop();
+
+    // lowers the key of a queued portal; no-op if it was already popped
+    void update(size_t portalnum, int nummightsee);
+
+    size_t size();
+};
+
 constexpr size_t MAX_SEPARATORS = MAX_WINDING;
 constexpr size_t STACK_WINDINGS = 3; // source, pass and a temp for clipping
 
@@ -165,11 +225,12 @@ struct pstack_t
     viswinding_t windings[STACK_WINDINGS]; // Fixed size windings
     bool windings_used[STACK_WINDINGS];
     qplane3d portalplane;
-    leafbits_t *mightsee; // bit string
+    leafbits_t *mightsee; // bit string; owned by flowbits_t (or the portal, for the head)
     qplane3d separators[2][MAX_SEPARATORS]; /* Separator cache */
     int numseparators[2];
     char did_targetchecks;
     unsigned num_expected_targetchecks;
+    unsigned depth; // recursion depth; the head is 0
 };
 
 // important for perf as a ton of these are stack allocated, needs to be be just a pointer bump
@@ -188,6 +249,7 @@ struct visstats_t
     int64_t c_leafskip = 0;
     int64_t c_portalskip = 0;
     int64_t c_targetcheck = 0;
+    int64_t c_bitsetalloc = 0;
 
     visstats_t operator+(const visstats_t &other) const
     {
@@ -203,6 +265,7 @@ struct visstats_t
         result.c_leafskip = this->c_leafskip + other.c_leafskip;
         result.c_portalskip = this->c_portalskip + other.c_portalskip;
         result.c_targetcheck = this->c_targetcheck + other.c_targetcheck;
+        result.c_bitsetalloc = this->c_bitsetalloc + other.c_bitsetalloc;
         return result;
     }
 };
@@ -210,10 +273,52 @@ struct visstats_t
 viswinding_t *AllocStackWinding(pstack_t &stack);
 void FreeStackWinding(viswinding_t *&w, pstack_t &stack);
 viswinding_t *ClipStackWinding(visstats_t &stats, viswinding_t *in, pstack_t &stack, const qplane3d &split);
+viswinding_t *ClipStackWindingToPlanes(
+    visstats_t &stats, viswinding_t *in, pstack_t &stack, const qplane3d *planes, size_t numplanes);
+
+// batched plane distance kernels (classify.cc)
+
+enum class vis_simd_t
+{
+    AUTO,
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+using point_distances_fn = void (*)(const qvec3d *points, size_t numpoints, const qplane3d &plane, double *dists);
+using plane_distances_fn = void (*)(const qplane3d *planes, size_t numplanes, const qvec3d &point, double *dists);
+
+// dists[i] = plane.distance_to(w[i]) for every point of w
+void WindingPlaneDistances(const viswinding_t &w, const qplane3d &plane, double *dists);
+// dists[i] = planes[i].distance_to(point)
+void PlanePointDistances(const qplane3d *planes, size_t numplanes, const qvec3d &point, double *dists);
+// selects the kernels used by the above; returns what was actually selected
+vis_simd_t SetVisSIMD(vis_simd_t requested);
+
+/**
+ * Per-thread bitsets for PortalFlow: the mightsee of every recursion level of
+ * RecursiveLeafFlow, plus scratch space for the target checks. They're sized
+ * once and reused across PortalFlow calls, so flowing a portal doesn't allocate
+ * once a thread has reached its deepest recursion; stats.c_bitsetalloc counts
+ * the allocations that do happen.
+ */
+struct flowbits_t
+{
+    std::deque<leafbits_t> mightsee; // indexed by pstack_t::depth - 1; deque keeps references stable
+    leafbits_t targetcheck_mightsee;
+    leafbits_t portalbits, nextportalbits; // in contradiction to the typename, one bit per portal
+
+    // drops everything if the portal/leaf counts changed since the last call
+    void prepare(visstats_t &stats);
+
+    leafbits_t &level(unsigned depth, visstats_t &stats);
+};
 
 struct threaddata_t
 {
     leafbits_t &leafvis;
+    flowbits_t &bits;
     visportal_t *base;
     pstack_t pstack_head;
     visstats_t stats;
@@ -233,12 +338,15 @@ extern int leafbytes;
 extern int leafbytes_real;
 extern int leaflongs;
 
-extern fs::path portalfile, statefile, statetmpfile;
+extern fs::path portalfile, statefile, statetmpfile, incrementalfile;
 
 void BasePortalVis();
 
 visstats_t PortalFlow(visportal_t *p);
 
+// held while reading a portal's mightsee from outside the worker that owns it
+std::unique_lock<std::mutex> LockPortalSourceLeaf(const visportal_t *p);
+
 void CalcAmbientSounds(mbsp_t *bsp);
 
 void CalcPHS(mbsp_t *bsp);
@@ -246,9 +354,24 @@ void CalcPHS(mbsp_t *bsp);
 extern time_point starttime, endtime, statetime;
 
 void SaveVisState();
+// periodic checkpoints are written by a background thread while one of these is alive
+struct vis_state_writer_scope
+{
+    vis_state_writer_scope();
+    ~vis_state_writer_scope();
+
+    vis_state_writer_scope(const vis_state_writer_scope &) = delete;
+    vis_state_writer_scope &operator=(const vis_state_writer_scope &) = delete;
+};
+// snapshots the portal states for the writer; false if it's still busy with the last one
+bool QueueVisState(time_point now);
 bool LoadVisState();
 void CleanVisState();
 
+void SaveIncrementalVis();
+// marks portals whose visibility can be reused from the previous compile as done; returns how many
+int LoadIncrementalVis();
+
 #include <common/settings.hh>
 #include <common/fs.hh>
 
@@ -271,12 +394,21 @@ public:
     setting_scalar visdist{
         this, "visdist", 0.0, &vis_advanced_group, "control the distance required for a portal to be considered seen"};
     setting_bool nostate{this, "nostate", false, &vis_advanced_group, "ignore saved state files, for forced re-runs"};
+    setting_scalar stateinterval{this, "stateinterval", 300.0, 0.0, std::numeric_limits<float>::max(),
+        &vis_advanced_group, "seconds between saving the vis state while running (0 = only save it at the end)"};
+    setting_bool incremental{this, "incremental", false, &vis_advanced_group,
+        "save the final portal visibility to a .vcache file, and reuse it for portals whose surroundings haven't changed since the previous compile"};
     setting_bool phsonly{
         this, "phsonly", false, &vis_advanced_group, "re-calculate the PHS of a Quake II BSP without touching the PVS"};
     setting_invertible_bool autoclean{
         this, "autoclean", true, &vis_output_group, "remove any extra files on successful completion"};
     setting_scalar targetratio{this, "targetchecks", 0.5, 0.0, 9999.0, &performance_group,
         "target ratio of target checks to regular checks (0.0 = no target checks, 1.0 = equal amounts of regular and target checks)"};
+    setting_enum<vis_simd_t> simd{this, "simd", vis_simd_t::AUTO,
+        {{"auto", vis_simd_t::AUTO}, {"scalar", vis_simd_t::SCALAR}, {"sse2", vis_simd_t::SSE2},
+            {"avx2", vis_simd_t::AVX2}},
+        &performance_group,
+        "instruction set used for winding clipping. auto = best supported by the CPU. output is identical for all of them"};
 
     fs::path sourceMap;
 
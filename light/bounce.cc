@@ -32,6 +32,7 @@
 
 #include <common/polylib.hh>
 #include <common/bsputils.hh>
+#include <common/profile.hh>
 
 #include <vector>
 #include <unordered_map>
@@ -224,6 +225,7 @@ static bool MakeBounceLightsThread(
 
 bool MakeBounceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp, size_t depth)
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     std::atomic_bool any_to_bounce = false;
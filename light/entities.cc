@@ -20,10 +20,14 @@
 #include <light/entities.hh>
 
 #include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <fstream>
+#include <map>
+#include <tuple>
 #include <common/imglib.hh> // for img::find
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <common/cmdlib.hh>
 #include <common/parser.hh>
 
@@ -31,11 +35,14 @@
 #include <light/trace.hh>
 #include <light/trace_embree.hh>
 #include <light/light.hh>
+#include <light/ltface.hh>
 #include <common/bsputils.hh>
 #include <common/parallel.hh>
 
 static std::vector<std::unique_ptr<light_t>> all_lights;
 static std::vector<sun_t> all_suns;
+static std::vector<sun_group_t> all_sun_groups;
+static std::vector<sun_stratum_t> all_sun_strata;
 static std::vector<entdict_t> entdicts;
 static std::vector<entdict_t> radlights;
 static std::vector<std::pair<std::string, int>> lightstyleForTargetname;
@@ -43,6 +50,7 @@ static std::vector<std::unique_ptr<light_t>> surfacelight_templates;
 static std::ofstream surflights_dump_file;
 static fs::path surflights_dump_filename;
 static std::map<std::string, light_t *> lights_by_switchableshadow_target;
+static light_index_t light_index;
 
 /**
  * Resets global data in this file
@@ -51,6 +59,8 @@ void ResetLightEntities()
 {
     all_lights.clear();
     all_suns.clear();
+    all_sun_groups.clear();
+    all_sun_strata.clear();
     entdicts.clear();
     radlights.clear();
 
@@ -60,6 +70,7 @@ void ResetLightEntities()
     surflights_dump_file = {};
     surflights_dump_filename.clear();
     lights_by_switchableshadow_target.clear();
+    light_index.clear();
 }
 
 std::vector<std::unique_ptr<light_t>> &GetLights()
@@ -72,11 +83,128 @@ const std::vector<entdict_t> &GetEntdicts()
     return entdicts;
 }
 
+const light_index_t &GetLightIndex()
+{
+    return light_index;
+}
+
 std::vector<sun_t> &GetSuns()
 {
     return all_suns;
 }
 
+const std::vector<sun_group_t> &GetSunGroups()
+{
+    return all_sun_groups;
+}
+
+std::vector<sun_group_t> GroupSuns(const std::vector<sun_t> &suns)
+{
+    std::vector<sun_group_t> groups;
+    std::map<std::tuple<qvec3f, bool>, size_t> group_for;
+
+    for (const sun_t &sun : suns) {
+        const qvec3f incoming = qv::normalize(sun.sunvec);
+        const bool negative = sun.sunlight < 0;
+        auto [it, inserted] = group_for.try_emplace({incoming, negative}, groups.size());
+        if (inserted) {
+            groups.push_back({incoming, negative, {}});
+        }
+        groups[it->second].suns.push_back(&sun);
+    }
+
+    return groups;
+}
+
+const std::vector<sun_stratum_t> &GetSunStrata()
+{
+    return all_sun_strata;
+}
+
+static float SunGroupWeight(const sun_group_t &group)
+{
+    float weight = 0;
+    for (const sun_t *sun : group.suns) {
+        weight += std::fabs(sun->sunlight) * LightSample_Brightness(sun->sunlight_color) / 255.0f;
+    }
+    // black suns still need a chance to be picked
+    return std::max(weight, LIGHT_EQUAL_EPSILON);
+}
+
+static sun_stratum_t MakeStratum(bool negative, uint32_t seed, std::vector<const sun_group_t *> groups)
+{
+    sun_stratum_t stratum{negative, seed, std::move(groups), {}};
+
+    float total = 0;
+    for (const sun_group_t *group : stratum.groups) {
+        total += SunGroupWeight(*group);
+        stratum.cdf.push_back(total);
+    }
+    for (float &p : stratum.cdf) {
+        p /= total;
+    }
+    stratum.cdf.back() = 1.0f;
+
+    return stratum;
+}
+
+std::vector<sun_stratum_t> StratifySuns(const std::vector<sun_group_t> &groups, int numstrata)
+{
+    std::vector<sun_stratum_t> strata;
+
+    if (numstrata <= 0) {
+        for (const sun_group_t &group : groups) {
+            strata.push_back(MakeStratum(group.negative, strata.size(), {&group}));
+        }
+        return strata;
+    }
+
+    for (const bool negative : {false, true}) {
+        std::vector<const sun_group_t *> sorted;
+        float total = 0;
+        for (const sun_group_t &group : groups) {
+            if (group.negative == negative) {
+                sorted.push_back(&group);
+                total += SunGroupWeight(group);
+            }
+        }
+
+        // rings of elevation, then around each ring, so neighbours end up in the same stratum
+        std::stable_sort(sorted.begin(), sorted.end(), [](const sun_group_t *a, const sun_group_t *b) {
+            const float ea = std::round(a->incoming[2] * 1000.0f), eb = std::round(b->incoming[2] * 1000.0f);
+            if (ea != eb) {
+                return ea < eb;
+            }
+            return std::atan2(a->incoming[1], a->incoming[0]) < std::atan2(b->incoming[1], b->incoming[0]);
+        });
+
+        // each group goes to the slice of equal light its middle falls in, so a group
+        // brighter than a slice (e.g. a strong _sunlight) ends up with a ray of its own
+        const float slice = total / numstrata;
+        std::vector<const sun_group_t *> current;
+        int current_slice = 0;
+        float cumulative = 0;
+
+        for (const sun_group_t *group : sorted) {
+            const float weight = SunGroupWeight(*group);
+            const int group_slice = std::min(static_cast<int>((cumulative + weight * 0.5f) / slice), numstrata - 1);
+            cumulative += weight;
+
+            if (!current.empty() && group_slice != current_slice) {
+                strata.push_back(MakeStratum(negative, strata.size(), std::move(current)));
+                current.clear();
+            }
+            current.push_back(group);
+            current_slice = group_slice;
+        }
+        if (!current.empty()) {
+            strata.push_back(MakeStratum(negative, strata.size(), std::move(current)));
+        }
+    }
+
+    return strata;
+}
+
 std::vector<entdict_t> &GetRadLights()
 {
     return radlights;
@@ -1216,8 +1344,153 @@ void EstimateLightVisibility()
     logging::parallel_for_each(all_lights, EstimateLightAABB);
 }
 
+/*
+ * ============================================================================
+ * LIGHT INDEX
+ * ============================================================================
+ */
+
+constexpr uint32_t LIGHT_INDEX_LEAF_SIZE = 4;
+
+static uint32_t BuildLightIndex_r(light_index_t &index, const std::vector<std::unique_ptr<light_t>> &lights,
+    uint32_t first, uint32_t count)
+{
+    const uint32_t nodenum = index.nodes.size();
+    index.nodes.emplace_back();
+
+    light_index_t::node_t node;
+    aabb3f origins;
+
+    for (uint32_t i = first; i < first + count; i++) {
+        const uint32_t lightnum = index.leaf_lights[i];
+        const qvec3f &origin = lights[lightnum]->origin.value();
+        const float dist = index.cull_dists[lightnum];
+
+        origins += origin;
+        node.bounds += aabb3f(origin - qvec3f(dist), origin + qvec3f(dist));
+    }
+
+    if (count <= LIGHT_INDEX_LEAF_SIZE) {
+        node.first_light = first;
+        node.num_lights = count;
+        index.nodes[nodenum] = node;
+        return nodenum;
+    }
+
+    // split at the median along the longest axis
+    const qvec3f size = origins.size();
+    const size_t axis = size[0] >= size[1] && size[0] >= size[2] ? 0 : (size[1] >= size[2] ? 1 : 2);
+    const uint32_t half = count / 2;
+    auto begin = index.leaf_lights.begin() + first;
+
+    std::nth_element(begin, begin + half, begin + count, [&](uint32_t a, uint32_t b) {
+        return std::tie(lights[a]->origin.value()[axis], a) < std::tie(lights[b]->origin.value()[axis], b);
+    });
+
+    node.children[0] = BuildLightIndex_r(index, lights, first, half);
+    node.children[1] = BuildLightIndex_r(index, lights, first + half, count - half);
+
+    index.nodes[nodenum] = node;
+    return nodenum;
+}
+
+void light_index_t::clear()
+{
+    cull_dists.clear();
+    unbounded.clear();
+    leaf_lights.clear();
+    nodes.clear();
+}
+
+void light_index_t::build(const settings::worldspawn_keys &cfg, const std::vector<std::unique_ptr<light_t>> &lights)
+{
+    clear();
+
+    cull_dists.resize(lights.size());
+
+    for (uint32_t i = 0; i < lights.size(); i++) {
+        cull_dists[i] = LightCullDistance(cfg, lights[i].get());
+
+        if (std::isinf(cull_dists[i])) {
+            unbounded.push_back(i);
+        } else {
+            leaf_lights.push_back(i);
+        }
+    }
+
+    if (!leaf_lights.empty()) {
+        BuildLightIndex_r(*this, lights, 0, leaf_lights.size());
+    }
+
+    logging::print(logging::flag::VERBOSE, "light index: {} nodes, {} unbounded lights\n", nodes.size(),
+        unbounded.size());
+}
+
+size_t light_index_t::query(const std::vector<std::unique_ptr<light_t>> &lights, const qvec3f &origin, float radius,
+    std::vector<uint64_t> &bits) const
+{
+    bits.assign((lights.size() + 63) / 64, 0);
+
+    auto set_bit = [&](uint32_t lightnum) { bits[lightnum / 64] |= nth_bit<uint64_t>(lightnum % 64); };
+
+    if (cull_dists.size() != lights.size()) {
+        for (uint32_t i = 0; i < lights.size(); i++) {
+            set_bit(i);
+        }
+        return lights.size();
+    }
+
+    size_t count = unbounded.size();
+    for (uint32_t lightnum : unbounded) {
+        set_bit(lightnum);
+    }
+
+    if (nodes.empty()) {
+        return count;
+    }
+
+    // the +1 keeps the node test conservative; lights are then checked exactly as CullLight() does
+    const float node_radius = radius + 1.0f;
+
+    uint32_t stack[64];
+    size_t stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size) {
+        const node_t &node = nodes[stack[--stack_size]];
+
+        const qvec3f closest = qv::max(node.bounds.mins(), qv::min(origin, node.bounds.maxs()));
+        if (qv::length2(closest - origin) > node_radius * node_radius) {
+            continue;
+        }
+
+        if (!node.num_lights) {
+            stack[stack_size++] = node.children[1];
+            stack[stack_size++] = node.children[0];
+            continue;
+        }
+
+        for (uint32_t i = node.first_light; i < node.first_light + node.num_lights; i++) {
+            const uint32_t lightnum = leaf_lights[i];
+            const qvec3f distvec = lights[lightnum]->origin.value() - origin;
+            const float dist = qv::length(distvec) - radius;
+
+            if (dist >= cull_dists[lightnum]) {
+                continue;
+            }
+
+            set_bit(lightnum);
+            count++;
+        }
+    }
+
+    return count;
+}
+
 void SetupLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
 {
+    profile::zone zone(__func__);
+
     logging::print("SetupLights: {} initial lights\n", all_lights.size());
 
     // Creates more light entities, needs to be done before the rest
@@ -1235,6 +1508,8 @@ void SetupLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
     SetupSpotlights(bsp, cfg);
     SetupSuns(cfg);
     SetupSkyDomes(cfg);
+    all_sun_groups = GroupSuns(all_suns);
+    all_sun_strata = StratifySuns(all_sun_groups, light_options.sunstrata.value());
     FixLightsOnFaces(bsp);
     if (light_options.visapprox.value() == visapprox_t::RAYS) {
         EstimateLightVisibility();
@@ -1242,7 +1517,13 @@ void SetupLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp)
         SetupLightLeafnums(bsp);
     }
 
-    logging::print("Final count: {} lights, {} suns in use.\n", all_lights.size(), all_suns.size());
+    light_index.build(cfg, all_lights);
+
+    logging::print("Final count: {} lights, {} suns in use ({} directions).\n", all_lights.size(), all_suns.size(),
+        all_sun_groups.size());
+    if (light_options.sunstrata.value()) {
+        logging::print("Sampling the sun directions with {} rays per point.\n", all_sun_strata.size());
+    }
 
     Q_assert(final_lightcount == all_lights.size());
 }
@@ -33,6 +33,7 @@
 #include <light/trace_embree.hh>
 
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <common/bsputils.hh>
 #include <common/numeric_cast.hh>
 #include <common/fs.hh>
@@ -65,6 +66,9 @@ static std::span<lightsurf_t> light_surfaces_span;
 // light_surfaces filtered down to just the emissive ones
 static std::vector<lightsurf_t *> emissive_light_surfaces;
 
+// emissive_light_surfaces grouped by bounce level (std::nullopt for direct emission)
+static std::map<std::optional<size_t>, surflight_tree_t> emissive_light_trees;
+
 std::span<lightsurf_t> &LightSurfaces()
 {
     return light_surfaces_span;
@@ -75,15 +79,37 @@ std::vector<lightsurf_t *> &EmissiveLightSurfaces()
     return emissive_light_surfaces;
 }
 
+const surflight_tree_t *EmissiveLightTree(const std::optional<size_t> &bounce_level)
+{
+    auto it = emissive_light_trees.find(bounce_level);
+
+    if (it == emissive_light_trees.end()) {
+        return nullptr;
+    }
+
+    return &it->second;
+}
+
 static void UpdateEmissiveLightSurfacesList()
 {
     emissive_light_surfaces.clear();
+    emissive_light_trees.clear();
+
+    std::set<std::optional<size_t>> bounce_levels;
 
     for (auto &surf_ptr : light_surfaces_span) {
         if (surf_ptr.vpl) {
             emissive_light_surfaces.push_back(&surf_ptr);
+
+            for (auto &style : surf_ptr.vpl->styles) {
+                bounce_levels.insert(style.bounce_level);
+            }
         }
     }
+
+    for (auto &bounce_level : bounce_levels) {
+        emissive_light_trees[bounce_level].build(emissive_light_surfaces, bounce_level);
+    }
 }
 
 std::vector<facesup_t> faces_sup; // lit2/bspx stuff
@@ -291,6 +317,8 @@ light_settings::light_settings()
       novanilla{this, "novanilla", false, &experimental_group, "implies -bspxlit; don't write vanilla lighting"},
       gate{this, "gate", LIGHT_EQUAL_EPSILON, &performance_group, "cutoff lights at this brightness level"},
       sunsamples{this, "sunsamples", 64, 8, 2048, &performance_group, "set samples for _sunlight2, default 64"},
+      sunstrata{this, "sunstrata", 0, 0, 2048, &performance_group,
+          "trace this many importance sampled sky rays per point instead of one per sun direction; 0 = off (default)"},
       arghradcompat{this, "arghradcompat", false, &output_group, "enable compatibility for Arghrad-specific keys"},
       nolighting{this, "nolighting", false, &output_group, "don't output main world lighting (Q2RTX)"},
       debugface{this, "debugface", std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::quiet_NaN(),
@@ -315,6 +343,9 @@ light_settings::light_settings()
               {"rays", visapprox_t::RAYS}},
           &debug_group,
           "change approximate visibility algorithm. auto = choose default based on format. vis = use BSP vis data (slow but precise). rays = use sphere culling with fired rays (fast but may miss faces)"},
+      raypackets{this, "raypackets", raypackets_t::SINGLE,
+          {{"single", raypackets_t::SINGLE}, {"8", raypackets_t::PACKET8}, {"16", raypackets_t::PACKET16}},
+          &performance_group, "trace rays one at a time (single) or in 8 / 16-wide SIMD packets"},
       lit{this, "lit",
           [&](const std::string &, parser_base_t &, source) {
               write_litfile |= lightfile::external;
@@ -388,6 +419,8 @@ light_settings::light_settings()
           "distance between lightgrid sample points, in world units. controls lightgrid size."},
       lightgrid_format{this, "lightgrid_format", lightgrid_format_t::OCTREE, {{"octree", lightgrid_format_t::OCTREE}},
           &experimental_group, "lightgrid BSPX lump to use"},
+      lightgrid_adaptive{this, "lightgrid_adaptive", 0.0f, 0.0f, 255.0f, &experimental_group,
+          "if nonzero, light the lightgrid coarsely and refine only near solid or where neighbouring samples differ by more than this (in 0-255 color units); the rest is interpolated"},
 
       dirtdebug{this, {"dirtdebug", "debugdirt"},
           [&](const std::string &, parser_base_t &, source) {
@@ -785,6 +818,7 @@ static void FindModelInfo(const mbsp_t *bsp)
  */
 static void LightWorld(bspdata_t *bspdata, const fs::path &source, bool forcedscale)
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     mbsp_t &bsp = std::get<mbsp_t>(bspdata->bsp);
@@ -1526,11 +1560,10 @@ int light_main(int argc, const char **argv)
     }
 
     WriteEntitiesToString(light_options, &bsp);
-    /* Convert data format back if necessary */
-    ConvertBSPFormat(&bspdata, bspdata.loadversion);
 
     if (!light_options.litonly.value()) {
-        WriteBSPFile(source, &bspdata);
+        /* Convert data format back while writing */
+        WriteBSPFile(source, &bspdata, bspdata.loadversion);
     }
 
     auto end = I_FloatTime();
@@ -1549,6 +1582,10 @@ int light_main(int argc, const char **argv)
         static_cast<float>(total_bounce_ray_hits) / static_cast<float>(total_samplepoints));
 #endif
     logging::print("{} empty lightmaps\n", static_cast<int>(fully_transparent_lightmaps));
+    logging::print("{} surface light emitters traced, {} culled\n", total_surflight_emitters_traced.load(),
+        total_surflight_emitters_culled.load());
+    logging::print("{} light entities tested, {} culled by the light index\n", total_light_entities_tested.load(),
+        total_light_entities_culled.load());
     logging::close();
 
     return 0;
@@ -33,6 +33,7 @@
 
 #include <common/prtfile.hh>
 #include <common/parallel.hh>
+#include <common/profile.hh>
 #include <common/qvec.hh>
 #include <common/cmdlib.hh>
 
@@ -364,7 +365,11 @@ static std::vector<uint8_t> MakeOctreeLump(const mbsp_t &bsp, const lightgrid_ra
     return vec;
 }
 
-std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp, qvec3f world_point)
+/**
+ * returns the point to sample the lightgrid at for `world_point`, and whether it's occluded.
+ * points in solid are moved to a nearby point in empty space if there's one.
+ */
+static std::tuple<qvec3f, bool> FixLightgridPoint(const mbsp_t *bsp, qvec3f world_point)
 {
     bool occluded = Light_PointInWorld(bsp, world_point);
     if (occluded) {
@@ -376,16 +381,279 @@ std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp
         }
     }
 
+    return {world_point, occluded};
+}
+
+std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp, qvec3f world_point)
+{
+    auto [fixed_point, occluded] = FixLightgridPoint(bsp, world_point);
+
     lightgrid_samples_t samples;
 
     if (!occluded)
-        samples = CalcLightgridAtPoint(bsp, world_point);
+        samples = CalcLightgridAtPoint(bsp, fixed_point);
 
     return {samples, occluded};
 }
 
+static size_t lightgrid_traced_points;
+
+size_t LightGridTracedPoints()
+{
+    return lightgrid_traced_points;
+}
+
+/**
+ * Adaptive sampling: the grid is split into blocks of ADAPTIVE_BLOCK_SIZE points
+ * and only the corners of each block are lit. A block whose corners agree
+ * (same styles, colors within `threshold`) and which doesn't touch solid is
+ * filled in by trilinear interpolation of its corners; otherwise it's split in
+ * half along each axis and the halves are tested the same way.
+ */
+static void AdaptiveLightgrid(const mbsp_t &bsp, lightgrid_raw_data &data, float threshold)
+{
+    constexpr int ADAPTIVE_BLOCK_SIZE = 8;
+
+    // grid points, inclusive on both ends; neighbouring blocks share a face
+    struct block_t
+    {
+        qvec3i mins, maxs;
+    };
+
+    const int num_points = data.grid_size[0] * data.grid_size[1] * data.grid_size[2];
+    const qvec3i last = data.grid_size - qvec3i(1, 1, 1);
+
+    // classify every point first; this is much cheaper than lighting it
+    std::vector<qvec3f> sample_points(num_points);
+    std::vector<uint8_t> in_solid(num_points);
+
+    logging::parallel_for(0, num_points, [&](int sample_index) {
+        const int z = (sample_index / (data.grid_size[0] * data.grid_size[1]));
+        const int y = (sample_index / data.grid_size[0]) % data.grid_size[1];
+        const int x = sample_index % data.grid_size[0];
+
+        const qvec3f world_point = data.grid_mins + (qvec3f{x, y, z} * data.grid_dist);
+        auto [fixed_point, occluded] = FixLightgridPoint(&bsp, world_point);
+
+        sample_points[sample_index] = fixed_point;
+        data.occlusion[sample_index] = occluded;
+        in_solid[sample_index] = occluded || fixed_point != world_point;
+    });
+
+    // points that have been lit exactly
+    std::vector<uint8_t> lit(num_points);
+
+    auto index_of = [&](const qvec3i &p) { return data.get_grid_index(p[0], p[1], p[2]); };
+
+    auto corner = [](const block_t &block, int i) -> qvec3i {
+        return {(i & 4) ? block.maxs[0] : block.mins[0], (i & 2) ? block.maxs[1] : block.mins[1],
+            (i & 1) ? block.maxs[2] : block.mins[2]};
+    };
+
+    auto can_interpolate = [&](const block_t &block) {
+        for (int z = block.mins[2]; z <= block.maxs[2]; ++z) {
+            for (int y = block.mins[1]; y <= block.maxs[1]; ++y) {
+                for (int x = block.mins[0]; x <= block.maxs[0]; ++x) {
+                    if (in_solid[data.get_grid_index(x, y, z)]) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        const lightgrid_samples_t &first = data.grid_result[index_of(block.mins)];
+
+        for (int i = 1; i < 8; ++i) {
+            const lightgrid_samples_t &other = data.grid_result[index_of(corner(block, i))];
+
+            for (size_t s = 0; s < first.samples_by_style.size(); ++s) {
+                const lightgrid_sample_t &a = first.samples_by_style[s];
+                const lightgrid_sample_t &b = other.samples_by_style[s];
+
+                if (a.used != b.used) {
+                    return false;
+                }
+                if (!a.used) {
+                    break;
+                }
+                if (a.style != b.style) {
+                    return false;
+                }
+                for (int c = 0; c < 3; ++c) {
+                    if (!(std::abs(a.color[c] - b.color[c]) <= threshold)) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        return true;
+    };
+
+    // fills in the points of `block` that it owns: each point belongs to exactly one
+    // of the final blocks, so the blocks can be filled in parallel
+    auto interpolate = [&](const block_t &block) {
+        std::array<const lightgrid_samples_t *, 8> corners;
+        for (int i = 0; i < 8; ++i) {
+            corners[i] = &data.grid_result[index_of(corner(block, i))];
+        }
+
+        qvec3i owned_maxs;
+        for (int axis = 0; axis < 3; ++axis) {
+            owned_maxs[axis] = (block.maxs[axis] == last[axis]) ? block.maxs[axis] : block.maxs[axis] - 1;
+        }
+
+        for (int z = block.mins[2]; z <= owned_maxs[2]; ++z) {
+            for (int y = block.mins[1]; y <= owned_maxs[1]; ++y) {
+                for (int x = block.mins[0]; x <= owned_maxs[0]; ++x) {
+                    const qvec3i p{x, y, z};
+
+                    if (lit[index_of(p)]) {
+                        // lit as the corner of a neighbouring block
+                        continue;
+                    }
+
+                    qvec3f t;
+                    for (int axis = 0; axis < 3; ++axis) {
+                        const int extent = block.maxs[axis] - block.mins[axis];
+                        t[axis] = extent ? static_cast<float>(p[axis] - block.mins[axis]) / extent : 0.0f;
+                    }
+
+                    lightgrid_samples_t result = *corners[0];
+
+                    for (auto &sample : result.samples_by_style) {
+                        if (sample.used) {
+                            sample.color = {};
+                        }
+                    }
+
+                    for (int i = 0; i < 8; ++i) {
+                        const float weight = ((i & 4) ? t[0] : 1.0f - t[0]) * ((i & 2) ? t[1] : 1.0f - t[1]) *
+                                             ((i & 1) ? t[2] : 1.0f - t[2]);
+
+                        for (size_t s = 0; s < result.samples_by_style.size(); ++s) {
+                            if (!result.samples_by_style[s].used) {
+                                break;
+                            }
+                            result.samples_by_style[s].color += corners[i]->samples_by_style[s].color * weight;
+                        }
+                    }
+
+                    data.grid_result[index_of(p)] = result;
+                }
+            }
+        }
+    };
+
+    // the top level blocks
+    std::vector<block_t> blocks;
+
+    for (int z = 0; z == 0 || z < last[2]; z += ADAPTIVE_BLOCK_SIZE) {
+        for (int y = 0; y == 0 || y < last[1]; y += ADAPTIVE_BLOCK_SIZE) {
+            for (int x = 0; x == 0 || x < last[0]; x += ADAPTIVE_BLOCK_SIZE) {
+                const qvec3i mins{x, y, z};
+                blocks.push_back({mins, qv::min(mins + qvec3i(ADAPTIVE_BLOCK_SIZE), last)});
+            }
+        }
+    }
+
+    std::vector<block_t> interpolated_blocks;
+    size_t num_lit = 0;
+
+    while (!blocks.empty()) {
+        // light the corners that haven't been lit by an earlier level
+        std::vector<int> to_light;
+        for (const block_t &block : blocks) {
+            for (int i = 0; i < 8; ++i) {
+                const int sample_index = index_of(corner(block, i));
+                if (!lit[sample_index] && !data.occlusion[sample_index]) {
+                    lit[sample_index] = true;
+                    to_light.push_back(sample_index);
+                }
+            }
+        }
+
+        logging::parallel_for(static_cast<size_t>(0), to_light.size(), [&](size_t i) {
+            const int sample_index = to_light[i];
+            data.grid_result[sample_index] = CalcLightgridAtPoint(&bsp, sample_points[sample_index]);
+        });
+
+        num_lit += to_light.size();
+
+        // blocks one point apart on every axis are made up of corners only, so they're done.
+        // the rest are either interpolated or split for the next level.
+        std::vector<std::array<block_t, 8>> children(blocks.size());
+        std::vector<uint8_t> num_children(blocks.size());
+
+        logging::parallel_for(static_cast<size_t>(0), blocks.size(), [&](size_t i) {
+            const block_t &block = blocks[i];
+            const qvec3i extent = block.maxs - block.mins;
+
+            if (extent[0] <= 1 && extent[1] <= 1 && extent[2] <= 1) {
+                return;
+            }
+
+            if (can_interpolate(block)) {
+                num_children[i] = 0xff;
+                return;
+            }
+
+            const qvec3i mid = block.mins + (extent / 2);
+            int count = 0;
+
+            for (int octant = 0; octant < 8; ++octant) {
+                block_t child;
+                bool valid = true;
+
+                for (int axis = 0; axis < 3; ++axis) {
+                    const bool upper = octant & (4 >> axis);
+
+                    if (extent[axis] <= 1) {
+                        // not split on this axis
+                        valid = valid && !upper;
+                        child.mins[axis] = block.mins[axis];
+                        child.maxs[axis] = block.maxs[axis];
+                    } else {
+                        child.mins[axis] = upper ? mid[axis] : block.mins[axis];
+                        child.maxs[axis] = upper ? block.maxs[axis] : mid[axis];
+                    }
+                }
+
+                if (valid) {
+                    children[i][count++] = child;
+                }
+            }
+
+            num_children[i] = count;
+        });
+
+        std::vector<block_t> next_blocks;
+
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (num_children[i] == 0xff) {
+                interpolated_blocks.push_back(blocks[i]);
+            } else {
+                next_blocks.insert(next_blocks.end(), children[i].begin(), children[i].begin() + num_children[i]);
+            }
+        }
+
+        blocks = std::move(next_blocks);
+    }
+
+    logging::parallel_for(static_cast<size_t>(0), interpolated_blocks.size(),
+        [&](size_t i) { interpolate(interpolated_blocks[i]); });
+
+    lightgrid_traced_points = num_lit;
+
+    const size_t num_unoccluded = std::count(data.occlusion.begin(), data.occlusion.end(), 0);
+    logging::print("     {} of {} unoccluded points lit, {} interpolated from {} blocks\n", num_lit, num_unoccluded,
+        num_unoccluded - num_lit, interpolated_blocks.size());
+}
+
 void LightGrid(bspdata_t *bspdata)
 {
+    profile::zone zone(__func__);
+
     if (!light_options.lightgrid.value())
         return;
 
@@ -410,21 +678,27 @@ void LightGrid(bspdata_t *bspdata)
 
     data.occlusion.resize(data.grid_size[0] * data.grid_size[1] * data.grid_size[2]);
 
-    logging::parallel_for(0, data.grid_size[0] * data.grid_size[1] * data.grid_size[2], [&](int sample_index) {
-        const int z = (sample_index / (data.grid_size[0] * data.grid_size[1]));
-        const int y = (sample_index / data.grid_size[0]) % data.grid_size[1];
-        const int x = sample_index % data.grid_size[0];
+    if (light_options.lightgrid_adaptive.value() > 0) {
+        AdaptiveLightgrid(bsp, data, light_options.lightgrid_adaptive.value());
+    } else {
+        logging::parallel_for(0, data.grid_size[0] * data.grid_size[1] * data.grid_size[2], [&](int sample_index) {
+            const int z = (sample_index / (data.grid_size[0] * data.grid_size[1]));
+            const int y = (sample_index / data.grid_size[0]) % data.grid_size[1];
+            const int x = sample_index % data.grid_size[0];
 
-        qvec3f world_point = data.grid_mins + (qvec3f{x, y, z} * data.grid_dist);
+            qvec3f world_point = data.grid_mins + (qvec3f{x, y, z} * data.grid_dist);
 
-        bool occluded;
-        lightgrid_samples_t samples;
+            bool occluded;
+            lightgrid_samples_t samples;
 
-        std::tie(samples, occluded) = FixPointAndCalcLightgrid(&bsp, world_point);
+            std::tie(samples, occluded) = FixPointAndCalcLightgrid(&bsp, world_point);
 
-        data.grid_result[sample_index] = samples;
-        data.occlusion[sample_index] = occluded;
-    });
+            data.grid_result[sample_index] = samples;
+            data.occlusion[sample_index] = occluded;
+        });
+
+        lightgrid_traced_points = std::count(data.occlusion.begin(), data.occlusion.end(), 0);
+    }
 
     // the maximum used styles across the map.
     data.num_styles = [&]() {
@@ -30,6 +30,7 @@
 
 #include <common/imglib.hh>
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <common/bsputils.hh>
 #include <common/qvec.hh>
 #include <common/ostream.hh>
@@ -38,13 +39,17 @@
 #include <cassert>
 #include <cmath>
 #include <algorithm>
+#include <bit>
 #include <fstream>
+#include <limits>
 
 #if 0
 std::atomic<uint32_t> total_light_rays, total_light_ray_hits, total_samplepoints;
 std::atomic<uint32_t> total_bounce_rays, total_bounce_ray_hits;
 std::atomic<uint32_t> total_surflight_rays, total_surflight_ray_hits; // mxd
 #endif
+std::atomic<uint64_t> total_surflight_emitters_traced, total_surflight_emitters_culled;
+std::atomic<uint64_t> total_light_entities_tested, total_light_entities_culled;
 
 thread_local static raystream_occlusion_t occlusion_stream;
 thread_local static raystream_intersection_t intersection_stream;
@@ -1173,6 +1178,51 @@ inline bool CullLight(const light_t *entity, const lightsurf_t *lightsurf)
     return fabs(GetLightValue(cfg, entity, dist)) <= light_options.gate.value();
 }
 
+float LightCullDistance(const settings::worldspawn_keys &cfg, const light_t *entity)
+{
+    constexpr float unbounded = std::numeric_limits<float>::infinity();
+
+    // written so that nan light values are never culled
+    auto reaches = [&](float dist) {
+        return !(fabs(GetLightValue(cfg, entity, dist)) <= light_options.gate.value());
+    };
+
+    const light_formula_t formula = entity->getFormula();
+
+    if (formula == LF_INFINITE || formula == LF_LOCALMIN) {
+        return reaches(0) ? unbounded : 0;
+    }
+    if (formula == LF_LINEAR && entity->falloff.value() > 0) {
+        return reaches(entity->falloff.value()) ? unbounded : entity->falloff.value();
+    }
+
+    // the remaining formulas only fall off with distance when this is positive
+    if (!(cfg.scaledist.value() * entity->atten.value() > 0)) {
+        return unbounded;
+    }
+
+    float lo = 0, hi = 1;
+    while (reaches(hi)) {
+        lo = hi;
+        hi *= 2;
+        if (hi > 1e7f) {
+            return unbounded;
+        }
+    }
+
+    for (int i = 0; i < 24; i++) {
+        const float mid = (lo + hi) * 0.5f;
+        if (reaches(mid)) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // small margin so callers comparing against a slightly differently rounded distance stay conservative
+    return hi * 1.001f + 0.01f;
+}
+
 static bool VisCullEntity(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, const mleaf_t *entleaf)
 {
     if (pvs.empty()) {
@@ -1384,33 +1434,70 @@ static void LightPoint_Entity(const mbsp_t *bsp, raystream_occlusion_t &rs, cons
     }
 }
 
+/*
+ * Picks the group of the stratum that the ray from this point samples; returns it with
+ * 1 / the probability of picking it. Deterministic per point, so reruns match.
+ */
+static std::pair<const sun_group_t *, float> SunStratum_Pick(const sun_stratum_t &stratum, const qvec3f &point)
+{
+    if (stratum.groups.size() == 1) {
+        return {stratum.groups.front(), 1.0f};
+    }
+
+    uint32_t h = stratum.seed * 0x9e3779b9u;
+    for (int i = 0; i < 3; i++) {
+        h ^= std::bit_cast<uint32_t>(point[i]) + 0x9e3779b9u + (h << 6) + (h >> 2);
+    }
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+
+    const float u = (h >> 8) * (1.0f / 16777216.0f);
+    const size_t k = std::min<size_t>(
+        std::upper_bound(stratum.cdf.begin(), stratum.cdf.end(), u) - stratum.cdf.begin(), stratum.cdf.size() - 1);
+    const float p = stratum.cdf[k] - (k ? stratum.cdf[k - 1] : 0.0f);
+
+    return {stratum.groups[k], 1.0f / p};
+}
+
 /*
  * =============
  * LightFace_Sky
+ *
+ * Lights the face with a stratum of sun groups, e.g. the matching samples of
+ * several sky domes: one ray is traced per sample point in the direction of
+ * the group it picks, and every sun of that group that it reaches adds its
+ * light.
  * =============
  */
-static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+static void LightFace_Sky(
+    const mbsp_t *bsp, const sun_stratum_t &stratum, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
 {
     const settings::worldspawn_keys &cfg = *lightsurf->cfg;
     const modelinfo_t *modelinfo = lightsurf->modelinfo;
     const qplane3f &plane = lightsurf->plane;
 
-    // FIXME: Normalized sun vector should be stored in the sun_t. Also clarify which way the vector points (towards or
-    // away..)
-    // FIXME: Much of this is copied/pasted from LightFace_Entity, should probably be merged
-    qvec3f incoming = qv::normalize(sun->sunvec);
-
-    /* Don't bother if surface facing away from sun */
-    const float dp = qv::dot(incoming, plane.normal);
-    if (dp < -LIGHT_ANGLE_EPSILON && !lightsurf->curved && !lightsurf->twosided) {
-        return;
-    }
-
     // check lighting channels (currently sunlight is always on CHANNEL_MASK_DEFAULT)
     if (!(lightsurf->object_channel_mask & CHANNEL_MASK_DEFAULT)) {
         return;
     }
 
+    // the group each pushed ray samples, and where its suns' light starts in colors
+    struct pushed_group_t
+    {
+        const sun_group_t *group;
+        size_t first;
+    };
+
+    // light each sun of the group carries along each pushed ray; zero where it's gated
+    thread_local static std::vector<pushed_group_t> pushed;
+    thread_local static std::vector<qvec3f> colors, normalcontribs;
+    pushed.clear();
+    colors.clear();
+    normalcontribs.clear();
+
     /* Check each point... */
     raystream_intersection_t &rs = intersection_stream;
     rs.clearPushedRays();
@@ -1424,32 +1511,61 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
         const qvec3f &surfpoint = sample.point;
         const qvec3f &surfnorm = sample.normal;
 
-        float angle = qv::dot(incoming, surfnorm);
+        const auto [group, scale] = SunStratum_Pick(stratum, surfpoint);
+        const qvec3f &incoming = group->incoming;
+
+        /* Don't bother if surface facing away from sun */
+        const float dp = qv::dot(incoming, plane.normal);
+        if (dp < -LIGHT_ANGLE_EPSILON && !lightsurf->curved && !lightsurf->twosided) {
+            continue;
+        }
+
+        float sample_angle = qv::dot(incoming, surfnorm);
         if (lightsurf->twosided) {
-            if (angle < 0) {
-                angle = -angle;
+            if (sample_angle < 0) {
+                sample_angle = -sample_angle;
             }
         }
 
-        angle = std::max(0.0f, angle);
+        sample_angle = std::max(0.0f, sample_angle);
 
-        angle = (1.0f - sun->anglescale) + sun->anglescale * angle;
-        float value = angle * sun->sunlight;
+        std::optional<float> dirtscale;
+        bool any = false;
+        const size_t first = colors.size();
 
-        if (sun->dirt) {
-            value *= Dirt_GetScaleFactor(cfg, sample.occlusion, NULL, 0.0f, lightsurf);
-        }
+        for (const sun_t *sun : group->suns) {
+            const float angle = (1.0f - sun->anglescale) + sun->anglescale * sample_angle;
+            float value = angle * sun->sunlight;
 
-        qvec3f color = sun->sunlight_color * (value / 255.0f);
+            if (sun->dirt) {
+                if (!dirtscale) {
+                    dirtscale = Dirt_GetScaleFactor(cfg, sample.occlusion, NULL, 0.0f, lightsurf);
+                }
+                value *= *dirtscale;
+            }
 
-        /* Quick distance check first */
-        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
-            continue;
+            qvec3f color = sun->sunlight_color * (value / 255.0f);
+
+            /* Quick distance check first */
+            if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
+                colors.emplace_back();
+                normalcontribs.emplace_back();
+                continue;
+            }
+
+            colors.push_back(color * scale);
+            normalcontribs.push_back(incoming * (value * scale));
+            any = true;
         }
 
-        qvec3f normalcontrib = incoming * value;
+        if (!any) {
+            colors.resize(first);
+            normalcontribs.resize(first);
+            continue;
+        }
 
-        rs.pushRay(i, surfpoint, incoming, MAX_SKY_DIST, &color, &normalcontrib);
+        pushed.push_back({group, first});
+        rs.pushRay(i, surfpoint, incoming, MAX_SKY_DIST);
     }
 
     // We need to check if the first hit face is a sky face, so we need
@@ -1457,7 +1573,7 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
     rs.tracePushedRaysIntersection(modelinfo, CHANNEL_MASK_DEFAULT);
 
     /* if sunlight is set, use a style 0 light map */
-    int cached_style = sun->style;
+    int cached_style = stratum.groups.front()->suns.front()->style;
     lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
 
     const int N = rs.numPushedRays();
@@ -1470,54 +1586,68 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
             continue;
         }
 
-        // check if we hit the wrong texture
-        if (sun->suntexture_value) {
-            const triinfo *face = rs.getPushedRayHitFaceInfo(j);
-            if (sun->suntexture_value != face->texture) {
+        const ray_io &ray = rs.getRay(j);
+        const int i = ray.index;
+        const sun_group_t &group = *pushed[j].group;
+
+        for (size_t k = 0; k < group.suns.size(); k++) {
+            const sun_t *sun = group.suns[k];
+            const size_t contrib = pushed[j].first + k;
+
+            if (colors[contrib] == qvec3f{}) {
                 continue;
             }
-        }
 
-        const ray_io &ray = rs.getRay(j);
-        const int i = ray.index;
+            // check if we hit the wrong texture
+            if (sun->suntexture_value) {
+                const triinfo *face = rs.getPushedRayHitFaceInfo(j);
+                if (sun->suntexture_value != face->texture) {
+                    continue;
+                }
+            }
 
-        // check if we hit a dynamic shadow caster
-        int desired_style = sun->style;
-        if (desired_style == 0) {
-            desired_style = ray.dynamic_style;
-        }
+            // check if we hit a dynamic shadow caster
+            int desired_style = sun->style;
+            if (desired_style == 0) {
+                desired_style = ray.dynamic_style;
+            }
 
-        // if necessary, switch which lightmap we are writing to.
-        if (desired_style != cached_style) {
-            cached_style = desired_style;
-            cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
-        }
+            // if necessary, switch which lightmap we are writing to.
+            if (desired_style != cached_style) {
+                cached_style = desired_style;
+                cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
+            }
 
-        lightsample_t &sample = cached_lightmap->samples[i];
+            lightsample_t &sample = cached_lightmap->samples[i];
+            const qvec3f color = rs.tintPushedRayColor(j, colors[contrib]);
 
-        sample.color += rs.getPushedRayColor(j);
-        cached_lightmap->bounce_color += rs.getPushedRayColor(j);
-        sample.direction += ray.normalcontrib;
+            sample.color += color;
+            cached_lightmap->bounce_color += color;
+            sample.direction += normalcontribs[contrib];
 #if 0
-        total_light_ray_hits++;
+            total_light_ray_hits++;
 #endif
 
-        Lightmap_Save(bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
+            Lightmap_Save(bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
+        }
     }
 }
 
-static void LightPoint_Sky(const mbsp_t *bsp, raystream_intersection_t &rs, const sun_t *sun, const qvec3f &surfpoint,
-    lightgrid_samples_t &result)
+static void LightPoint_Sky(const mbsp_t *bsp, raystream_intersection_t &rs, const sun_stratum_t &stratum,
+    const qvec3f &surfpoint, lightgrid_samples_t &result)
 {
-    // FIXME: Normalized sun vector should be stored in the sun_t. Also clarify which way the vector points (towards or
-    // away..)
-    // FIXME: Much of this is copied/pasted from LightFace_Entity, should probably be merged
-    qvec3f incoming = qv::normalize(sun->sunvec);
+    const auto [group, scale] = SunStratum_Pick(stratum, surfpoint);
+    const qvec3f &incoming = group->incoming;
 
     rs.clearPushedRays();
 
-    // only 1 ray
-    {
+    // light each sun of the group adds if the ray reaches the sky; zero where it's gated
+    thread_local static std::vector<qvec3f> colors;
+    colors.clear();
+
+    bool any = false;
+
+    for (const sun_t *sun : group->suns) {
         qvec3f color{};
 
         for (int axis = 0; axis < 3; ++axis) {
@@ -1547,26 +1677,34 @@ static void LightPoint_Sky(const mbsp_t *bsp, raystream_intersection_t &rs, cons
 
         /* Quick distance check first */
         if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
-            return;
+            colors.emplace_back();
+            continue;
         }
 
-        qvec3f normalcontrib{}; // unused
+        colors.push_back(color * scale);
+        any = true;
+    }
 
-        rs.pushRay(0, surfpoint, incoming, MAX_SKY_DIST, &color, &normalcontrib);
+    if (!any) {
+        return;
     }
 
+    // only 1 ray
+    rs.pushRay(0, surfpoint, incoming, MAX_SKY_DIST);
+
     // We need to check if the first hit face is a sky face, so we need
     // to test intersection (not occlusion)
     rs.tracePushedRaysIntersection(nullptr, CHANNEL_MASK_DEFAULT);
 
     // add result
-    const int N = rs.numPushedRays();
-    for (int j = 0; j < N; j++) {
-        if (rs.getPushedRayHitType(j) != hittype_t::SKY) {
-            continue;
-        }
+    if (rs.getPushedRayHitType(0) != hittype_t::SKY) {
+        return;
+    }
 
-        result.add(rs.getPushedRayColor(j), sun->style);
+    for (size_t k = 0; k < group->suns.size(); k++) {
+        if (colors[k] != qvec3f{}) {
+            result.add(rs.tintPushedRayColor(0, colors[k]), group->suns[k]->style);
+        }
     }
 }
 
@@ -2012,6 +2150,42 @@ static bool SurfaceLight_VisCull(const mbsp_t *bsp, const std::vector<uint8_t> *
     return false;
 }
 
+static bool SurfaceLight_NodeCull(const surflight_tree_t::node_t &node, const lightsurf_t *lightsurf,
+    float bouncelight_gate, float hotspot_clamp)
+{
+    // conservative version of SurfaceLight_SphereCull for every emitter under `node`
+    if (light_options.visapprox.value() == visapprox_t::RAYS &&
+        node.vis_bounds.disjoint(lightsurf->extents.bounds, 0.001f)) {
+        return true;
+    } else if (!bouncelight_gate) {
+        return false;
+    }
+
+    const settings::worldspawn_keys &cfg = *lightsurf->cfg;
+    const float standard_scale = cfg.surflightscale.value();
+    const float sky_scale = cfg.surflightskyscale.value();
+
+    // the bound below relies on the falloff only ever decreasing with distance
+    if (standard_scale < 0 || sky_scale < 0 || cfg.scaledist.value() < 0 || node.min_atten < 0) {
+        return false;
+    }
+
+    // closest any emitter position under this node can be to the sphere around the face
+    const qvec3f origin = lightsurf->extents.origin;
+    float dist2 = 0;
+    for (size_t i = 0; i < 3; i++) {
+        const float d = std::max({0.0f, node.pos_bounds.mins()[i] - origin[i], origin[i] - node.pos_bounds.maxs()[i]});
+        dist2 += d * d;
+    }
+    // leave some slack for rounding, the per-emitter test does the exact check
+    const float dist = std::sqrt(dist2) * 0.999f + lightsurf->extents.radius;
+
+    const float falloff = GetLightValue(cfg, LF_QRAD3, 1.0f, 0.0f, node.min_atten, dist, hotspot_clamp);
+    const float brightest = std::max(node.max_power * standard_scale, node.max_sky_power * sky_scale) * falloff;
+
+    return brightest * 1.001f <= bouncelight_gate;
+}
+
 static void // mxd
 LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps,
     std::optional<size_t> bounce_depth, float standard_scale, float sky_scale, float hotspot_clamp)
@@ -2024,18 +2198,37 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
         return;
     }
 
-    for (const auto &surf_ptr : EmissiveLightSurfaces()) {
-        auto &vpl = *surf_ptr->vpl.get();
+    const surflight_tree_t *tree = EmissiveLightTree(bounce_depth);
+    if (!tree) {
+        return;
+    }
 
-        for (const auto &vpl_setting : surf_ptr->vpl->styles) {
+    // reject groups of emitters that can't reach this face, then visit the rest in
+    // EmissiveLightSurfaces() order so the lightmaps are accumulated in a stable order
+    thread_local static std::vector<uint64_t> candidates;
+    candidates.assign((tree->entries.size() + 63) / 64, 0);
+    tree->query(
+        [&](const surflight_tree_t::node_t &node) {
+            return SurfaceLight_NodeCull(node, lightsurf, surflight_gate, hotspot_clamp);
+        },
+        [&](uint32_t entrynum) { candidates[entrynum / 64] |= nth_bit<uint64_t>(entrynum % 64); });
 
-            if (vpl_setting.bounce_level != bounce_depth)
-                continue;
-            else if (SurfaceLight_SphereCull(&vpl, lightsurf, vpl_setting, surflight_gate, hotspot_clamp))
+    uint64_t traced = 0;
+
+    for (size_t word = 0; word < candidates.size(); word++) {
+        for (uint64_t bits = candidates[word]; bits; bits &= bits - 1) {
+            const surflight_tree_t::entry_t &entry = tree->entries[word * 64 + std::countr_zero(bits)];
+            const lightsurf_t *surf_ptr = EmissiveLightSurfaces()[entry.surfnum];
+            const auto &vpl = *surf_ptr->vpl;
+            const auto &vpl_setting = vpl.styles[entry.stylenum];
+
+            if (SurfaceLight_SphereCull(&vpl, lightsurf, vpl_setting, surflight_gate, hotspot_clamp))
                 continue;
             else if (SurfaceLight_VisCull(bsp, &lightsurf->pvs, surf_ptr))
                 continue;
 
+            traced++;
+
             raystream_occlusion_t &rs = occlusion_stream;
 
             for (int c = 0; c < vpl.points.size(); c++) {
@@ -2116,6 +2309,9 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
             }
         }
     }
+
+    total_surflight_emitters_traced += traced;
+    total_surflight_emitters_culled += tree->entries.size() - traced;
 }
 
 static void // mxd
@@ -2590,6 +2786,33 @@ lightsurf_t CreateLightmapSurface(const mbsp_t *bsp, const mface_t *face, const
     return Lightsurf_Init(modelinfo, cfg, face, bsp, facesup, facesup_decoupled);
 }
 
+/*
+ * ============
+ * ForEachCandidateLight
+ *
+ * Calls fn for each light in GetLights() that the light index can't rule out
+ * for lightsurf, in GetLights() order so the result doesn't depend on the index.
+ * ============
+ */
+template<typename F>
+static void ForEachCandidateLight(const lightsurf_t &lightsurf, F &&fn)
+{
+    const auto &lights = GetLights();
+
+    thread_local static std::vector<uint64_t> candidates;
+    const size_t num_candidates =
+        GetLightIndex().query(lights, lightsurf.extents.origin, lightsurf.extents.radius, candidates);
+
+    total_light_entities_tested += num_candidates;
+    total_light_entities_culled += lights.size() - num_candidates;
+
+    for (size_t word = 0; word < candidates.size(); word++) {
+        for (uint64_t bits = candidates[word]; bits; bits &= bits - 1) {
+            fn(lights[word * 64 + std::countr_zero(bits)].get());
+        }
+    }
+}
+
 /*
  * ============
  * LightFace
@@ -2597,6 +2820,8 @@ lightsurf_t CreateLightmapSurface(const mbsp_t *bsp, const mface_t *face, const
  */
 void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg)
 {
+    profile::zone zone(__func__);
+
     auto face = lightsurf.face;
     const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
 
@@ -2621,17 +2846,17 @@ void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::
 
         /* positive lights */
         if (!(modelinfo->lightignore.value() || extended_flags.light_ignore)) {
-            for (const auto &entity : GetLights()) {
+            ForEachCandidateLight(lightsurf, [&](const light_t *entity) {
                 if (entity->getFormula() == LF_LOCALMIN)
-                    continue;
+                    return;
                 if (entity->nostaticlight.value())
-                    continue;
+                    return;
                 if (entity->light.value() > 0)
-                    LightFace_Entity(bsp, entity.get(), &lightsurf, lightmaps);
-            }
-            for (const sun_t &sun : GetSuns())
-                if (sun.sunlight > 0)
-                    LightFace_Sky(bsp, &sun, &lightsurf, lightmaps);
+                    LightFace_Entity(bsp, entity, &lightsurf, lightmaps);
+            });
+            for (const sun_stratum_t &stratum : GetSunStrata())
+                if (!stratum.negative)
+                    LightFace_Sky(bsp, stratum, &lightsurf, lightmaps);
 
             // mxd. Add surface lights...
             // FIXME: negative surface lights
@@ -2664,6 +2889,8 @@ void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::
 void IndirectLightFace(
     const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg, size_t bounce_depth)
 {
+    profile::zone zone(__func__);
+
     auto face = lightsurf.face;
     const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
     lightmapdict_t *lightmaps = &lightsurf.lightmapsByStyle;
@@ -2738,17 +2965,17 @@ void PostProcessLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const setti
 
         /* negative lights */
         if (!(modelinfo->lightignore.value() || extended_flags.light_ignore)) {
-            for (const auto &entity : GetLights()) {
+            ForEachCandidateLight(lightsurf, [&](const light_t *entity) {
                 if (entity->getFormula() == LF_LOCALMIN)
-                    continue;
+                    return;
                 if (entity->nostaticlight.value())
-                    continue;
+                    return;
                 if (entity->light.value() < 0)
-                    LightFace_Entity(bsp, entity.get(), &lightsurf, lightmaps);
-            }
-            for (const sun_t &sun : GetSuns())
-                if (sun.sunlight < 0)
-                    LightFace_Sky(bsp, &sun, &lightsurf, lightmaps);
+                    LightFace_Entity(bsp, entity, &lightsurf, lightmaps);
+            });
+            for (const sun_stratum_t &stratum : GetSunStrata())
+                if (stratum.negative)
+                    LightFace_Sky(bsp, stratum, &lightsurf, lightmaps);
         }
     }
 
@@ -2908,9 +3135,9 @@ lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3f &world_
             LightPoint_Entity(bsp, rs, entity.get(), world_point, result);
     }
 
-    for (const sun_t &sun : GetSuns())
-        if (sun.sunlight > 0)
-            LightPoint_Sky(bsp, rsi, &sun, world_point, result);
+    for (const sun_stratum_t &stratum : GetSunStrata())
+        if (!stratum.negative)
+            LightPoint_Sky(bsp, rsi, stratum, world_point, result);
 
     // mxd. Add surface lights...
     // FIXME: negative surface lights
@@ -2938,9 +3165,9 @@ lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3f &world_
         if (entity->light.value() < 0)
             LightPoint_Entity(bsp, rs, entity.get(), world_point, result);
     }
-    for (const sun_t &sun : GetSuns())
-        if (sun.sunlight < 0)
-            LightPoint_Sky(bsp, rsi, &sun, world_point, result);
+    for (const sun_stratum_t &stratum : GetSunStrata())
+        if (stratum.negative)
+            LightPoint_Sky(bsp, rsi, stratum, world_point, result);
 
     // from IndirectLightFace
 
@@ -2966,4 +3193,8 @@ void ResetLtFace()
     total_surflight_rays = 0;
     total_surflight_ray_hits = 0;
 #endif
+    total_surflight_emitters_traced = 0;
+    total_surflight_emitters_culled = 0;
+    total_light_entities_tested = 0;
+    total_light_entities_culled = 0;
 }
@@ -27,16 +27,18 @@
 
 #include <common/polylib.hh>
 #include <common/bsputils.hh>
+#include <common/profile.hh>
 
 #include <vector>
-#include <map>
 #include <unordered_map>
 #include <set>
 #include <algorithm>
-#include <mutex>
+#include <numeric>
 
 #include <common/qvec.hh>
-#include <tbb/parallel_for_each.h>
+#include <common/parallel.hh>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
 
 face_cache_t::face_cache_t() { };
 
@@ -177,12 +179,56 @@ static float AngleBetweenPoints(const qvec3f &p1, const qvec3f &p2, const qvec3f
     return result;
 }
 
+/**
+ * Compressed sparse row storage: the values for key `k` are the contiguous
+ * run values[offsets[k]] .. values[offsets[k + 1] - 1].
+ */
+template<typename T>
+struct csr_t
+{
+    std::vector<uint32_t> offsets;
+    std::vector<T> values;
+
+    size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+    std::span<const T> operator[](size_t key) const
+    {
+        if (key >= size())
+            return {};
+        return {values.data() + offsets[key], values.data() + offsets[key + 1]};
+    }
+};
+
+/**
+ * Builds a csr_t from unordered (key, value) pairs; each key's values come out
+ * in ascending order, duplicates included.
+ */
+static csr_t<int> MakeCSR(std::vector<std::pair<int, int>> pairs)
+{
+    tbb::parallel_sort(pairs.begin(), pairs.end());
+
+    csr_t<int> result;
+    result.offsets.resize((pairs.empty() ? 0 : pairs.back().first + 1) + 1);
+    result.values.resize(pairs.size());
+
+    for (size_t i = 0; i < pairs.size(); i++) {
+        result.offsets[pairs[i].first + 1]++;
+        result.values[i] = pairs[i].second;
+    }
+    std::partial_sum(result.offsets.begin(), result.offsets.end(), result.offsets.begin());
+
+    return result;
+}
+
 static bool s_builtPhongCaches;
-static std::unordered_map<const mface_t *, std::vector<face_normal_t>> vertex_normals;
-static std::map<const mface_t *, std::set<const mface_t *>> smoothFaces;
-static std::map<int, std::vector<const mface_t *>> vertsToFaces;
-static std::map<int, std::vector<const mface_t *>> planesToFaces;
-static edgeToFaceMap_t EdgeToFaceMap;
+// face number -> one normal per vertex of the face
+static csr_t<face_normal_t> vertex_normals;
+// face number -> face numbers to smooth with, ascending
+static csr_t<int> smoothFaces;
+// vertex number -> face numbers using it, ascending
+static csr_t<int> vertsToFaces;
+// plane number -> face numbers on it, ascending
+static csr_t<int> planesToFaces;
 static std::vector<face_cache_t> FaceCache;
 
 void ResetPhong()
@@ -192,66 +238,35 @@ void ResetPhong()
     smoothFaces = {};
     vertsToFaces = {};
     planesToFaces = {};
-    EdgeToFaceMap = {};
     FaceCache = {};
 }
 
-std::vector<const mface_t *> FacesUsingVert(int vertnum)
+std::span<const int> FacesUsingVert(int vertnum)
 {
-    const auto &vertsToFaces_const = vertsToFaces;
-
-    auto it = vertsToFaces_const.find(vertnum);
-    if (it != vertsToFaces_const.end())
-        return it->second;
-    return {};
-}
-
-const edgeToFaceMap_t &GetEdgeToFaceMap()
-{
-    Q_assert(s_builtPhongCaches);
-    return EdgeToFaceMap;
+    return vertsToFaces[vertnum];
 }
 
 // Uses `smoothFaces` static var
-bool FacesSmoothed(const mface_t *f1, const mface_t *f2)
+bool FacesSmoothed(const mbsp_t *bsp, const mface_t *f1, const mface_t *f2)
 {
     Q_assert(s_builtPhongCaches);
 
-    const auto &facesIt = smoothFaces.find(f1);
-    if (facesIt == smoothFaces.end())
-        return false;
-
-    const std::set<const mface_t *> &faceSet = facesIt->second;
-    if (faceSet.find(f2) == faceSet.end())
-        return false;
-
-    return true;
+    const auto faces = smoothFaces[Face_GetNum(bsp, f1)];
+    return std::binary_search(faces.begin(), faces.end(), Face_GetNum(bsp, f2));
 }
 
-const std::set<const mface_t *> &GetSmoothFaces(const mface_t *face)
+std::span<const int> GetSmoothFaces(const mbsp_t *bsp, const mface_t *face)
 {
     Q_assert(s_builtPhongCaches);
 
-    static std::set<const mface_t *> empty;
-    const auto it = smoothFaces.find(face);
-
-    if (it == smoothFaces.end())
-        return empty;
-
-    return it->second;
+    return smoothFaces[Face_GetNum(bsp, face)];
 }
 
-const std::vector<const mface_t *> &GetPlaneFaces(const mface_t *face)
+std::span<const int> GetPlaneFaces(const mface_t *face)
 {
     Q_assert(s_builtPhongCaches);
 
-    static std::vector<const mface_t *> empty;
-    const auto it = planesToFaces.find(face->planenum);
-
-    if (it == planesToFaces.end())
-        return empty;
-
-    return it->second;
+    return planesToFaces[face->planenum];
 }
 
 // Adapted from https://github.com/NVIDIAGameWorks/donut/blob/main/src/engine/GltfImporter.cpp#L684
@@ -277,13 +292,23 @@ const face_normal_t &GetSurfaceVertexNormal(const mbsp_t *bsp, const mface_t *f,
     Q_assert(s_builtPhongCaches);
 
     // handle degenerate faces
-    const auto it = vertex_normals.find(f);
-    if (it == vertex_normals.end()) {
+    const auto face_normals = vertex_normals[Face_GetNum(bsp, f)];
+    if (face_normals.empty()) {
         static const face_normal_t empty{};
         return empty;
     }
-    const auto &face_normals_vec = it->second;
-    return face_normals_vec.at(vertindex);
+    Q_assert(vertindex >= 0 && static_cast<size_t>(vertindex) < face_normals.size());
+    return face_normals[vertindex];
+}
+
+static bool Face_HasDirectedEdge(const mbsp_t *bsp, const mface_t *f, int v0, int v1)
+{
+    for (int j = 0; j < f->numedges; j++) {
+        if (Face_VertexAtIndex(bsp, f, j) == v0 && Face_VertexAtIndex(bsp, f, (j + 1) % f->numedges) == v1) {
+            return true;
+        }
+    }
+    return false;
 }
 
 const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const int edgeindex)
@@ -293,78 +318,44 @@ const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const
     const int v0 = Face_VertexAtIndex(bsp, f, edgeindex);
     const int v1 = Face_VertexAtIndex(bsp, f, (edgeindex + 1) % f->numedges);
 
-    auto it = EdgeToFaceMap.find(std::make_pair(v1, v0));
-    if (it != EdgeToFaceMap.end()) {
-        for (const mface_t *neighbour : it->second) {
-            if (neighbour == f) {
-                // Invalid face, e.g. with vertex numbers: [0, 1, 0, 2]
-                continue;
-            }
-
-            const bool sameplane = (neighbour->planenum == f->planenum && neighbour->side == f->side);
+    if (v0 == v1) {
+        // ad_swampy.bsp has faces with repeated verts...
+        return nullptr;
+    }
 
-            // Check if these faces are smoothed or on the same plane
-            if (!(FacesSmoothed(f, neighbour) || sameplane)) {
-                continue;
-            }
+    // a neighbour shares the edge in the opposite direction, v1 -> v0, so it
+    // uses v1. a directed edge can be used by more than one face, e.g. two
+    // cubes touching just along an edge; take the first in face order.
+    const int fnum = Face_GetNum(bsp, f);
+    int prevnum = -1;
 
-            return neighbour;
+    for (const int neighbournum : vertsToFaces[v1]) {
+        if (neighbournum == prevnum) {
+            // face uses v1 more than once
+            continue;
         }
-    }
-    return nullptr;
+        prevnum = neighbournum;
 
-#if 0
-    if (smoothFaces.find(f) == smoothFaces.end()) {
-        return nullptr;
-    }
-    
-    int v0 = Face_VertexAtIndex(bsp, f, edgeindex);
-    int v1 = Face_VertexAtIndex(bsp, f, (edgeindex + 1) % f->numedges);
-    
-    const auto &v0_faces = vertsToFaces.at(v0);
-    const auto &v1_faces = vertsToFaces.at(v1);
-    
-    // find a face f2 that has both verts v0 and v1
-    for (auto f2 : v0_faces) {
-        if (f2 == f)
+        if (neighbournum == fnum) {
+            // Invalid face, e.g. with vertex numbers: [0, 1, 0, 2]
             continue;
-        if (find(v1_faces.begin(), v1_faces.end(), f2) != v1_faces.end()) {
-            const auto &f_smoothfaces = smoothFaces.at(f);
-            bool smoothed = (f_smoothfaces.find(f2) != f_smoothfaces.end());
-            return smoothed ? f2 : nullptr;
         }
-    }
-    return nullptr;
-#endif
-}
 
-static edgeToFaceMap_t MakeEdgeToFaceMap(const mbsp_t *bsp)
-{
-    edgeToFaceMap_t result;
-
-    for (auto &f : bsp->dfaces) {
-        // walk edges
-        for (int j = 0; j < f.numedges; j++) {
-            const int v0 = Face_VertexAtIndex(bsp, &f, j);
-            const int v1 = Face_VertexAtIndex(bsp, &f, (j + 1) % f.numedges);
-
-            if (v0 == v1) {
-                // ad_swampy.bsp has faces with repeated verts...
-                continue;
-            }
+        const mface_t *neighbour = BSP_GetFace(bsp, neighbournum);
+        if (!Face_HasDirectedEdge(bsp, neighbour, v1, v0)) {
+            continue;
+        }
 
-            const auto edge = std::make_pair(v0, v1);
-            auto &edgeFacesRef = result[edge];
+        const bool sameplane = (neighbour->planenum == f->planenum && neighbour->side == f->side);
 
-            if (find(begin(edgeFacesRef), end(edgeFacesRef), &f) != end(edgeFacesRef)) {
-                // another sort of degenerate face where the same edge A->B appears more than once on the face
-                continue;
-            }
-            edgeFacesRef.push_back(&f);
+        // Check if these faces are smoothed or on the same plane
+        if (!(FacesSmoothed(bsp, f, neighbour) || sameplane)) {
+            continue;
         }
-    }
 
-    return result;
+        return neighbour;
+    }
+    return nullptr;
 }
 
 static std::vector<face_normal_t> Face_VertexNormals(const mbsp_t *bsp, const mface_t *face)
@@ -374,8 +365,6 @@ static std::vector<face_normal_t> Face_VertexNormals(const mbsp_t *bsp, const mf
     return normals;
 }
 
-#include <common/parallel.hh>
-
 static std::vector<face_cache_t> MakeFaceCache(const mbsp_t *bsp)
 {
     logging::funcheader();
@@ -421,15 +410,118 @@ inline bool isDegenerate(const qvec3f &a, const qvec3f &b, const qvec3f &c)
     return false;
 }
 
+/**
+ * Per-face phong settings and geometry, computed once so the smoothing pass
+ * doesn't redo them for every face incident to every vertex.
+ */
+struct face_phong_t
+{
+    // Q2 shading group
+    int phong_value;
+    // any face normal within this many degrees can be smoothed with this face
+    float phong_angle;
+    float phong_angle_concave;
+    bool wants_phong;
+    qvec3f normal;
+    qvec3f centroid;
+};
+
+static face_phong_t Face_PhongSettings(const mbsp_t *bsp, const mface_t *f)
+{
+    face_phong_t result;
+
+    result.phong_value = Q2_FacePhongValue(bsp, f);
+
+    // Q1 phong angle stuff
+    result.phong_angle = extended_texinfo_flags[f->texinfo].phong_angle;
+    if (result.phong_angle == 0 && result.phong_value != 0) {
+        // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
+        result.phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
+    }
+    result.phong_angle_concave = extended_texinfo_flags[f->texinfo].phong_angle_concave;
+    if (result.phong_angle_concave == 0) {
+        result.phong_angle_concave = result.phong_angle;
+    }
+    result.wants_phong = (result.phong_angle || result.phong_angle_concave) &&
+                         !extended_texinfo_flags[f->texinfo].no_phong;
+
+    const auto points = Face_Points(bsp, f);
+    result.normal = Face_Normal(bsp, f);
+    result.centroid = qv::PolyCentroid(points.begin(), points.end());
+
+    return result;
+}
+
+/**
+ * Returns the ascending, unique face numbers that face `fnum` smooths with.
+ */
+static std::vector<int> Face_FindSmoothFaces(const mbsp_t *bsp, const std::vector<face_phong_t> &phong, int fnum)
+{
+    std::vector<int> result;
+
+    const mface_t *f = BSP_GetFace(bsp, fnum);
+    const face_phong_t &fp = phong[fnum];
+
+    if (!fp.wants_phong)
+        return result;
+
+    auto *f_texinfo = Face_Texinfo(bsp, f);
+    const qplane3f f_plane = Face_Plane(bsp, f);
+
+    for (int j = 0; j < f->numedges; j++) {
+        const int v = Face_VertexAtIndex(bsp, f, j);
+        // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
+        for (const int f2num : vertsToFaces[v]) {
+            if (f2num == fnum)
+                continue;
+
+            const face_phong_t &f2p = phong[f2num];
+
+            if (!f2p.wants_phong)
+                continue;
+
+            if (fp.phong_value != f2p.phong_value) {
+                // mismatched smoothing groups never phong
+                continue;
+            }
+
+            auto *f2_texinfo = Face_Texinfo(bsp, BSP_GetFace(bsp, f2num));
+            if (f2_texinfo != nullptr && f_texinfo != nullptr) {
+                if (!bsp->loadversion->game->surfflags_may_phong(f_texinfo->flags, f2_texinfo->flags)) {
+                    // phong may be blocked by the gamedef, e.g. warping and non-warping never phong
+                    continue;
+                }
+            }
+
+            const float cosangle = qv::dot(fp.normal, f2p.normal);
+
+            const bool concave = f_plane.distance_to(f2p.centroid) > 0.1;
+            const float f_threshold = concave ? fp.phong_angle_concave : fp.phong_angle;
+            const float f2_threshold = concave ? f2p.phong_angle_concave : f2p.phong_angle;
+            const float min_threshold = std::min(f_threshold, f2_threshold);
+            const float cosmaxangle = cos(DEG2RAD(min_threshold));
+
+            // check the angle between the face normals
+            if (cosangle >= cosmaxangle) {
+                result.push_back(f2num);
+            }
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+
+    return result;
+}
+
 void CalculateVertexNormals(const mbsp_t *bsp)
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     Q_assert(!s_builtPhongCaches);
     s_builtPhongCaches = true;
 
-    EdgeToFaceMap = MakeEdgeToFaceMap(bsp);
-
     // read _phong and _phong_angle from entities for compatibility with other qbsp's, at the expense of no
     // support on func_detail/func_group
     for (size_t i = 0; i < bsp->dmodels.size(); i++) {
@@ -446,111 +538,59 @@ void CalculateVertexNormals(const mbsp_t *bsp)
         }
     }
 
-    for (auto &f : bsp->dfaces) {
-        // build "plane -> faces" map
-        planesToFaces[f.planenum].push_back(&f);
+    const size_t numfaces = bsp->dfaces.size();
 
-        // build "vert index -> faces" map
-        for (size_t j = 0; j < f.numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, &f, j);
-            vertsToFaces[v].push_back(&f);
-        }
+    // face number -> first vertex slot; shared by the vertex list and vertex_normals
+    std::vector<uint32_t> face_offsets(numfaces + 1);
+    for (size_t i = 0; i < numfaces; i++) {
+        face_offsets[i + 1] = face_offsets[i] + std::max(bsp->dfaces[i].numedges, 0);
     }
 
-    // build the "face -> faces to smooth with" map
-    for (auto &f : bsp->dfaces) {
-        // Q2 shading groups
-        const int f_phongValue = Q2_FacePhongValue(bsp, &f);
-
-        // Q1 phong angle stuff
-        auto *f_texinfo = Face_Texinfo(bsp, &f);
-        const auto f_points = Face_Points(bsp, &f);
-        const qvec3f f_norm = Face_Normal(bsp, &f);
-        const qplane3f f_plane = Face_Plane(bsp, &f);
-
-        // any face normal within this many degrees can be smoothed with this face
-        float f_phong_angle = extended_texinfo_flags[f.texinfo].phong_angle;
-        if (f_phong_angle == 0 && f_phongValue != 0) {
-            // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
-            f_phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
-        }
-        float f_phong_angle_concave = extended_texinfo_flags[f.texinfo].phong_angle_concave;
-        if (f_phong_angle_concave == 0) {
-            f_phong_angle_concave = f_phong_angle;
-        }
-        const bool f_wants_phong = (f_phong_angle || f_phong_angle_concave);
+    // build the "plane -> faces" and "vert index -> faces" maps
+    std::vector<std::pair<int, int>> plane_pairs(numfaces);
+    std::vector<std::pair<int, int>> vert_pairs(face_offsets.back());
 
-        if (!f_wants_phong)
-            continue;
+    tbb::parallel_for(size_t(0), numfaces, [&](size_t i) {
+        const mface_t *f = &bsp->dfaces[i];
 
-        if (extended_texinfo_flags[f.texinfo].no_phong)
-            continue;
+        plane_pairs[i] = {f->planenum, static_cast<int>(i)};
 
-        for (int j = 0; j < f.numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, &f, j);
-            // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
-            for (const mface_t *f2 : vertsToFaces[v]) {
-                if (f2 == &f)
-                    continue;
-
-                // FIXME: factor out and share with above?
-                const int f2_phongValue = Q2_FacePhongValue(bsp, f2);
-                float f2_phong_angle = extended_texinfo_flags[f2->texinfo].phong_angle;
-                if (f2_phong_angle == 0 && f2_phongValue != 0) {
-                    // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
-                    f2_phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
-                }
-                float f2_phong_angle_concave = extended_texinfo_flags[f2->texinfo].phong_angle_concave;
-                if (f2_phong_angle_concave == 0) {
-                    f2_phong_angle_concave = f2_phong_angle;
-                }
-                const bool f2_wants_phong = (f2_phong_angle || f2_phong_angle_concave);
-
-                if (!f2_wants_phong)
-                    continue;
-
-                if (extended_texinfo_flags[f2->texinfo].no_phong)
-                    continue;
-
-                auto *f2_texinfo = Face_Texinfo(bsp, f2);
-                if (f2_texinfo != nullptr && f_texinfo != nullptr) {
-                    if (!bsp->loadversion->game->surfflags_may_phong(f_texinfo->flags, f2_texinfo->flags)) {
-                        // phong may be blocked by the gamedef, e.g. warping and non-warping never phong
-                        continue;
-                    }
-                }
-
-                const auto f2_points = Face_Points(bsp, f2);
-                const qvec3f f2_centroid = qv::PolyCentroid(f2_points.begin(), f2_points.end());
-                const qvec3f f2_norm = Face_Normal(bsp, f2);
+        for (int j = 0; j < f->numedges; j++) {
+            vert_pairs[face_offsets[i] + j] = {Face_VertexAtIndex(bsp, f, j), static_cast<int>(i)};
+        }
+    });
 
-                const float cosangle = qv::dot(f_norm, f2_norm);
+    planesToFaces = MakeCSR(std::move(plane_pairs));
+    vertsToFaces = MakeCSR(std::move(vert_pairs));
 
-                const bool concave = f_plane.distance_to(f2_centroid) > 0.1;
-                const float f_threshold = concave ? f_phong_angle_concave : f_phong_angle;
-                const float f2_threshold = concave ? f2_phong_angle_concave : f2_phong_angle;
-                const float min_threshold = std::min(f_threshold, f2_threshold);
-                const float cosmaxangle = cos(DEG2RAD(min_threshold));
+    // build the "face -> faces to smooth with" map
+    std::vector<face_phong_t> phong(numfaces);
+    tbb::parallel_for(size_t(0), numfaces, [&](size_t i) { phong[i] = Face_PhongSettings(bsp, &bsp->dfaces[i]); });
 
-                if (f_phongValue != f2_phongValue) {
-                    // mismatched smoothing groups never phong
-                    continue;
-                }
+    std::vector<std::vector<int>> smooth_lists(numfaces);
+    tbb::parallel_for(size_t(0), numfaces, [&](size_t i) { smooth_lists[i] = Face_FindSmoothFaces(bsp, phong, i); });
 
-                // check the angle between the face normals
-                if (cosangle >= cosmaxangle) {
-                    smoothFaces[&f].insert(f2);
-                }
-            }
-        }
+    size_t num_smoothed = 0;
+    smoothFaces.offsets.resize(numfaces + 1);
+    for (size_t i = 0; i < numfaces; i++) {
+        smoothFaces.offsets[i + 1] = smoothFaces.offsets[i] + smooth_lists[i].size();
+        num_smoothed += !smooth_lists[i].empty();
     }
+    smoothFaces.values.resize(smoothFaces.offsets.back());
+    tbb::parallel_for(size_t(0), numfaces, [&](size_t i) {
+        std::copy(smooth_lists[i].begin(), smooth_lists[i].end(), smoothFaces.values.begin() + smoothFaces.offsets[i]);
+    });
+    smooth_lists = {};
 
-    logging::print(logging::flag::VERBOSE, "        {} faces for smoothing\n", smoothFaces.size());
+    logging::print(logging::flag::VERBOSE, "        {} faces for smoothing\n", num_smoothed);
 
     // finally do the smoothing for each face
-    std::mutex normalsMutex;
+    vertex_normals.offsets = std::move(face_offsets);
+    vertex_normals.values.resize(vertex_normals.offsets.back());
+
+    logging::parallel_for(size_t(0), numfaces, [bsp](size_t i) {
+        const mface_t &f = bsp->dfaces[i];
 
-    logging::parallel_for_each(bsp->dfaces, [bsp, &normalsMutex](const mface_t &f) {
         if (f.numedges < 3) {
             logging::funcprint("face {} is degenerate with {} edges\n", Face_GetNum(bsp, &f), f.numedges);
             for (int j = 0; j < f.numedges; j++) {
@@ -566,13 +606,12 @@ void CalculateVertexNormals(const mbsp_t *bsp)
         std::tuple<qvec3f, qvec3f> tangents(t1.col(0).xyz(), qv::normalize(t1.col(1).xyz()));
 
         // gather up f and neighboursToSmooth
+        const auto neighboursToSmooth = smoothFaces[i];
         std::vector<const mface_t *> fPlusNeighbours;
+        fPlusNeighbours.reserve(neighboursToSmooth.size() + 1);
         fPlusNeighbours.push_back(&f);
-        auto neighboursIt = smoothFaces.find(&f);
-
-        if (neighboursIt != smoothFaces.end()) {
-            const auto &neighboursToSmooth = neighboursIt->second;
-            std::copy(neighboursToSmooth.begin(), neighboursToSmooth.end(), std::back_inserter(fPlusNeighbours));
+        for (const int neighbournum : neighboursToSmooth) {
+            fPlusNeighbours.push_back(&bsp->dfaces[neighbournum]);
         }
 
         // global vertex index -> smoothed normal
@@ -649,24 +688,13 @@ void CalculateVertexNormals(const mbsp_t *bsp)
             }
         }
 
-        // sanity check
-        if (neighboursIt != smoothFaces.end()) {
-            const auto &neighboursToSmooth = neighboursIt->second;
-            if (!neighboursToSmooth.size()) {
-                for (auto &vertIndexNormalPair : smoothedNormals) {
-                    Q_assert(qv::epsilonEqual(vertIndexNormalPair.second.normal, f_norm, (float)LIGHT_EQUAL_EPSILON));
-                }
-            }
-        }
-
         // now, record all of the smoothed normals that are actually part of `f`
+        face_normal_t *normals = vertex_normals.values.data() + vertex_normals.offsets[i];
         for (int j = 0; j < f.numedges; j++) {
             int v = Face_VertexAtIndex(bsp, &f, j);
             Q_assert(smoothedNormals.find(v) != smoothedNormals.end());
 
-            normalsMutex.lock();
-            vertex_normals[&f].push_back(smoothedNormals[v]);
-            normalsMutex.unlock();
+            normals[j] = smoothedNormals[v];
         }
     });
 
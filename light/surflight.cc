@@ -30,9 +30,11 @@ See file, 'COPYING', for details.
 #include <common/bsputils.hh>
 #include <common/parallel.hh>
 
+#include <algorithm>
 #include <vector>
 #include <map>
 #include <mutex>
+#include <tuple>
 
 #include <common/qvec.hh>
 
@@ -284,3 +286,84 @@ MakeRadiositySurfaceLights(const settings::worldspawn_keys &cfg, const mbsp_t *b
 
     logging::print("{} surface light points in use.\n", total_surflight_points.load());
 }
+
+// surflight_tree_t
+
+static constexpr uint32_t SURFLIGHT_TREE_LEAF_SIZE = 4;
+
+static uint32_t BuildSurflightTree_r(surflight_tree_t &tree, const std::vector<lightsurf_t *> &surfs,
+    const std::vector<qvec3f> &positions, uint32_t first, uint32_t count)
+{
+    const uint32_t nodenum = tree.nodes.size();
+    tree.nodes.emplace_back();
+
+    surflight_tree_t::node_t node;
+
+    for (uint32_t i = first; i < first + count; i++) {
+        const surflight_tree_t::entry_t &entry = tree.entries[tree.leaf_entries[i]];
+        const surfacelight_t &vpl = *surfs[entry.surfnum]->vpl;
+        const surfacelight_t::per_style_t &style = vpl.styles[entry.stylenum];
+        const float power = qv::max(style.color) * style.totalintensity;
+
+        node.pos_bounds += vpl.pos;
+        node.vis_bounds += vpl.bounds;
+        if (style.omnidirectional) {
+            node.max_sky_power = std::max(node.max_sky_power, power);
+        } else {
+            node.max_power = std::max(node.max_power, power);
+        }
+        node.min_atten = std::min(node.min_atten, style.atten);
+    }
+
+    if (count <= SURFLIGHT_TREE_LEAF_SIZE) {
+        node.first_entry = first;
+        node.num_entries = count;
+        tree.nodes[nodenum] = node;
+        return nodenum;
+    }
+
+    // split at the median along the longest axis
+    const qvec3f size = node.pos_bounds.size();
+    const size_t axis = size[0] >= size[1] && size[0] >= size[2] ? 0 : (size[1] >= size[2] ? 1 : 2);
+    const uint32_t half = count / 2;
+    auto begin = tree.leaf_entries.begin() + first;
+
+    std::nth_element(begin, begin + half, begin + count, [&](uint32_t a, uint32_t b) {
+        return std::tie(positions[a][axis], a) < std::tie(positions[b][axis], b);
+    });
+
+    node.children[0] = BuildSurflightTree_r(tree, surfs, positions, first, half);
+    node.children[1] = BuildSurflightTree_r(tree, surfs, positions, first + half, count - half);
+
+    tree.nodes[nodenum] = node;
+    return nodenum;
+}
+
+void surflight_tree_t::build(const std::vector<lightsurf_t *> &surfs, const std::optional<size_t> &bounce_level)
+{
+    entries.clear();
+    leaf_entries.clear();
+    nodes.clear();
+
+    std::vector<qvec3f> positions;
+
+    for (uint32_t i = 0; i < surfs.size(); i++) {
+        const surfacelight_t &vpl = *surfs[i]->vpl;
+
+        for (uint32_t j = 0; j < vpl.styles.size(); j++) {
+            if (vpl.styles[j].bounce_level != bounce_level) {
+                continue;
+            }
+
+            leaf_entries.push_back(entries.size());
+            entries.push_back({i, j});
+            positions.push_back(vpl.pos);
+        }
+    }
+
+    if (entries.empty()) {
+        return;
+    }
+
+    BuildSurflightTree_r(*this, surfs, positions, 0, entries.size());
+}
@@ -24,6 +24,7 @@
 
 #include <common/bsputils.hh>
 #include <common/polylib.hh>
+#include <algorithm>
 #include <vector>
 #include <climits>
 #include <set>
@@ -37,6 +38,7 @@ std::set<const mface_t *> shadow_casting_solid_faces;
 
 static RTCDevice device;
 RTCScene scene;
+int ray_packet_width = 1;
 
 static const mbsp_t *bsp_static;
 
@@ -58,6 +60,7 @@ void ResetEmbree()
     }
 
     bsp_static = nullptr;
+    ray_packet_width = 1;
 }
 
 const std::set<const mface_t *> &ShadowCastingSolidFacesSet()
@@ -663,6 +666,21 @@ void Embree_TraceInit(const mbsp_t *bsp)
     const size_t ver_pat = rtcGetDeviceProperty(device, RTC_DEVICE_PROPERTY_VERSION_PATCH);
     logging::funcprint("Embree version: {}.{}.{}\n", ver_maj, ver_min, ver_pat);
 
+    // rtcOccluded8/16 are only available if Embree was built with EMBREE_RAY_PACKETS
+    // and the CPU supports the matching instruction set
+    ray_packet_width = 1;
+    if (light_options.raypackets.value() != raypackets_t::SINGLE) {
+        const bool packet16 = light_options.raypackets.value() == raypackets_t::PACKET16;
+        const int width = packet16 ? 16 : 8;
+
+        if (rtcGetDeviceProperty(device,
+                packet16 ? RTC_DEVICE_PROPERTY_NATIVE_RAY16_SUPPORTED : RTC_DEVICE_PROPERTY_NATIVE_RAY8_SUPPORTED)) {
+            ray_packet_width = width;
+        } else {
+            logging::print("WARNING: this Embree doesn't support {}-wide ray packets, tracing single rays\n", width);
+        }
+    }
+
     scene = rtcNewScene(device);
 #ifdef HAVE_EMBREE4
     // necessary for RTCOccludedArguments::filter and RTCIntersectArguments::filter
@@ -698,6 +716,10 @@ void Embree_TraceInit(const mbsp_t *bsp)
     logging::print("\t{} solid faces\n", solidfaces.size());
     logging::print("\t{} filtered faces\n", filterfaces.size());
     logging::print("\t{} shadow-casting skip faces\n", skipwindings.size());
+
+    if (ray_packet_width > 1) {
+        logging::print("\ttracing {}-wide ray packets\n", ray_packet_width);
+    }
 }
 
 static void AddGlassToRay(ray_source_info *ctx, unsigned rayIndex, float opacity, const qvec3f &glasscolor)
@@ -782,4 +804,168 @@ RTCOccludedArguments ray_source_info::setup_occluded_arguments()
 
     return result;
 }
-#endif
\ No newline at end of file
+#endif
+/*
+ * ============================================================================
+ * PACKET TRACING
+ *
+ * Rays pushed by one caller are neighbouring samples traced towards the same
+ * light, so consecutive rays in a stream make coherent packets. Each packet
+ * is loaded into Embree's SoA layout, traced, and the results are copied back
+ * into the ray_io's, so the rest of the raystream code is unchanged.
+ * ============================================================================
+ */
+
+template<typename RayN>
+static void RayPacket_Load(RayN &packet, size_t k, const RTCRay &ray)
+{
+    packet.org_x[k] = ray.org_x;
+    packet.org_y[k] = ray.org_y;
+    packet.org_z[k] = ray.org_z;
+    packet.tnear[k] = ray.tnear;
+    packet.dir_x[k] = ray.dir_x;
+    packet.dir_y[k] = ray.dir_y;
+    packet.dir_z[k] = ray.dir_z;
+    packet.time[k] = ray.time;
+    packet.tfar[k] = ray.tfar;
+    packet.mask[k] = ray.mask;
+    packet.id[k] = ray.id;
+    packet.flags[k] = ray.flags;
+}
+
+template<typename HitN>
+static void RayPacket_LoadHit(HitN &packet, size_t k, const RTCHit &hit)
+{
+    packet.geomID[k] = hit.geomID;
+    packet.primID[k] = hit.primID;
+    packet.instID[0][k] = hit.instID[0];
+}
+
+template<typename HitN>
+static void RayPacket_StoreHit(const HitN &packet, size_t k, RTCHit &hit)
+{
+    hit.Ng_x = packet.Ng_x[k];
+    hit.Ng_y = packet.Ng_y[k];
+    hit.Ng_z = packet.Ng_z[k];
+    hit.u = packet.u[k];
+    hit.v = packet.v[k];
+    hit.primID = packet.primID[k];
+    hit.geomID = packet.geomID[k];
+    hit.instID[0] = packet.instID[0][k];
+}
+
+#ifdef HAVE_EMBREE4
+static void Embree_Intersect(const int *valid, RTCRayHit8 *packet, ray_source_info &ctx)
+{
+    RTCIntersectArguments args = ctx.setup_intersection_arguments();
+    rtcIntersect8(valid, scene, packet, &args);
+}
+static void Embree_Intersect(const int *valid, RTCRayHit16 *packet, ray_source_info &ctx)
+{
+    RTCIntersectArguments args = ctx.setup_intersection_arguments();
+    rtcIntersect16(valid, scene, packet, &args);
+}
+static void Embree_Occluded(const int *valid, RTCRay8 *packet, ray_source_info &ctx)
+{
+    RTCOccludedArguments args = ctx.setup_occluded_arguments();
+    rtcOccluded8(valid, scene, packet, &args);
+}
+static void Embree_Occluded(const int *valid, RTCRay16 *packet, ray_source_info &ctx)
+{
+    RTCOccludedArguments args = ctx.setup_occluded_arguments();
+    rtcOccluded16(valid, scene, packet, &args);
+}
+#else
+static void Embree_Intersect(const int *valid, RTCRayHit8 *packet, ray_source_info &ctx)
+{
+    rtcIntersect8(valid, scene, &ctx, packet);
+}
+static void Embree_Intersect(const int *valid, RTCRayHit16 *packet, ray_source_info &ctx)
+{
+    rtcIntersect16(valid, scene, &ctx, packet);
+}
+static void Embree_Occluded(const int *valid, RTCRay8 *packet, ray_source_info &ctx)
+{
+    rtcOccluded8(valid, scene, &ctx, packet);
+}
+static void Embree_Occluded(const int *valid, RTCRay16 *packet, ray_source_info &ctx)
+{
+    rtcOccluded16(valid, scene, &ctx, packet);
+}
+#endif
+
+template<size_t N, typename RayHitN>
+static void Embree_IntersectPacketsN(ray_source_info &ctx, aligned_vector<ray_io> &rays)
+{
+    alignas(64) int valid[N];
+    RayHitN packet;
+
+    for (size_t first = 0; first < rays.size(); first += N) {
+        const size_t count = std::min(N, rays.size() - first);
+
+        packet = {};
+        for (size_t k = 0; k < N; k++) {
+            if (k < count) {
+                valid[k] = -1;
+                RayPacket_Load(packet.ray, k, rays[first + k].ray.ray);
+                RayPacket_LoadHit(packet.hit, k, rays[first + k].ray.hit);
+            } else {
+                valid[k] = 0;
+            }
+        }
+
+        Embree_Intersect(valid, &packet, ctx);
+
+        for (size_t k = 0; k < count; k++) {
+            RTCRayHit &ray = rays[first + k].ray;
+            ray.ray.tfar = packet.ray.tfar[k];
+            RayPacket_StoreHit(packet.hit, k, ray.hit);
+        }
+    }
+}
+
+template<size_t N, typename RayN>
+static void Embree_OccludedPacketsN(ray_source_info &ctx, aligned_vector<ray_io> &rays)
+{
+    alignas(64) int valid[N];
+    RayN packet;
+
+    for (size_t first = 0; first < rays.size(); first += N) {
+        const size_t count = std::min(N, rays.size() - first);
+
+        packet = {};
+        for (size_t k = 0; k < N; k++) {
+            if (k < count) {
+                valid[k] = -1;
+                RayPacket_Load(packet, k, rays[first + k].ray.ray);
+            } else {
+                valid[k] = 0;
+            }
+        }
+
+        Embree_Occluded(valid, &packet, ctx);
+
+        // occluded rays get tfar set to -inf
+        for (size_t k = 0; k < count; k++) {
+            rays[first + k].ray.ray.tfar = packet.tfar[k];
+        }
+    }
+}
+
+void Embree_IntersectPackets(ray_source_info &ctx, aligned_vector<ray_io> &rays)
+{
+    if (ray_packet_width == 16) {
+        Embree_IntersectPacketsN<16, RTCRayHit16>(ctx, rays);
+    } else {
+        Embree_IntersectPacketsN<8, RTCRayHit8>(ctx, rays);
+    }
+}
+
+void Embree_OccludedPackets(ray_source_info &ctx, aligned_vector<ray_io> &rays)
+{
+    if (ray_packet_width == 16) {
+        Embree_OccludedPacketsN<16, RTCRay16>(ctx, rays);
+    } else {
+        Embree_OccludedPacketsN<8, RTCRay8>(ctx, rays);
+    }
+}
@@ -22,6 +22,7 @@
 #include <light/write.hh>
 
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <common/parallel.hh>
 #include <common/litfile.hh>
 
@@ -83,15 +84,17 @@ void WriteLuxFile(const mbsp_t *bsp, const fs::path &filename, int version, cons
 }
 
 /*
- * Return space for the lightmap and colourmap at the same time so it can
- * be done in a thread-safe manner.
+ * Return space for the lightmap and colourmap at the same time.
+ * Called serially, in face order, so the layout doesn't depend on
+ * thread scheduling.
  *
  * size is the number of greyscale pixels = number of bytes to allocate
  * and return in *lightdata
  */
-static inline int GetFileSpace(std::atomic_size_t &offset, size_t size)
+static inline int GetFileSpace(size_t &offset, size_t size)
 {
-    size_t v = offset.fetch_add(align_value<4>(size));
+    size_t v = offset;
+    offset += align_value<4>(size);
 
     // early check
     if (v > std::numeric_limits<int>::max())
@@ -695,6 +698,8 @@ static void SaveLitOnlyLightmapSurface(const mbsp_t *bsp, mface_t *face, lightsu
 struct lightmap_intermediate_data_t
 {
     std::vector<const lightmap_t *> sorted;
+    // sizes in samples, filled in parallel before the offsets are assigned
+    size_t size = 0, vanilla_size = 0;
     int lightofs = -1, vanilla_lightofs = -1;
 };
 
@@ -703,7 +708,7 @@ extern std::vector<facesup_t> faces_sup; // lit2/bspx stuff
 extern std::vector<bspx_decoupled_lm_perface> facesup_decoupled_global;
 
 int CalculateLightmapStyles(const mbsp_t *bsp, mface_t *face, facesup_t *facesup, lightsurf_t *lightsurf,
-    const faceextents_t &extents, std::atomic_size_t &lightmap_size, lightmap_intermediate_data_t &id)
+    const faceextents_t &extents, lightmap_intermediate_data_t &id)
 {
     lightmapdict_t &lightmaps = lightsurf->lightmapsByStyle;
 
@@ -979,6 +984,8 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
 
 void SaveLightmapSurfaces(bspdata_t *bspdata, const fs::path &source)
 {
+    profile::zone zone(__func__);
+
     mbsp_t *bsp = &std::get<mbsp_t>(bspdata->bsp);
 
     logging::funcheader();
@@ -1026,12 +1033,10 @@ void SaveLightmapSurfaces(bspdata_t *bspdata, const fs::path &source)
                 bsp, f, &surf, surf.extents, surf.extents, filebase, lit_filebase, lux_filebase, hdr_filebase);
         });
     } else {
-        std::atomic_size_t lightmap_size = 0;
         std::vector<lightmap_intermediate_data_t> intermediate_data;
         intermediate_data.resize(bsp->dfaces.size());
 
-        // calculate finish lightmaps and calculate lightofs for each face.
-        // the lightofs will be set to the size in bytes.
+        // finish lightmaps and calculate the lightmap size of each face.
         logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
             auto &surf = LightSurfaces()[i];
 
@@ -1047,30 +1052,39 @@ void SaveLightmapSurfaces(bspdata_t *bspdata, const fs::path &source)
 
             if (!facesup_decoupled_global.empty()) {
                 num_styles =
-                    CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, lightmap_size, intermediate_data[i]);
+                    CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, intermediate_data[i]);
 
                 if (!light_options.novanilla.value()) {
-                    intermediate_data[i].vanilla_lightofs =
-                        GetFileSpace(lightmap_size, surf.vanilla_extents.numsamples() * num_styles);
+                    intermediate_data[i].vanilla_size = surf.vanilla_extents.numsamples() * num_styles;
                 }
             } else if (faces_sup.empty()) {
                 num_styles =
-                    CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, lightmap_size, intermediate_data[i]);
+                    CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, intermediate_data[i]);
             } else if (light_options.novanilla.value() || faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
                 num_styles = CalculateLightmapStyles(
-                    bsp, f, &faces_sup[i], &surf, surf.extents, lightmap_size, intermediate_data[i]);
+                    bsp, f, &faces_sup[i], &surf, surf.extents, intermediate_data[i]);
             } else {
                 num_styles =
-                    CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, lightmap_size, intermediate_data[i]);
-                intermediate_data[i].vanilla_lightofs =
-                    GetFileSpace(lightmap_size, surf.vanilla_extents.numsamples() * num_styles);
+                    CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, intermediate_data[i]);
+                intermediate_data[i].vanilla_size = surf.vanilla_extents.numsamples() * num_styles;
             }
 
-            if (num_styles) {
-                intermediate_data[i].lightofs = GetFileSpace(lightmap_size, surf.extents.numsamples() * num_styles);
-            }
+            intermediate_data[i].size = surf.extents.numsamples() * num_styles;
         });
 
+        // assign offsets in face order, so the output is the same regardless of
+        // how the faces above were scheduled
+        size_t lightmap_size = 0;
+
+        for (auto &id : intermediate_data) {
+            if (id.vanilla_size) {
+                id.vanilla_lightofs = GetFileSpace(lightmap_size, id.vanilla_size);
+            }
+            if (id.size) {
+                id.lightofs = GetFileSpace(lightmap_size, id.size);
+            }
+        }
+
         // allocate required space
         if (!bsp->loadversion->game->has_rgb_lightmap) {
             filebase.resize(lightmap_size);
@@ -36,6 +36,7 @@ side_t side_t::clone_non_winding_data() const
     result.onnode = this->onnode;
     result.bevel = this->bevel;
     result.source = this->source;
+    result.hullnum = this->hullnum;
     result.tested = this->tested;
     return result;
 }
@@ -59,7 +60,7 @@ bool side_t::is_visible() const
         return false;
     }
 
-    return source && source->visible;
+    return source && source->visible[hullnum];
 }
 
 const maptexinfo_t &side_t::get_texinfo() const
@@ -86,6 +87,7 @@ bspbrush_t bspbrush_t::clone() const
 {
     bspbrush_t result;
 
+    result.original = this->original;
     result.original_ptr = this->original_ptr;
     result.mapbrush = this->mapbrush;
 
@@ -301,12 +303,12 @@ bool CreateBrushWindings(bspbrush_t &brush)
 
             side.w = std::move(*w);
             if (side.source) {
-                side.source->visible = true;
+                side.source->visible[side.hullnum] = true;
             }
         } else {
             side.w.clear();
             if (side.source) {
-                side.source->visible = false;
+                side.source->visible[side.hullnum] = false;
             }
         }
     }
@@ -596,6 +598,7 @@ std::optional<bspbrush_t> LoadBrush(const mapentity_t &src, mapbrush_t &mapbrush
         dst.planenum = src.planenum;
         dst.bevel = src.bevel;
         dst.source = &src;
+        dst.hullnum = hullnum.value_or(0);
     }
 
     // expand the brushes for the hull
@@ -910,7 +913,7 @@ void Brush_LoadEntity(mapentity_t &entity, hull_index_t hullnum, bspbrush_t::con
         for (auto &side : brush->sides) {
             if (!side.source) {
                 sourceless_sides_stat.count++;
-            } else if (side.source->visible) {
+            } else if (side.source->visible[side.hullnum]) {
                 visible_sides_stat.count++;
             } else {
                 invisible_sides_stat.count++;
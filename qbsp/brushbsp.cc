@@ -24,6 +24,7 @@
 #include <climits>
 
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <qbsp/brush.hh>
 #include <qbsp/map.hh>
 #include <qbsp/portals.hh>
@@ -345,7 +346,7 @@ Creates a leaf node.
 Called in parallel.
 ==================
 */
-static void LeafNode(node_t *leafnode, bspbrush_t::container brushes, bspstats_t &stats)
+static void LeafNode(tree_t &tree, node_t *leafnode, std::vector<bspbrush_t *> brushes, bspstats_t &stats)
 {
     leafnode->make_leaf();
 
@@ -362,9 +363,15 @@ static void LeafNode(node_t *leafnode, bspbrush_t::container brushes, bspstats_t
     qbsp_options.target_game->count_contents_in_stats(leafdata->contents, *stats.leafstats);
 
     if (qbsp_options.debugleak.value() || qbsp_options.debugbspbrushes.value()) {
-        leafdata->bsp_brushes = brushes;
+        leafdata->bsp_brushes = std::move(brushes);
     } else {
-        leafnode->volume.reset();
+        for (auto *brush : brushes) {
+            tree.release_brush(brush);
+        }
+        if (leafnode->volume) {
+            tree.release_brush(leafnode->volume);
+            leafnode->volume = nullptr;
+        }
     }
 }
 
@@ -396,21 +403,59 @@ planeside_t BrushMostlyOnSide(const bspbrush_t &brush, const qplane3d &plane)
     return side;
 }
 
+// where SplitBrush gets the two halves of a brush from, and gives back the
+// ones it throws away (including the brush it split).
+// ChopBrushes' fragments replace their originals in the entity's brush list,
+// so they're shared, and keep the original alive...
+struct chop_fragments_t
+{
+    bspbrush_t::ptr create(const bspbrush_t::ptr &from) const
+    {
+        auto brush = bspbrush_t::make_ptr();
+        brush->original_ptr = from->original_ptr ? from->original_ptr : from;
+        brush->original = brush->original_ptr.get();
+        return brush;
+    }
+
+    void release(bspbrush_t::ptr &brush) const { brush = nullptr; }
+};
+
+// ...while BrushBSP's live in the tree and only borrow it
+struct tree_fragments_t
+{
+    tree_t &tree;
+
+    bspbrush_t *create(bspbrush_t *from) const
+    {
+        auto *brush = tree.create_brush();
+        brush->original = from->original;
+        return brush;
+    }
+
+    void release(bspbrush_t *&brush) const
+    {
+        tree.release_brush(brush);
+        brush = nullptr;
+    }
+};
+
 /*
 ================
 SplitBrush
 
-Note, it's useful to take/return std::unique_ptr so it can quickly return the
-input.
+Note, it's useful to take/return pointers so it can quickly return the
+input. `brush` is consumed: it's either returned as one of the sides or
+given back to `fragments`.
 
 https://github.com/id-Software/Quake-2-Tools/blob/master/bsp/qbsp3/brushbsp.c#L935
 ================
 */
-static twosided<bspbrush_t::ptr> SplitBrush(
-    bspbrush_t::ptr brush, size_t planenum, std::optional<std::reference_wrapper<bspstats_t>> stats)
+template<typename Ptr, typename Fragments>
+static twosided<Ptr> SplitBrush(
+    Ptr brush, size_t planenum, std::optional<std::reference_wrapper<bspstats_t>> stats, const Fragments &fragments)
 {
     const qplane3d &split = map.planes[planenum];
-    twosided<bspbrush_t::ptr> result;
+    twosided<Ptr> result{};
 
     // check all points
     double d_front = 0; // for points above plane, greatest distance from plane (positive)
@@ -465,8 +510,7 @@ static twosided<bspbrush_t::ptr> SplitBrush(
     // start with 2 empty brushes
 
     for (int i = 0; i < 2; i++) {
-        result[i] = bspbrush_t::make_ptr();
-        result[i]->original_ptr = brush->original_ptr ? brush->original_ptr : brush;
+        result[i] = fragments.create(brush);
         result[i]->mapbrush = brush->mapbrush;
         // fixme-brushbsp: add a bspbrush_t copy constructor to make sure we get all fields
         result[i]->contents = brush->contents;
@@ -516,7 +560,7 @@ static twosided<bspbrush_t::ptr> SplitBrush(
         }
 
         if (bogus) {
-            result[i] = nullptr;
+            fragments.release(result[i]);
         }
     }
 
@@ -525,6 +569,7 @@ static twosided<bspbrush_t::ptr> SplitBrush(
             stats->get().c_brushesremoved++;
         }
 
+        fragments.release(brush);
         return result;
     } else if (!result[0] || !result[1]) {
         if (stats) {
@@ -532,8 +577,10 @@ static twosided<bspbrush_t::ptr> SplitBrush(
         }
 
         if (result[0]) {
+            fragments.release(result.front);
             result.front = std::move(brush);
         } else {
+            fragments.release(result.back);
             result.back = std::move(brush);
         }
 
@@ -564,13 +611,14 @@ static twosided<bspbrush_t::ptr> SplitBrush(
     for (int i = 0; i < 2; i++) {
         double v1 = BrushVolume(*result[i]);
         if (v1 < qbsp_options.microvolume.value()) {
-            result[i] = nullptr;
+            fragments.release(result[i]);
             if (stats) {
                 stats->get().c_tinyvolumes++;
             }
         }
     }
 
+    fragments.release(brush);
     return result;
 }
 
@@ -643,7 +691,7 @@ A special, low-allocation version of SplitBrush. Checks if a brush split
 by the specified plane would result in two valid brushes.
 ================
 */
-static bool CheckSplitBrush(const bspbrush_t::ptr &brush, size_t planenum)
+static bool CheckSplitBrush(const bspbrush_t &brush, size_t planenum)
 {
     const qplane3d &split = map.planes[planenum];
 
@@ -651,7 +699,7 @@ static bool CheckSplitBrush(const bspbrush_t::ptr &brush, size_t planenum)
     double d_front = 0;
     double d_back = 0;
 
-    for (auto &face : brush->sides) {
+    for (auto &face : brush.sides) {
         for (int j = 0; j < face.w.size(); j++) {
             double d = qv::dot(face.w[j], split.normal) - split.dist;
             if (d > 0 && d > d_front)
@@ -673,7 +721,7 @@ static bool CheckSplitBrush(const bspbrush_t::ptr &brush, size_t planenum)
     // create a new winding from the split plane
     std::optional<stack_winding_t> w = BaseWindingForPlane<stack_winding_t>(split);
 
-    for (auto &face : brush->sides) {
+    for (auto &face : brush.sides) {
         if (!w) {
             return false;
         }
@@ -692,13 +740,13 @@ static bool CheckSplitBrush(const bspbrush_t::ptr &brush, size_t planenum)
     twosided<stack_brush_t> temporary_brushes;
 
     for (int i = 0; i < 2; i++) {
-        temporary_brushes[i].sides = (stack_side_t *)alloca(sizeof(stack_side_t) * (brush->sides.size() + 1));
+        temporary_brushes[i].sides = (stack_side_t *)alloca(sizeof(stack_side_t) * (brush.sides.size() + 1));
         temporary_brushes[i].num_sides = 0;
     }
 
     // split all the current windings
 
-    for (const auto &face : brush->sides) {
+    for (const auto &face : brush.sides) {
         auto cw = face.w.clip<stack_winding_storage_t>(split, 0 /*PLANESIDE_EPSILON*/);
 
         for (size_t j = 0; j < 2; j++) {
@@ -767,9 +815,9 @@ inline bool CheckPlaneAgainstVolume(size_t planenum, const node_t *node)
     if (!node->volume)
         return false;
 
-    bool valid = CheckSplitBrush(node->volume, planenum);
+    bool valid = CheckSplitBrush(*node->volume, planenum);
 #ifdef PARANOID
-    auto [front, back] = SplitBrush(node->volume, planenum, std::nullopt);
+    auto [front, back] = SplitBrush(node->volume->copy_unique(), planenum, std::nullopt, chop_fragments_t{});
     Q_assert(valid == (front && back));
 #endif
     return valid;
@@ -853,7 +901,7 @@ ChooseMidPlaneFromList
 The clipping hull BSP doesn't worry about avoiding splits
 ==================
 */
-static side_t *ChooseMidPlaneFromList(const bspbrush_t::container &brushes, const node_t *node)
+static side_t *ChooseMidPlaneFromList(const std::vector<bspbrush_t *> &brushes, const node_t *node)
 {
     double bestaxialmetric = VECT_MAX;
     side_t *bestaxialplane = nullptr;
@@ -936,7 +984,7 @@ Returns nullopt if there are no valid planes to split with.
 ================
 */
 static side_t *SelectSplitPlane(
-    const bspbrush_t::container &brushes, node_t *node, tree_split_t split_type, bspstats_t &stats)
+    const std::vector<bspbrush_t *> &brushes, node_t *node, tree_split_t split_type, bspstats_t &stats)
 {
     // no brushes left to split, so we can't use any plane.
     if (!brushes.size()) {
@@ -1119,24 +1167,24 @@ static side_t *SelectSplitPlane(
 SplitBrushList
 ================
 */
-static std::array<bspbrush_t::container, 2> SplitBrushList(
-    bspbrush_t::container brushes, size_t planenum, bspstats_t &stats)
+static std::array<std::vector<bspbrush_t *>, 2> SplitBrushList(
+    tree_t &tree, std::vector<bspbrush_t *> brushes, size_t planenum, bspstats_t &stats)
 {
-    std::array<bspbrush_t::container, 2> result;
+    std::array<std::vector<bspbrush_t *>, 2> result;
 
-    for (auto &brush : brushes) {
+    for (auto *brush : brushes) {
         int sides = brush->side;
 
         if (sides == PSIDE_BOTH) {
             // split into two brushes (destructively)
-            auto [front, back] = SplitBrush(std::move(brush), planenum, stats);
+            auto [front, back] = SplitBrush(brush, planenum, stats, tree_fragments_t{tree});
 
             if (front) {
-                result[0].push_back(std::move(front));
+                result[0].push_back(front);
             }
 
             if (back) {
-                result[1].push_back(std::move(back));
+                result[1].push_back(back);
             }
             continue;
         }
@@ -1153,11 +1201,11 @@ static std::array<bspbrush_t::container, 2> SplitBrushList(
         }
 
         if (sides & PSIDE_FRONT) {
-            result[0].push_back(std::move(brush));
+            result[0].push_back(brush);
             continue;
         }
         if (sides & PSIDE_BACK) {
-            result[1].push_back(std::move(brush));
+            result[1].push_back(brush);
             continue;
         }
     }
@@ -1172,8 +1220,8 @@ BuildTree_r
 Called in parallel.
 ==================
 */
-static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::container brushes, tree_split_t split_type,
-    bspstats_t &stats, logging::percent_clock &clock)
+static void BuildTree_r(tree_t &tree, int level, node_t *node, std::vector<bspbrush_t *> brushes,
+    tree_split_t split_type, bspstats_t &stats, logging::percent_clock &clock)
 {
     // find the best plane to use as a splitter
     auto *bestside = SelectSplitPlane(brushes, node, split_type, stats);
@@ -1185,7 +1233,7 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
         node->make_leaf();
 
         stats.c_leafs++;
-        LeafNode(node, std::move(brushes), stats);
+        LeafNode(tree, node, std::move(brushes), stats);
 
         return;
     }
@@ -1203,7 +1251,7 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
     nodedata->planenum = bestplane;
 
     auto &plane = map.get_plane(bestplane);
-    auto children = SplitBrushList(std::move(brushes), bestplane, stats);
+    auto children = SplitBrushList(tree, std::move(brushes), bestplane, stats);
 
     // allocate children before recursing
     for (int i = 0; i < 2; i++) {
@@ -1222,10 +1270,10 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
 
     // to save time/memory we can destroy node's volume at this point
     if (node->volume) {
-        auto children_volumes = SplitBrush(std::move(node->volume), bestplane, stats);
+        auto children_volumes = SplitBrush(node->volume, bestplane, stats, tree_fragments_t{tree});
         node->volume = nullptr;
-        nodedata->children[0]->volume = std::move(children_volumes[0]);
-        nodedata->children[1]->volume = std::move(children_volumes[1]);
+        nodedata->children[0]->volume = children_volumes[0];
+        nodedata->children[1]->volume = children_volumes[1];
     }
 
     // recursively process children
@@ -1249,17 +1297,38 @@ struct brushbsp_input_stats_t : logging::stat_tracker_t
 
 /*
 ==================
-BrushBSP
+TreeBounds
+
+The bounds of the tree BrushBSP builds from `brushlist`; its head node
+volume is these bounds grown by SIDESPACE.
 ==================
 */
-void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &brushlist, tree_split_t split_type)
+aabb3d TreeBounds(const aabb3d &entity_bounds, const bspbrush_t::container &brushlist)
 {
-    logging::header(__func__);
-
     // NOTE: entity bounds may include brushes that were deleted
     // from the brush list (e.g. clip brushes in Q1 hull 0 still need to affect the model/node bounds)
     // so start with that.
-    tree.bounds = entity.bounds;
+    aabb3d bounds = entity_bounds;
+
+    for (const auto &b : brushlist) {
+        bounds += b->bounds;
+    }
+
+    return bounds;
+}
+
+/*
+==================
+BrushBSP
+==================
+*/
+void BrushBSP(tree_t &tree, const aabb3d &entity_bounds, const bspbrush_t::container &brushlist, tree_split_t split_type)
+{
+    profile::zone zone(__func__);
+
+    logging::header(__func__);
+
+    tree.bounds = TreeBounds(entity_bounds, brushlist);
 
     if (brushlist.empty()) {
         /*
@@ -1269,7 +1338,7 @@ void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &br
          * smarter, but this works.
          */
         auto headnode = tree.create_node();
-        headnode->bounds = entity.bounds;
+        headnode->bounds = entity_bounds;
 
         auto *nodedata = headnode->get_nodedata();
 
@@ -1323,15 +1392,27 @@ void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &br
                     stats.nonvis_faces++;
                 }
             }
-
-            tree.bounds += b->bounds;
         }
     }
 
+    // the tree is built from copies of the brushes, so every brush BuildTree_r
+    // splits or frees belongs to the tree
+    std::vector<bspbrush_t *> brushes;
+    brushes.reserve(brushlist.size());
+
+    for (const auto &b : brushlist) {
+        auto *brush = tree.create_brush();
+        *brush = b->clone();
+        brush->original = b->original_brush();
+        brush->original_ptr = nullptr;
+        brushes.push_back(brush);
+    }
+
     auto node = tree.create_node();
 
     node->bounds = tree.bounds.grow(SIDESPACE);
-    node->volume = BrushFromBounds(node->bounds);
+    node->volume = tree.create_brush();
+    *node->volume = std::move(*BrushFromBounds(node->bounds));
 
     tree.headnode = node;
 
@@ -1340,7 +1421,7 @@ void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &br
 
     {
         logging::percent_clock clock;
-        BuildTree_r(tree, 0, tree.headnode, brushlist, split_type, stats, clock);
+        BuildTree_r(tree, 0, tree.headnode, std::move(brushes), split_type, stats, clock);
     }
 
     stats.print_stats();
@@ -1412,7 +1493,7 @@ inline bspbrush_t::list SubtractBrush(const bspbrush_t::ptr &a, const bspbrush_t
     bspbrush_t::ptr in = a;
 
     for (auto &side : b->sides) {
-        auto [front, back] = SplitBrush(in, side.planenum, std::nullopt);
+        auto [front, back] = SplitBrush(in, side.planenum, std::nullopt, chop_fragments_t{});
 
         if (front) {
             // add to list
@@ -1448,6 +1529,8 @@ Modifies the input list and may free destroyed brushes.
 */
 void ChopBrushes(bspbrush_t::container &brushes, bool allow_fragmentation)
 {
+    profile::zone zone(__func__);
+
     size_t original_count = brushes.size();
     logging::funcheader();
 
@@ -26,6 +26,7 @@
 #include <qbsp/qbsp.hh>
 
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <common/parallel.hh>
 #include <atomic>
 #include <mutex>
@@ -311,6 +312,7 @@ fixme-brushbsp: lots of moving of side_t, which is slow
 */
 bspbrush_t::container CSGFaces(bspbrush_t::container brushes)
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     {
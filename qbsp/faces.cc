@@ -22,6 +22,8 @@
 #include <qbsp/brush.hh>
 
 #include <common/log.hh>
+#include <common/parallel.hh>
+#include <common/profile.hh>
 #include <qbsp/portals.hh>
 #include <qbsp/csg.hh>
 #include <qbsp/map.hh>
@@ -29,6 +31,7 @@
 #include <qbsp/qbsp.hh>
 #include <qbsp/writebsp.hh>
 
+#include <limits>
 #include <list>
 
 struct makefaces_stats_t : logging::stat_tracker_t
@@ -92,21 +95,10 @@ inline void EmitVertex(const qvec3d &vert, size_t &vert_id)
     map.bsp.dvertexes.emplace_back(vert);
 }
 
-// output final vertices
-static void EmitFaceVertices(face_t *f)
-{
-    if (ShouldOmitFace(f)) {
-        return;
-    }
+// placeholder in original_vertices for a vertex that still needs a number
+constexpr size_t UNEMITTED_VERTEX = std::numeric_limits<size_t>::max();
 
-    f->original_vertices.resize(f->w.size());
-
-    for (size_t i = 0; i < f->w.size(); i++) {
-        EmitVertex(f->w[i], f->original_vertices[i]);
-    }
-}
-
-static void EmitVertices_R(node_t *node)
+static void GatherFaces_R(node_t *node, std::vector<face_t *> &faces)
 {
     if (node->is_leaf()) {
         return;
@@ -114,16 +106,57 @@ static void EmitVertices_R(node_t *node)
 
     auto *nodedata = node->get_nodedata();
     for (auto &f : nodedata->facelist) {
-        EmitFaceVertices(f.get());
+        faces.push_back(f.get());
     }
 
-    EmitVertices_R(nodedata->children[0]);
-    EmitVertices_R(nodedata->children[1]);
+    GatherFaces_R(nodedata->children[0], faces);
+    GatherFaces_R(nodedata->children[1], faces);
 }
 
+// output final vertices
 void EmitVertices(node_t *headnode)
 {
-    EmitVertices_R(headnode);
+    profile::zone zone(__func__);
+
+    // vertex numbers are handed out in tree order
+    std::vector<face_t *> faces;
+    GatherFaces_R(headnode, faces);
+
+    std::vector<uint8_t> omitted(faces.size());
+
+    // find out which faces are output, and look up their vertices among
+    // the ones emitted for previous entities. lookups return the oldest
+    // match, and everything emitted below is newer than those, so this
+    // gives the same numbers as looking them up one at a time in order.
+    logging::parallel_for(static_cast<size_t>(0), faces.size(), [&](size_t i) {
+        face_t *f = faces[i];
+
+        if (ShouldOmitFace(f)) {
+            omitted[i] = true;
+            return;
+        }
+
+        f->original_vertices.resize(f->w.size());
+
+        for (size_t j = 0; j < f->w.size(); j++) {
+            f->original_vertices[j] = map.find_emitted_hash_vector(f->w[j]).value_or(UNEMITTED_VERTEX);
+        }
+    });
+
+    // number the rest in tree order
+    for (size_t i = 0; i < faces.size(); i++) {
+        if (omitted[i]) {
+            continue;
+        }
+
+        face_t *f = faces[i];
+
+        for (size_t j = 0; j < f->w.size(); j++) {
+            if (f->original_vertices[j] == UNEMITTED_VERTEX) {
+                EmitVertex(f->w[j], f->original_vertices[j]);
+            }
+        }
+    }
 }
 
 //===========================================================================
@@ -148,8 +181,8 @@ inline int64_t GetEdge(size_t v1, size_t v2, const face_t *face, emit_faces_stat
 
     if (!qbsp_options.noedgereuse.value()) {
         // search for existing edges
-        if (auto it = map.hashedges.find(std::make_pair(v2, v1)); it != map.hashedges.end()) {
-            hashedge_t &existing = it->second;
+        if (hashedge_t *it = map.hashedges.find(v2, v1)) {
+            hashedge_t &existing = *it;
             // this content check is required for software renderers
             // (see q1_liquid_software test case)
             if (existing.face->contents.front.equals(qbsp_options.target_game, face->contents.front)) {
@@ -275,6 +308,10 @@ size_t EmitFaces(node_t *headnode)
 
     Q_assert(map.hashedges.empty());
 
+    // maps end up with about twice as many edges as vertices, and the
+    // vertices have all been emitted by now
+    map.hashedges.reserve(map.bsp.dvertexes.size() * 2);
+
     emit_faces_stats_t stats;
 
     size_t firstface = map.bsp.dfaces.size();
@@ -571,6 +608,7 @@ MakeFaces
 */
 void MakeFaces(node_t *node)
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     makefaces_stats_t stats{};
@@ -30,12 +30,19 @@
 #include <utility>
 #include <optional>
 #include <fstream>
+#include <array>
+#include <cmath>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <bit>
 
 #include <qbsp/brush.hh>
 #include <qbsp/map.hh>
 #include <qbsp/qbsp.hh>
 
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <common/parser.hh>
 #include <common/fs.hh>
 #include <common/imglib.hh>
@@ -43,7 +50,7 @@
 #include <common/ostream.hh>
 #include <common/mapfile.hh>
 
-#include <pareto/spatial_map.h>
+#include <tbb/concurrent_unordered_map.h>
 
 mapdata_t map;
 
@@ -52,16 +59,68 @@ mapplane_t::mapplane_t(const qbsp_plane_t &copy)
 {
 }
 
+// cell sizes for plane_cell_t; several times the lookup epsilons, so
+// a lookup usually only has to visit one cell
+constexpr double PLANE_CELL_NORMAL = NORMAL_EPSILON * 4;
+constexpr double PLANE_CELL_DIST = DIST_EPSILON * 4;
+
+// a plane's normal and distance, quantized
+using plane_cell_t = std::array<int64_t, 4>;
+
+struct cell_hash_t
+{
+    template<size_t N>
+    size_t operator()(const std::array<int64_t, N> &cell) const noexcept
+    {
+        size_t h = 0;
+        for (auto &v : cell) {
+            h = (h ^ std::hash<int64_t>()(v)) * 0x100000001b3ull;
+        }
+        return h;
+    }
+};
+
 struct planehash_t
 {
-    // planes indices (into the `planes` vector)
-    pareto::spatial_map<double, 4, size_t> hash;
+    // planes indices (into the `planes` vector), bucketed by cell.
+    // lookups don't lock; insertions are serialized by `insert_lock`
+    tbb::concurrent_unordered_multimap<plane_cell_t, size_t, cell_hash_t> hash;
+    std::mutex insert_lock;
+
+    static plane_cell_t cell_for(const qvec3d &normal, double dist)
+    {
+        return {static_cast<int64_t>(std::floor(normal[0] / PLANE_CELL_NORMAL)),
+            static_cast<int64_t>(std::floor(normal[1] / PLANE_CELL_NORMAL)),
+            static_cast<int64_t>(std::floor(normal[2] / PLANE_CELL_NORMAL)),
+            static_cast<int64_t>(std::floor(dist / PLANE_CELL_DIST))};
+    }
+};
+
+// cell size for vertex_cell_t; several times the lookup epsilon, so
+// a lookup usually only has to visit one cell
+constexpr double VERTEX_CELL = POINT_EQUAL_EPSILON * 4;
+
+// a point, quantized
+using vertex_cell_t = std::array<int64_t, 3>;
+
+struct hashvert_t
+{
+    qvec3d point;
+    size_t num;
 };
 
 struct vertexhash_t
 {
-    // hashed vertices; generated by EmitVertices
-    pareto::spatial_map<double, 3, size_t> hash;
+    // hashed vertices, bucketed by cell; generated by EmitVertices.
+    // lookups may run concurrently with each other, but not with insertions
+    std::unordered_multimap<vertex_cell_t, hashvert_t, cell_hash_t> hash;
+
+    static vertex_cell_t cell_for(const qvec3d &point)
+    {
+        return {static_cast<int64_t>(std::floor(point[0] / VERTEX_CELL)),
+            static_cast<int64_t>(std::floor(point[1] / VERTEX_CELL)),
+            static_cast<int64_t>(std::floor(point[2] / VERTEX_CELL))};
+    }
 };
 
 mapdata_t::mapdata_t()
@@ -70,35 +129,39 @@ mapdata_t::mapdata_t()
 {
 }
 
-// add the specified plane to the list
-size_t mapdata_t::add_plane(const qplane3d &plane)
+// adds the plane pair; the caller holds plane_hash->insert_lock
+static size_t AddPlaneLocked(mapdata_t &map, const qplane3d &plane)
 {
-    planes.emplace_back(plane);
-    planes.emplace_back(-plane);
-
-    size_t positive_index = planes.size() - 2;
-    size_t negative_index = planes.size() - 1;
-
-    auto &positive = planes[positive_index];
-    auto &negative = planes[negative_index];
-
-    size_t result;
+    qbsp_plane_t positive(plane);
+    qbsp_plane_t negative(-plane);
+    bool flipped = false;
 
     if (positive.get_normal()[static_cast<int32_t>(positive.get_type()) % 3] < 0.0) {
         std::swap(positive, negative);
-        result = negative_index;
-    } else {
-        result = positive_index;
+        flipped = true;
     }
 
-    plane_hash->hash.emplace(pareto::point<double, 4>{positive.get_normal()[0], positive.get_normal()[1],
-                                 positive.get_normal()[2], positive.get_dist()},
-        positive_index);
-    plane_hash->hash.emplace(pareto::point<double, 4>{negative.get_normal()[0], negative.get_normal()[1],
-                                 negative.get_normal()[2], negative.get_dist()},
-        negative_index);
+    // grow_by gives us two adjacent slots, even with concurrent readers
+    const mapplane_t pair[2] = {positive, negative};
+    auto it = map.planes.grow_by(std::begin(pair), std::end(pair));
 
-    return result;
+    size_t positive_index = it - map.planes.begin();
+    size_t negative_index = positive_index + 1;
+
+    // only publish the indices once the planes are constructed
+    map.plane_hash->hash.emplace(
+        planehash_t::cell_for(positive.get_normal(), positive.get_dist()), positive_index);
+    map.plane_hash->hash.emplace(
+        planehash_t::cell_for(negative.get_normal(), negative.get_dist()), negative_index);
+
+    return flipped ? negative_index : positive_index;
+}
+
+// add the specified plane to the list
+size_t mapdata_t::add_plane(const qplane3d &plane)
+{
+    std::scoped_lock lock(plane_hash->insert_lock);
+    return AddPlaneLocked(*this, plane);
 }
 
 std::optional<size_t> mapdata_t::find_plane_nonfatal(const qplane3d &plane)
@@ -106,16 +169,42 @@ std::optional<size_t> mapdata_t::find_plane_nonfatal(const qplane3d &plane)
     constexpr double HALF_NORMAL_EPSILON = NORMAL_EPSILON * 0.5;
     constexpr double HALF_DIST_EPSILON = DIST_EPSILON * 0.5;
 
-    if (auto it = plane_hash->hash.find_intersection(
-            {plane.normal[0] - HALF_NORMAL_EPSILON, plane.normal[1] - HALF_NORMAL_EPSILON,
-                plane.normal[2] - HALF_NORMAL_EPSILON, plane.dist - HALF_DIST_EPSILON},
-            {plane.normal[0] + HALF_NORMAL_EPSILON, plane.normal[1] + HALF_NORMAL_EPSILON,
-                plane.normal[2] + HALF_NORMAL_EPSILON, plane.dist + HALF_DIST_EPSILON});
-        it != plane_hash->hash.end()) {
-        return it->second;
+    const qvec3d half_normal_epsilon{HALF_NORMAL_EPSILON};
+    const plane_cell_t lo =
+        planehash_t::cell_for(plane.normal - half_normal_epsilon, plane.dist - HALF_DIST_EPSILON);
+    const plane_cell_t hi =
+        planehash_t::cell_for(plane.normal + half_normal_epsilon, plane.dist + HALF_DIST_EPSILON);
+
+    // if several planes are within epsilon, the oldest wins
+    std::optional<size_t> result;
+    plane_cell_t cell;
+
+    for (cell[0] = lo[0]; cell[0] <= hi[0]; cell[0]++) {
+        for (cell[1] = lo[1]; cell[1] <= hi[1]; cell[1]++) {
+            for (cell[2] = lo[2]; cell[2] <= hi[2]; cell[2]++) {
+                for (cell[3] = lo[3]; cell[3] <= hi[3]; cell[3]++) {
+                    auto [begin, end] = plane_hash->hash.equal_range(cell);
+
+                    for (auto it = begin; it != end; ++it) {
+                        if (result && *result < it->second) {
+                            continue;
+                        }
+
+                        const mapplane_t &candidate = planes[it->second];
+
+                        if (fabs(candidate.get_dist() - plane.dist) <= HALF_DIST_EPSILON &&
+                            fabs(candidate.get_normal()[0] - plane.normal[0]) <= HALF_NORMAL_EPSILON &&
+                            fabs(candidate.get_normal()[1] - plane.normal[1]) <= HALF_NORMAL_EPSILON &&
+                            fabs(candidate.get_normal()[2] - plane.normal[2]) <= HALF_NORMAL_EPSILON) {
+                            result = it->second;
+                        }
+                    }
+                }
+            }
+        }
     }
 
-    return std::nullopt;
+    return result;
 }
 
 // find the specified plane in the list if it exists. throws
@@ -137,7 +226,14 @@ size_t mapdata_t::add_or_find_plane(const qplane3d &plane)
         return *index;
     }
 
-    return add_plane(plane);
+    std::scoped_lock lock(plane_hash->insert_lock);
+
+    // another thread may have added it while we were waiting
+    if (auto index = find_plane_nonfatal(plane)) {
+        return *index;
+    }
+
+    return AddPlaneLocked(*this, plane);
 }
 
 const qbsp_plane_t &mapdata_t::get_plane(size_t pnum)
@@ -146,30 +242,130 @@ const qbsp_plane_t &mapdata_t::get_plane(size_t pnum)
 }
 
 // find output index for specified already-output vector.
-std::optional<size_t> mapdata_t::find_emitted_hash_vector(const qvec3d &vert)
+std::optional<size_t> mapdata_t::find_emitted_hash_vector(const qvec3d &vert) const
 {
     constexpr double HALF_EPSILON = POINT_EQUAL_EPSILON * 0.5;
 
-    if (auto it =
-            hashverts->hash.find_intersection({vert[0] - HALF_EPSILON, vert[1] - HALF_EPSILON, vert[2] - HALF_EPSILON},
-                {vert[0] + HALF_EPSILON, vert[1] + HALF_EPSILON, vert[2] + HALF_EPSILON});
-        it != hashverts->hash.end()) {
-        return it->second;
+    const qvec3d half_epsilon{HALF_EPSILON};
+    const vertex_cell_t lo = vertexhash_t::cell_for(vert - half_epsilon);
+    const vertex_cell_t hi = vertexhash_t::cell_for(vert + half_epsilon);
+
+    // if several vertices are within epsilon, the oldest wins, so the
+    // result doesn't depend on the order of the buckets
+    std::optional<size_t> result;
+    vertex_cell_t cell;
+
+    for (cell[0] = lo[0]; cell[0] <= hi[0]; cell[0]++) {
+        for (cell[1] = lo[1]; cell[1] <= hi[1]; cell[1]++) {
+            for (cell[2] = lo[2]; cell[2] <= hi[2]; cell[2]++) {
+                auto [begin, end] = hashverts->hash.equal_range(cell);
+
+                for (auto it = begin; it != end; ++it) {
+                    const hashvert_t &candidate = it->second;
+
+                    if (result && *result < candidate.num) {
+                        continue;
+                    }
+
+                    if (fabs(candidate.point[0] - vert[0]) <= HALF_EPSILON &&
+                        fabs(candidate.point[1] - vert[1]) <= HALF_EPSILON &&
+                        fabs(candidate.point[2] - vert[2]) <= HALF_EPSILON) {
+                        result = candidate.num;
+                    }
+                }
+            }
+        }
     }
 
-    return std::nullopt;
+    return result;
 }
 
 // add vector to hash
 void mapdata_t::add_hash_vector(const qvec3d &point, size_t num)
 {
-    hashverts->hash.emplace(pareto::point<double, 3>({point[0], point[1], point[2]}), num);
+    hashverts->hash.emplace(vertexhash_t::cell_for(point), hashvert_t{point, num});
 }
 
 void mapdata_t::add_hash_edge(size_t v1, size_t v2, int64_t edge_index, const face_t *face)
 {
-    hashedges.emplace(std::make_pair(v1, v2),
-        hashedge_t{.v1 = v1, .v2 = v2, .edge_index = edge_index, .face = face, .has_been_reused = false});
+    hashedges.emplace(hashedge_t{.v1 = v1, .v2 = v2, .edge_index = edge_index, .face = face, .has_been_reused = false});
+}
+
+size_t edgehash_t::slot_for(size_t v1, size_t v2) const
+{
+    // fibonacci hashing of the packed pair; the high bits are the best mixed
+    const uint64_t key = (static_cast<uint64_t>(v1) << 32) ^ static_cast<uint64_t>(v2);
+    const uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(hash >> (64 - std::countr_zero(m_slots.size())));
+}
+
+void edgehash_t::rehash(size_t num_slots)
+{
+    m_slots.assign(num_slots, 0);
+
+    const size_t mask = num_slots - 1;
+    for (size_t i = 0; i < m_edges.size(); i++) {
+        size_t slot = slot_for(m_edges[i].v1, m_edges[i].v2);
+        while (m_slots[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        m_slots[slot] = static_cast<uint32_t>(i + 1);
+    }
+}
+
+void edgehash_t::reserve(size_t count)
+{
+    // keep the load factor at or below 1/2
+    const size_t num_slots = std::bit_ceil(std::max<size_t>(count * 2, 16));
+    if (num_slots > m_slots.size()) {
+        m_edges.reserve(count);
+        rehash(num_slots);
+    }
+}
+
+void edgehash_t::emplace(const hashedge_t &edge)
+{
+    if ((m_edges.size() + 1) * 2 > m_slots.size()) {
+        reserve(std::max<size_t>(m_edges.size() * 2, 8));
+    }
+
+    const size_t mask = m_slots.size() - 1;
+    size_t slot = slot_for(edge.v1, edge.v2);
+    while (const uint32_t index = m_slots[slot]) {
+        const hashedge_t &existing = m_edges[index - 1];
+        if (existing.v1 == edge.v1 && existing.v2 == edge.v2) {
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    m_edges.push_back(edge);
+    m_slots[slot] = static_cast<uint32_t>(m_edges.size());
+}
+
+hashedge_t *edgehash_t::find(size_t v1, size_t v2)
+{
+    if (m_slots.empty()) {
+        return nullptr;
+    }
+
+    const size_t mask = m_slots.size() - 1;
+    size_t slot = slot_for(v1, v2);
+    while (const uint32_t index = m_slots[slot]) {
+        hashedge_t &existing = m_edges[index - 1];
+        if (existing.v1 == v1 && existing.v2 == v2) {
+            return &existing;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return nullptr;
+}
+
+void edgehash_t::clear()
+{
+    m_edges.clear();
+    std::fill(m_slots.begin(), m_slots.end(), 0);
 }
 
 const std::optional<img::texture_meta> &mapdata_t::load_image_meta(std::string_view name)
@@ -2326,6 +2522,7 @@ void ProcessMapBrushes()
 
 void LoadMapFile()
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     {
@@ -2607,7 +2804,7 @@ WriteBspBrushMap
 from q3map
 ==================
 */
-void WriteBspBrushMap(std::string_view filename_suffix, const bspbrush_t::container &list)
+void WriteBspBrushMap(std::string_view filename_suffix, const std::vector<bspbrush_t *> &list)
 {
     fs::path name = qbsp_options.bsp_path;
     name.replace_extension(std::string(filename_suffix) + ".map");
@@ -2650,3 +2847,15 @@ void WriteBspBrushMap(std::string_view filename_suffix, const bspbrush_t::contai
 
     f.close();
 }
+
+void WriteBspBrushMap(std::string_view filename_suffix, const bspbrush_t::container &list)
+{
+    std::vector<bspbrush_t *> brushes;
+    brushes.reserve(list.size());
+
+    for (auto &brush : list) {
+        brushes.push_back(brush.get());
+    }
+
+    WriteBspBrushMap(filename_suffix, brushes);
+}
@@ -28,6 +28,7 @@
 #include <qbsp/tree.hh>
 
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <common/ostream.hh>
 #include <climits>
 #include <vector>
@@ -306,7 +307,7 @@ static void WriteLeakLine(const mapentity_t &leakentity, const std::vector<porta
 static void WriteLeafVolumes(const std::vector<portal_t *> &leakline, std::string_view filename_suffix)
 {
     std::set<node_t *> used_leafs;
-    std::vector<bspbrush_t::ptr> volumes_to_write;
+    std::vector<bspbrush_t *> volumes_to_write;
 
     for (portal_t *portal : leakline) {
         for (node_t *node : portal->nodes) {
@@ -410,10 +411,10 @@ void MarkBrushSidesInvisible(bspbrush_t::container &brushes)
     for (auto &brush : brushes) {
         for (auto &face : brush->sides) {
             if (face.source) {
-                face.source->visible = false;
+                face.source->visible[face.hullnum] = false;
 
                 if (face.source->get_texinfo().flags.is_hint) {
-                    face.source->visible = true; // hints are always visible
+                    face.source->visible[face.hullnum] = true; // hints are always visible
                 }
             }
         }
@@ -460,7 +461,7 @@ static void MarkVisibleBrushSides_R(node_t *node)
                     if (side.source && qv::epsilonEqual(side.get_positive_plane(), portal->plane)) {
                         // we've found a brush side in an original brush in the neighbouring
                         // leaf, on a portal to this (non-opaque) leaf, so mark it as visible.
-                        side.source->visible = true;
+                        side.source->visible[side.hullnum] = true;
                     }
                 }
             }
@@ -647,6 +648,40 @@ static std::vector<portal_t *> MakeLeakLine(node_t *outleaf, mapentity_t *&leake
     return result;
 }
 
+/*
+===========
+WriteLeakFiles
+
+Writes the .pts and .leak.prt files for `leak`, unless an earlier leak has
+already written them.
+===========
+*/
+void WriteLeakFiles(const leak_t &leak)
+{
+    if (map.leakfile)
+        return;
+
+    WriteLeakLine(*leak.entity, leak.line);
+    map.leakfile = true;
+
+    // also write the leak portals to `<bsp_path>.leak.prt`
+    WriteDebugPortals(leak.line, "leak");
+
+    // also write the leafs used in the leak line to <bsp_path>.leak-leaf-volumes.map`
+    if (qbsp_options.debugleak.value()) {
+        WriteLeafVolumes(leak.line, "leak-leaf-volumes");
+    }
+
+    /* Get rid of the .prt file since the map has a leak */
+    if (!qbsp_options.keepprt.value()) {
+        fs::path name = qbsp_options.bsp_path;
+        name.replace_extension("prt");
+        remove(name);
+        name.replace_extension("prtb");
+        remove(name);
+    }
+}
+
 /*
 ===========
 FillOutside
@@ -677,8 +712,10 @@ get incorrectly marked as "invisible").
 Special cases: structural fully covered by detail still needs to be marked "visible".
 ===========
 */
-bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes)
+bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brushes, leak_t *leak)
 {
+    profile::zone zone(__func__);
+
     Q_assert(tree.portaltype == portaltype_t::TREE);
 
     node_t *node = tree.headnode;
@@ -755,30 +792,15 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
     if (leakentity) {
         logging::print("WARNING: Reached occupant \"{}\" at ({}), no filling performed.\n",
             leakentity->epairs.get("classname"), leakentity->origin);
-        if (map.leakfile)
-            return false;
-
-        WriteLeakLine(*leakentity, leakline);
-        map.leakfile = true;
-
-        // also write the leak portals to `<bsp_path>.leak.prt`
-        WriteDebugPortals(leakline, "leak");
 
-        // also write the leafs used in the leak line to <bsp_path>.leak-leaf-volumes.map`
-        if (qbsp_options.debugleak.value()) {
-            WriteLeafVolumes(leakline, "leak-leaf-volumes");
-        }
-
-        /* Get rid of the .prt file since the map has a leak */
-        if (!qbsp_options.keepprt.value()) {
-            fs::path name = qbsp_options.bsp_path;
-            name.replace_extension("prt");
-            remove(name);
-        }
-
-        if (qbsp_options.leaktest.value()) {
-            logging::print("Aborting because -leaktest was used.\n");
-            exit(1);
+        if (leak) {
+            // the caller writes the leak files once it knows which hull leaked first
+            if (!leak->entity) {
+                leak->entity = leakentity;
+                leak->line = std::move(leakline);
+            }
+        } else {
+            WriteLeakFiles({leakentity, std::move(leakline)});
         }
 
         // clear occupied state, so areas can be flooded in Q2
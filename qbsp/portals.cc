@@ -29,6 +29,7 @@
 #include <qbsp/outside.hh>
 #include <qbsp/tree.hh>
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <atomic>
 #include <common/prtfile.hh>
 
@@ -528,6 +529,7 @@ MakeTreePortals
 */
 void MakeTreePortals(tree_t &tree)
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     FreeTreePortals(tree);
@@ -1150,7 +1152,7 @@ static void MarkVisibleSides_r(node_t *node, visible_faces_stats_t &stats)
         }
         for (int i = 0; i < 2; ++i) {
             if (p->sides[i] && p->sides[i]->source) {
-                p->sides[i]->source->visible = true;
+                p->sides[i]->source->visible[p->sides[i]->hullnum] = true;
                 stats.sides_visible++;
             }
         }
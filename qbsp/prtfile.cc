@@ -185,10 +185,6 @@ static void WritePortalfile(node_t *headnode, portal_state_t &state)
      */
     NumberLeafs_r(headnode, state, -1);
 
-    // write the file
-    fs::path name = qbsp_options.bsp_path;
-    name.replace_extension("prt");
-
     prtfile_t portalFile{};
 
     // q2 uses a PRT1 file, but with clusters.
@@ -213,7 +209,20 @@ static void WritePortalfile(node_t *headnode, portal_state_t &state)
         WritePTR2ClusterMapping_r(headnode, portalFile);
     }
 
-    WritePortalfile(name, portalFile, qbsp_options.target_version, state.uses_detail, qbsp_options.forceprt1.value());
+    // write the file(s)
+    fs::path name = qbsp_options.bsp_path;
+    const prtformat_t format = qbsp_options.prtformat.value();
+
+    if (format != prtformat_t::binary) {
+        name.replace_extension("prt");
+        WritePortalfile(
+            name, portalFile, qbsp_options.target_version, state.uses_detail, qbsp_options.forceprt1.value());
+    }
+    if (format != prtformat_t::text) {
+        name.replace_extension("prtb");
+        WriteBinaryPortalfile(
+            name, portalFile, qbsp_options.target_version, state.uses_detail, qbsp_options.forceprt1.value());
+    }
 }
 
 /*
@@ -23,6 +23,8 @@
 #include <algorithm>
 
 #include <common/log.hh>
+#include <common/parallel.hh>
+#include <common/profile.hh>
 #include <common/aabb.hh>
 #include <common/fs.hh>
 #include <common/settings.hh>
@@ -44,6 +46,10 @@
 
 #include <fmt/chrono.h>
 
+#include <list>
+
+#include <tbb/task_arena.h>
+
 namespace settings
 {
 bool wadpath::operator<(const wadpath &other) const
@@ -516,10 +522,15 @@ qbsp_settings::qbsp_settings()
       leakdist{this, "leakdist", 0, &debugging_group, "space between leakfile points (default 0: no inbetween points)"},
       forceprt1{
           this, "forceprt1", false, &debugging_group, "force a PRT1 output file even if PRT2 is required for vis"},
+      prtformat{this, "prtformat", prtformat_t::text,
+          {{"text", prtformat_t::text}, {"binary", prtformat_t::binary}, {"both", prtformat_t::both}},
+          &debugging_group, "portal file format: text .prt, binary .prtb, or both"},
       tjunc{this, {"tjunc", "notjunc"}, tjunclevel_t::MWT,
           {{"none", tjunclevel_t::NONE}, {"rotate", tjunclevel_t::ROTATE}, {"retopologize", tjunclevel_t::RETOPOLOGIZE},
               {"mwt", tjunclevel_t::MWT}},
           &debugging_group, "T-junction fix level"},
+      tjuncbruteforce{this, "tjuncbruteforce", false, &debugging_group,
+          "check the vertices of every face against each edge when fixing T-junctions (slow)"},
       objexport{
           this, "objexport", false, &debugging_group, "export the map file as .OBJ models during various CSG phases"},
       noextendedsurfflags{this, "noextendedsurfflags", false, &debugging_group, "suppress writing a .texinfo file"},
@@ -956,7 +967,7 @@ void CountLeafs(node_t *headnode)
     stat_print.register_stat("avg tree height").count += static_cast<int>(avg_height);
 }
 
-static void GatherBspbrushes_r(node_t *node, bspbrush_t::container &container)
+static void GatherBspbrushes_r(node_t *node, std::vector<bspbrush_t *> &container)
 {
     if (auto *leafdata = node->get_leafdata()) {
         for (auto &brush : leafdata->bsp_brushes) {
@@ -970,7 +981,7 @@ static void GatherBspbrushes_r(node_t *node, bspbrush_t::container &container)
     GatherBspbrushes_r(nodedata->children[1], container);
 }
 
-static void GatherLeafVolumes_r(node_t *node, bspbrush_t::container &container)
+static void GatherLeafVolumes_r(node_t *node, std::vector<bspbrush_t *> &container)
 {
     if (auto *leafdata = node->get_leafdata()) {
         if (!leafdata->contents.is_empty(qbsp_options.target_game)) {
@@ -1004,15 +1015,18 @@ static bool ShouldGenerateClipnodes(mapentity_t &entity, hull_index_t hullnum)
 
 /*
 ===============
-ProcessEntity
+LoadEntityBrushes
+
+Reserves the entity's output model and loads its brushes for `hullnum`,
+setting entity.bounds. Returns false if there's no tree to build.
 ===============
 */
-static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
+static bool LoadEntityBrushes(mapentity_t &entity, hull_index_t hullnum, bspbrush_t::container &brushes)
 {
     /* No map brushes means non-bmodel entity.
        We need to handle worldspawn containing no brushes, though. */
     if (!entity.mapbrushes.size() && !map.is_world_entity(entity)) {
-        return;
+        return false;
     }
 
     /*
@@ -1020,7 +1034,7 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
      * worldspawn
      */
     if (IsWorldBrushEntity(entity) || IsNonRemoveWorldBrushEntity(entity))
-        return;
+        return false;
 
     // for notriggermodels: if we have at least one trigger-like texture, do special trigger stuff
     bool discarded_trigger = !map.is_world_entity(entity) && qbsp_options.notriggermodels.value() && IsTrigger(entity);
@@ -1060,7 +1074,6 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
 
     // reserve enough brushes; we would only make less,
     // never more
-    bspbrush_t::container brushes;
     brushes.reserve(entity.mapbrushes.size());
 
     /*
@@ -1087,73 +1100,119 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
     std::ranges::sort(
         brushes, [](const auto &a, const auto &b) { return a->mapbrush->sort_key() < b->mapbrush->sort_key(); });
 
-    // always chop the other hulls to reduce brush tests
-    if (qbsp_options.chop.value() || hullnum.value_or(0)) {
-        ChopBrushes(brushes, qbsp_options.chopfragment.value());
-    }
-
     // we're discarding the brush
     if (discarded_trigger) {
         entity.epairs.set("mins", fmt::to_string(entity.bounds.mins()));
         entity.epairs.set("maxs", fmt::to_string(entity.bounds.maxs()));
-        return;
+        return false;
     }
 
     // corner case, -omitdetail with all detail in an bmodel
     if (brushes.empty() && entity.bounds == aabb3d()) {
-        return;
+        return false;
     }
 
+    return true;
+}
+
+/*
+===============
+CheckLeakTest
+
+FillOutside only records a leak, since it may be running on a worker
+thread; this aborts the compile for -leaktest from the main thread.
+===============
+*/
+static void CheckLeakTest()
+{
+    if (map.leakfile && qbsp_options.leaktest.value()) {
+        logging::print("Aborting because -leaktest was used.\n");
+        exit(1);
+    }
+}
+
+/*
+===============
+BuildClipHull
+
+Builds the collision tree of a clipping hull (hullnum >= 1) from the brushes
+loaded by LoadEntityBrushes and chopped by CreateClipHulls. Doesn't create
+planes or write to the bsp, and a leak is recorded in `leak` rather than
+written out, so different (entity, hull) pairs can be built concurrently;
+see CreateClipHulls.
+===============
+*/
+static void BuildClipHull(mapentity_t &entity, hull_index_t hullnum, const aabb3d &bounds,
+    bspbrush_t::container &brushes, tree_t &tree, leak_t &leak)
+{
     // _hulls key
     if (!ShouldGenerateClipnodes(entity, hullnum)) {
         // We still need to emit an empty tree otherwise hull 0 will point past
         // the clipnode array (FIXME?).
         bspbrush_t::container empty;
-        tree_t tree;
-        BrushBSP(tree, entity, empty, tree_split_t::FAST);
-        if (hullnum.value_or(0)) {
-            ExportClipNodes(entity, tree.headnode, hullnum.value());
-        } else {
-            MakeTreePortals(tree); // needed to assign leaf bounds
-            ExportDrawNodes(entity, tree.headnode, map.bsp.dfaces.size());
-        }
+        BrushBSP(tree, bounds, empty, tree_split_t::FAST);
         return;
     }
 
-    // simpler operation for hulls
-    if (hullnum.value_or(0)) {
-        tree_t tree;
-        BrushBSP(tree, entity, brushes, tree_split_t::FAST);
-        if (map.is_world_entity(entity) && !qbsp_options.nofill.value()) {
-            // assume non-world bmodels are simple
+    BrushBSP(tree, bounds, brushes, tree_split_t::FAST);
+    if (map.is_world_entity(entity) && !qbsp_options.nofill.value()) {
+        // assume non-world bmodels are simple
+        MakeTreePortals(tree);
+        if (FillOutside(tree, hullnum, brushes, &leak)) {
+            if (qbsp_options.filldetail.value())
+                FillDetail(tree, hullnum, brushes);
+
+            // make a really good tree
+            tree.clear();
+            BrushBSP(tree, bounds, brushes, tree_split_t::PRECISE);
+
+            // fill again so PruneNodes works
             MakeTreePortals(tree);
-            if (FillOutside(tree, hullnum, brushes)) {
-                if (qbsp_options.filldetail.value())
-                    FillDetail(tree, hullnum, brushes);
-
-                // make a really good tree
-                tree.clear();
-                BrushBSP(tree, entity, brushes, tree_split_t::PRECISE);
-
-                // fill again so PruneNodes works
-                MakeTreePortals(tree);
-                FillOutside(tree, hullnum, brushes);
-                if (qbsp_options.filldetail.value())
-                    FillDetail(tree, hullnum, brushes);
-
-                FreeTreePortals(tree);
-                PruneNodes(tree.headnode);
-            }
-            CountLeafs(tree.headnode);
+            FillOutside(tree, hullnum, brushes, &leak);
+            if (qbsp_options.filldetail.value())
+                FillDetail(tree, hullnum, brushes);
+
+            FreeTreePortals(tree);
+            PruneNodes(tree.headnode);
         }
-        ExportClipNodes(entity, tree.headnode, hullnum.value());
+        CountLeafs(tree.headnode);
+    }
+}
+
+/*
+===============
+ProcessEntity
+===============
+*/
+static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
+{
+    profile::zone zone(__func__);
+
+    bspbrush_t::container brushes;
+    if (!LoadEntityBrushes(entity, hullnum, brushes)) {
+        return;
+    }
+
+    if (qbsp_options.chop.value()) {
+        ChopBrushes(brushes, qbsp_options.chopfragment.value());
+    }
+
+    // _hulls key
+    if (!ShouldGenerateClipnodes(entity, hullnum)) {
+        // We still need to emit an empty tree otherwise hull 0 will point past
+        // the clipnode array (FIXME?).
+        bspbrush_t::container empty;
+        tree_t tree;
+        BrushBSP(tree, entity.bounds, empty, tree_split_t::FAST);
+        MakeTreePortals(tree); // needed to assign leaf bounds
+        ExportDrawNodes(entity, tree.headnode, map.bsp.dfaces.size());
         return;
     }
 
     // full operation for collision (or main hull)
     tree_t tree;
 
-    BrushBSP(tree, entity, brushes,
+    BrushBSP(tree, entity.bounds, brushes,
         qbsp_options.forcegoodtree.value() ? tree_split_t::PRECISE : // we asked for the slow method
             !map.is_world_entity(entity) ? tree_split_t::FAST
                                          : // brush models are assumed to be simple
@@ -1167,12 +1226,12 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
         // debug output of bspbrushes
         if (!hullnum.value_or(0)) {
             if (qbsp_options.debugbspbrushes.value()) {
-                bspbrush_t::container all_bspbrushes;
+                std::vector<bspbrush_t *> all_bspbrushes;
                 GatherBspbrushes_r(tree.headnode, all_bspbrushes);
                 WriteBspBrushMap("first-brushbsp", all_bspbrushes);
             }
             if (qbsp_options.debugleafvolumes.value()) {
-                bspbrush_t::container all_bspbrushes;
+                std::vector<bspbrush_t *> all_bspbrushes;
                 GatherLeafVolumes_r(tree.headnode, all_bspbrushes);
                 WriteBspBrushMap("first-brushbsp-volumes", all_bspbrushes);
             }
@@ -1188,17 +1247,17 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
 
             // make a really good tree
             tree.clear();
-            BrushBSP(tree, entity, brushes, tree_split_t::PRECISE);
+            BrushBSP(tree, entity.bounds, brushes, tree_split_t::PRECISE);
 
             // debug output of bspbrushes
             if (!hullnum.value_or(0)) {
                 if (qbsp_options.debugbspbrushes.value()) {
-                    bspbrush_t::container all_bspbrushes;
+                    std::vector<bspbrush_t *> all_bspbrushes;
                     GatherBspbrushes_r(tree.headnode, all_bspbrushes);
                     WriteBspBrushMap("second-brushbsp", all_bspbrushes);
                 }
                 if (qbsp_options.debugleafvolumes.value()) {
-                    bspbrush_t::container all_bspbrushes;
+                    std::vector<bspbrush_t *> all_bspbrushes;
                     GatherLeafVolumes_r(tree.headnode, all_bspbrushes);
                     WriteBspBrushMap("second-brushbsp-volumes", all_bspbrushes);
                 }
@@ -1214,6 +1273,8 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
                 FillDetail(tree, hullnum, brushes);
         }
 
+        CheckLeakTest();
+
         // Area portals
         if (qbsp_options.target_game->id == GAME_QUAKE_II) {
             EmitAreaPortals(tree);
@@ -1223,7 +1284,7 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
 
         // rebuild BSP now that we've marked invisible brush sides
         tree.clear();
-        BrushBSP(tree, entity, brushes, tree_split_t::PRECISE);
+        BrushBSP(tree, entity.bounds, brushes, tree_split_t::PRECISE);
     }
 
     MakeTreePortals(tree);
@@ -1500,6 +1561,25 @@ static void BSPX_CreateBrushList()
     map.exported_bspxbrushes = StringToVector(str.str());
 }
 
+// decide if we want to log this entity / hull combination
+static bool WantsLogging(const mapentity_t &entity, hull_index_t hullnum)
+{
+    bool wants_logging = true;
+
+    if (!map.is_world_entity(entity)) {
+        wants_logging = wants_logging && qbsp_options.logbmodels.value();
+    }
+    if (hullnum.value_or(0)) {
+        wants_logging = wants_logging && qbsp_options.loghulls.value();
+    }
+
+    return wants_logging;
+}
+
+// the log output left out for entity / hull combinations we don't want to log
+static const auto quiet_logging_flags =
+    bitflags<logging::flag>(logging::flag::STAT) | logging::flag::PROGRESS | logging::flag::CLOCK_ELAPSED;
+
 /*
 =================
 CreateSingleHull
@@ -1515,21 +1595,10 @@ static void CreateSingleHull(hull_index_t hullnum)
 
     // for each entity in the map file that has geometry
     for (auto &entity : map.entities) {
-        bool wants_logging = true;
-
-        // decide if we want to log this entity / hull combination
-        if (!map.is_world_entity(entity)) {
-            wants_logging = wants_logging && qbsp_options.logbmodels.value();
-        }
-        if (hullnum.value_or(0)) {
-            wants_logging = wants_logging && qbsp_options.loghulls.value();
-        }
-
         // update logging mask if requested
         const auto prev_logging_mask = logging::mask;
-        if (!wants_logging) {
-            logging::mask &= ~(
-                bitflags<logging::flag>(logging::flag::STAT) | logging::flag::PROGRESS | logging::flag::CLOCK_ELAPSED);
+        if (!WantsLogging(entity, hullnum)) {
+            logging::mask &= ~quiet_logging_flags;
         }
 
         ProcessEntity(entity, hullnum);
@@ -1539,6 +1608,125 @@ static void CreateSingleHull(hull_index_t hullnum)
     }
 }
 
+// one (entity, hull) pair built by CreateClipHulls
+struct clip_hull_job_t
+{
+    mapentity_t *entity;
+    uint8_t hullnum;
+    bool build;
+    aabb3d bounds;
+    bspbrush_t::container brushes;
+    tree_t tree;
+
+    // recorded by FillOutside; the leak files are written from the first job that leaked
+    leak_t leak;
+
+    // everything this job logged, printed in job order once they're done
+    logging::buffer_t log;
+};
+
+// prints the jobs' logs in the order CreateSingleHull would have
+static void FlushClipHullLogs(std::list<clip_hull_job_t> &jobs)
+{
+    size_t hullnum = 0;
+
+    for (auto &job : jobs) {
+        if (job.hullnum != hullnum) {
+            hullnum = job.hullnum;
+            logging::print("Processing hull {}...\n", hullnum);
+        }
+
+        job.log.flush(WantsLogging(*job.entity, job.hullnum) ? bitflags<logging::flag>(logging::flag::ALL)
+                                                                  : ~quiet_logging_flags);
+    }
+}
+
+/*
+=================
+CreateClipHulls
+
+Builds clipping hulls 1 .. num_hulls - 1 for all entities, running the
+(entity, hull) pairs concurrently. Everything order-dependent stays serial
+and in the same order as CreateSingleHull: loading brushes (which creates
+the hull expansion planes), creating the BrushBSP head node planes, and
+exporting the clipnodes. Each job's log is buffered and printed in order
+afterwards.
+=================
+*/
+static void CreateClipHulls(size_t num_hulls)
+{
+    std::list<clip_hull_job_t> jobs;
+
+    for (size_t i = 1; i < num_hulls; i++) {
+        for (auto &entity : map.entities) {
+            auto &job = jobs.emplace_back();
+            job.entity = &entity;
+            job.hullnum = i;
+
+            logging::buffer_scope scope(&job.log);
+            job.build = LoadEntityBrushes(entity, job.hullnum, job.brushes);
+            job.bounds = entity.bounds;
+        }
+    }
+
+    // runs `func` on each job that builds a tree, with the job's log buffered
+    auto for_each_job = [&jobs](auto func) {
+        logging::parallel_for_each(jobs, [&func](clip_hull_job_t &job) {
+            if (!job.build) {
+                return;
+            }
+
+            // keep this thread from picking up another job's work while it waits,
+            // which would send that work's log into this job's buffer
+            tbb::this_task_arena::isolate([&]() {
+                logging::buffer_scope scope(&job.log);
+                func(job);
+            });
+        });
+    };
+
+    try {
+        // always chop the other hulls to reduce brush tests.
+        // this only splits brushes by their existing planes
+        for_each_job([](clip_hull_job_t &job) { ChopBrushes(job.brushes, qbsp_options.chopfragment.value()); });
+
+        // BrushBSP would create these when it makes the head node, from the same
+        // bounds; the concurrent builds below then only ever look planes up
+        for (auto &job : jobs) {
+            if (job.build && !job.brushes.empty() && ShouldGenerateClipnodes(*job.entity, job.hullnum)) {
+                BrushFromBounds(TreeBounds(job.bounds, job.brushes).grow(SIDESPACE));
+            }
+        }
+
+        for_each_job([](clip_hull_job_t &job) {
+            BuildClipHull(*job.entity, job.hullnum, job.bounds, job.brushes, job.tree, job.leak);
+        });
+    } catch (...) {
+        FlushClipHullLogs(jobs);
+        throw;
+    }
+
+    FlushClipHullLogs(jobs);
+
+    // jobs are in hull order, so this is the leak CreateSingleHull would have written
+    for (auto &job : jobs) {
+        if (job.leak.entity) {
+            WriteLeakFiles(job.leak);
+            break;
+        }
+    }
+
+    CheckLeakTest();
+
+    while (!jobs.empty()) {
+        auto &job = jobs.front();
+        if (job.build) {
+            ExportClipNodes(*job.entity, job.tree.headnode, job.hullnum);
+        }
+        jobs.pop_front();
+    }
+}
+
 /*
 =================
 CreateHulls
@@ -1546,7 +1734,6 @@ CreateHulls
 */
 static void CreateHulls()
 {
-    /* create the hulls sequentially */
     auto &hulls = qbsp_options.target_game->get_hull_sizes();
 
     // game has no hulls, so we have to export brush lists and stuff.
@@ -1555,15 +1742,15 @@ static void CreateHulls()
         return;
     }
 
-    // all the hulls
-    for (size_t i = 0; i < hulls.size(); i++) {
-        CreateSingleHull(i);
+    // hull 0 emits faces and models, so it always runs first and alone
+    CreateSingleHull(0);
 
-        // only create hull 0 if fNoclip is set
-        if (qbsp_options.noclip.value()) {
-            break;
-        }
+    // only create hull 0 if fNoclip is set
+    if (qbsp_options.noclip.value()) {
+        return;
     }
+
+    CreateClipHulls(hulls.size());
 }
 
 // Fill the BSP's `dtex` data
@@ -1678,6 +1865,8 @@ ProcessFile
 */
 void ProcessFile()
 {
+    profile::zone zone(__func__);
+
     if (qbsp_options.convertmapformat.value() != conversion_t::none) {
         ConvertMapFile();
         return;
@@ -1761,6 +1950,8 @@ void InitQBSP(int argc, const char **argv)
         fs::path prtfile = qbsp_options.bsp_path;
         prtfile.replace_extension("prt");
         remove(prtfile);
+        prtfile.replace_extension("prtb");
+        remove(prtfile);
 
         fs::path ptsfile = qbsp_options.bsp_path;
         ptsfile.replace_extension("pts");
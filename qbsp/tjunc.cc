@@ -23,7 +23,12 @@
 
 #include <qbsp/qbsp.hh>
 #include <qbsp/map.hh>
+#include <common/profile.hh>
+#include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
 
 struct tjunc_stats_t : logging::stat_tracker_t
 {
@@ -119,24 +124,6 @@ static void TestEdge(double start, double end, size_t p1, size_t p2, size_t star
     superface.push_back(p1);
 }
 
-#if 0
-/*
-==========
-FindEdgeVerts_BruteForce
-
-Force a dumb check of everything
-==========
-*/
-static void FindEdgeVerts_BruteForce(
-    const node_t *, const node_t *, const qvec3d &, const qvec3d &, std::vector<size_t> &verts)
-{
-    verts.resize(map.bsp.dvertexes.size());
-
-    for (size_t i = 0; i < verts.size(); i++) {
-        verts[i] = i;
-    }
-}
-#endif
 
 /**
  * This is to prevent func_detail_wall touching solid from creating
@@ -185,35 +172,167 @@ static bool HasTJuncInteraction(const face_t *f1, const face_t *f2)
 
 /*
 ==========
-FindEdgeVerts_FaceBounds_R
+tjunc_vertex_index_t
+
+Uniform grid over the vertices of every face, so the vertices that may lie
+on an edge can be looked up directly instead of walking the whole tree for
+every edge.
 
-Recursive function for matching nodes that intersect the aabb
-for vertex checking.
+HasTJuncInteraction only looks at the back contents of the two faces, so
+faces are bucketed into classes by those, and the grid stores one entry per
+distinct (vertex, class) pair. A query skips the vertices that only belong to
+faces which don't weld with the face being fixed.
 ==========
 */
-static void FindEdgeVerts_FaceBounds_R(
-    const node_t *node, const face_t *f, const aabb3d &aabb, std::vector<size_t> &verts)
+class tjunc_vertex_index_t
 {
-    if (node->is_leaf()) {
-        return;
-    } else if (node->bounds.disjoint(aabb, 0.0)) {
-        return;
+    static constexpr double CELL_SIZE = 64.0;
+    // cell coordinates are packed into 21 bits each, centered on the origin
+    static constexpr int64_t CELL_BIAS = 1 << 20;
+
+    struct entry_t
+    {
+        uint64_t cell;
+        uint32_t vertex;
+        uint32_t contents_class;
+
+        auto operator<=>(const entry_t &) const = default;
+    };
+
+    // sorted by cell, then vertex
+    std::vector<entry_t> m_entries;
+    // cell -> range of m_entries
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> m_cells;
+    // back contents of each class
+    std::vector<contentflags_t> m_classes;
+    const std::unordered_set<face_t *> &m_faces;
+
+    static inline int64_t cell_coord(double v) { return static_cast<int64_t>(std::floor(v / CELL_SIZE)); }
+
+    static inline uint64_t cell_key(int64_t x, int64_t y, int64_t z)
+    {
+        constexpr uint64_t mask = (1 << 21) - 1;
+        return (static_cast<uint64_t>(x + CELL_BIAS) & mask) << 42 |
+               (static_cast<uint64_t>(y + CELL_BIAS) & mask) << 21 | (static_cast<uint64_t>(z + CELL_BIAS) & mask);
     }
 
-    auto *nodedata = node->get_nodedata();
-    for (auto &face : nodedata->facelist) {
-        if (!HasTJuncInteraction(f, face.get()))
-            continue;
-        for (auto &v : face->original_vertices) {
-            if (aabb.containsPoint(map.bsp.dvertexes[v])) {
-                verts.push_back(v);
+    static inline uint64_t cell_key(const qvec3d &p)
+    {
+        return cell_key(cell_coord(p[0]), cell_coord(p[1]), cell_coord(p[2]));
+    }
+
+public:
+    explicit tjunc_vertex_index_t(const std::unordered_set<face_t *> &faces)
+        : m_faces(faces)
+    {
+        std::unordered_map<contents_int_t, uint32_t> class_for;
+
+        for (const face_t *face : faces) {
+            auto [it, inserted] = class_for.try_emplace(face->contents.back.flags, m_classes.size());
+            if (inserted) {
+                m_classes.push_back(face->contents.back);
+            }
+
+            for (size_t v : face->original_vertices) {
+                m_entries.push_back(
+                    {cell_key(map.bsp.dvertexes[v]), static_cast<uint32_t>(v), static_cast<uint32_t>(it->second)});
+            }
+        }
+
+        std::sort(m_entries.begin(), m_entries.end());
+        m_entries.erase(std::unique(m_entries.begin(), m_entries.end()), m_entries.end());
+
+        for (size_t i = 0; i < m_entries.size();) {
+            size_t end = i + 1;
+            while (end < m_entries.size() && m_entries[end].cell == m_entries[i].cell) {
+                end++;
             }
+            m_cells.emplace(m_entries[i].cell, std::make_pair(static_cast<uint32_t>(i), static_cast<uint32_t>(end)));
+            i = end;
         }
     }
 
-    FindEdgeVerts_FaceBounds_R(nodedata->children[0], f, aabb, verts);
-    FindEdgeVerts_FaceBounds_R(nodedata->children[1], f, aabb, verts);
-}
+    // every face the index was built from
+    const std::unordered_set<face_t *> &faces() const { return m_faces; }
+
+    // which classes HasTJuncInteraction with `f`
+    std::vector<bool> welds_with(const face_t *f) const
+    {
+        std::vector<bool> result(m_classes.size());
+        for (size_t i = 0; i < m_classes.size(); i++) {
+            result[i] = Welds(f->contents.back, m_classes[i]);
+        }
+        return result;
+    }
+
+    /*
+     * Adds the vertices inside `bounds` that belong to a face of a class in `welds`,
+     * in ascending order, to `verts`.
+     *
+     * Only cells near the edge p1 -> p2 are visited: the grid is walked one layer
+     * at a time along the edge's major axis, covering the part of the edge (grown
+     * by a unit) that passes through that layer. Vertices further than that from
+     * the edge can't be on it.
+     */
+    void query(const qvec3d &p1, const qvec3d &p2, const aabb3d &bounds, const std::vector<bool> &welds,
+        std::vector<size_t> &verts) const
+    {
+        const size_t first = verts.size();
+        const qvec3d dir = p2 - p1;
+        const int axis = qv::indexOfLargestMagnitudeComponent(dir);
+
+        const int64_t layer_first = cell_coord(bounds.mins()[axis]);
+        const int64_t layer_last = cell_coord(bounds.maxs()[axis]);
+
+        for (int64_t layer = layer_first; layer <= layer_last; layer++) {
+            // the part of the edge within a unit of this layer
+            double t0 = 0, t1 = 1;
+            if (dir[axis] != 0) {
+                t0 = ((layer * CELL_SIZE - 1.0) - p1[axis]) / dir[axis];
+                t1 = (((layer + 1) * CELL_SIZE + 1.0) - p1[axis]) / dir[axis];
+                if (t0 > t1) {
+                    std::swap(t0, t1);
+                }
+                t0 = std::max(t0, 0.0);
+                t1 = std::min(t1, 1.0);
+                if (t0 > t1) {
+                    continue;
+                }
+            }
+
+            const aabb3d part = (aabb3d{} + (p1 + dir * t0) + (p1 + dir * t1)).grow(qvec3d(1.0, 1.0, 1.0));
+
+            int64_t mins[3], maxs[3];
+            for (int i = 0; i < 3; i++) {
+                mins[i] = cell_coord(part.mins()[i]);
+                maxs[i] = cell_coord(part.maxs()[i]);
+            }
+            mins[axis] = maxs[axis] = layer;
+
+            for (int64_t x = mins[0]; x <= maxs[0]; x++) {
+                for (int64_t y = mins[1]; y <= maxs[1]; y++) {
+                    for (int64_t z = mins[2]; z <= maxs[2]; z++) {
+                        auto it = m_cells.find(cell_key(x, y, z));
+                        if (it == m_cells.end()) {
+                            continue;
+                        }
+
+                        for (uint32_t i = it->second.first; i < it->second.second; i++) {
+                            const entry_t &entry = m_entries[i];
+                            if (welds[entry.contents_class] && bounds.containsPoint(map.bsp.dvertexes[entry.vertex])) {
+                                verts.push_back(entry.vertex);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // a vertex can be in several classes
+        std::sort(verts.begin() + first, verts.end());
+        verts.erase(std::unique(verts.begin() + first, verts.end()), verts.end());
+    }
+};
 
 /*
 ==========
@@ -221,17 +340,46 @@ FindEdgeVerts_FaceBounds
 
 Use a loose AABB around the line and only capture vertices that intersect it.
 
-f is the face we're fixing; this will affect the candidate other faces
-because not everything has tjunc interactions (e.g. func_detail_wall and worldspawn.)
+`welds` is the classes of faces the face we're fixing interacts with;
+not everything has tjunc interactions (e.g. func_detail_wall and worldspawn.)
 ==========
 */
-static void FindEdgeVerts_FaceBounds(
-    const node_t *headnode, const face_t *f, const qvec3d &p1, const qvec3d &p2, std::vector<size_t> &verts)
+static void FindEdgeVerts_FaceBounds(const tjunc_vertex_index_t &index, const std::vector<bool> &welds,
+    const qvec3d &p1, const qvec3d &p2, std::vector<size_t> &verts)
 {
     // magic number, average of "usual" points per edge
     verts.reserve(8);
 
-    FindEdgeVerts_FaceBounds_R(headnode, f, (aabb3d{} + p1 + p2).grow(qvec3d(1.0, 1.0, 1.0)), verts);
+    index.query(p1, p2, (aabb3d{} + p1 + p2).grow(qvec3d(1.0, 1.0, 1.0)), welds, verts);
+}
+
+/*
+==========
+FindEdgeVerts_BruteForce
+
+Force a dumb check of every face's vertices (-tjuncbruteforce); gives the
+same vertices as FindEdgeVerts_FaceBounds, in the same order.
+==========
+*/
+static void FindEdgeVerts_BruteForce(const std::unordered_set<face_t *> &faces, const face_t *f, const qvec3d &p1,
+    const qvec3d &p2, std::vector<size_t> &verts)
+{
+    const aabb3d bounds = (aabb3d{} + p1 + p2).grow(qvec3d(1.0, 1.0, 1.0));
+
+    for (const face_t *face : faces) {
+        if (!HasTJuncInteraction(f, face)) {
+            continue;
+        }
+
+        for (size_t v : face->original_vertices) {
+            if (bounds.containsPoint(map.bsp.dvertexes[v])) {
+                verts.push_back(v);
+            }
+        }
+    }
+
+    std::sort(verts.begin(), verts.end());
+    verts.erase(std::unique(verts.begin(), verts.end()), verts.end());
 }
 
 /*
@@ -301,9 +449,10 @@ Generate a superface (the input face `f` but with all of the
 verts in the world added that lay on the line) and return it
 ==================
 */
-static std::vector<size_t> CreateSuperFace(node_t *headnode, face_t *f, tjunc_stats_t &stats)
+static std::vector<size_t> CreateSuperFace(const tjunc_vertex_index_t &index, face_t *f, tjunc_stats_t &stats)
 {
     std::vector<size_t> superface;
+    const std::vector<bool> welds = index.welds_with(f);
 
     superface.reserve(f->original_vertices.size() * 2);
 
@@ -321,7 +470,11 @@ static std::vector<size_t> CreateSuperFace(node_t *headnode, face_t *f, tjunc_st
         qvec3d v2_pos = map.bsp.dvertexes[v2];
 
         edge_verts.clear();
-        FindEdgeVerts_FaceBounds(headnode, f, v1_pos, v2_pos, edge_verts);
+        if (qbsp_options.tjuncbruteforce.value()) {
+            FindEdgeVerts_BruteForce(index.faces(), f, v1_pos, v2_pos, edge_verts);
+        } else {
+            FindEdgeVerts_FaceBounds(index, welds, v1_pos, v2_pos, edge_verts);
+        }
 
         double len;
         qvec3d edge_dir = qv::normalize(v2_pos - v1_pos, len);
@@ -760,7 +913,7 @@ FixFaceEdges
 If the face has any T-junctions, fix them here.
 ==================
 */
-static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
+static void FixFaceEdges(const tjunc_vertex_index_t &index, face_t *f, tjunc_stats_t &stats)
 {
     // we were asked not to bother fixing any of the faces.
     if (qbsp_options.tjunc.value() == settings::tjunclevel_t::NONE) {
@@ -768,7 +921,7 @@ static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
         return;
     }
 
-    std::vector<size_t> superface = CreateSuperFace(headnode, f, stats);
+    std::vector<size_t> superface = CreateSuperFace(index, f, stats);
 
     if (superface.size() < 3) {
         // entire face collapsed
@@ -911,6 +1064,7 @@ TJunc fixing entry point
 */
 void TJunc(node_t *headnode)
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     tjunc_stats_t stats{};
@@ -918,5 +1072,7 @@ void TJunc(node_t *headnode)
 
     FindFaces_r(headnode, faces);
 
-    logging::parallel_for_each(faces, [&](auto &face) { FixFaceEdges(headnode, face, stats); });
+    const tjunc_vertex_index_t index(faces);
+
+    logging::parallel_for_each(faces, [&](auto &face) { FixFaceEdges(index, face, stats); });
 }
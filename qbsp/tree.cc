@@ -42,6 +42,31 @@ node_t *tree_t::create_node()
     return &(*it);
 }
 
+bspbrush_t *tree_t::create_brush()
+{
+    auto &pool = brush_pools.local();
+
+    if (pool.free.empty()) {
+        return &pool.brushes.emplace_back();
+    }
+
+    bspbrush_t *brush = pool.free.back();
+    pool.free.pop_back();
+
+    // keep the side list's storage
+    auto sides = std::move(brush->sides);
+    *brush = {};
+    brush->sides = std::move(sides);
+
+    return brush;
+}
+
+void tree_t::release_brush(bspbrush_t *brush)
+{
+    brush->sides.clear();
+    brush_pools.local().free.push_back(brush);
+}
+
 void tree_t::clear()
 {
     headnode = nullptr;
@@ -50,6 +75,15 @@ void tree_t::clear()
 
     FreeTreePortals(*this);
     nodes.clear();
+
+    // the next BrushBSP on this tree reuses all of the brushes
+    for (auto &pool : brush_pools) {
+        pool.free.clear();
+        for (auto &brush : pool.brushes) {
+            brush.sides.clear();
+            pool.free.push_back(&brush);
+        }
+    }
 }
 
 /*
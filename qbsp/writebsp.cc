@@ -23,6 +23,7 @@
 #include <qbsp/map.hh>
 
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <qbsp/qbsp.hh>
 
 #include <vector>
@@ -478,6 +479,8 @@ WriteBSPFile
 */
 static void WriteBSPFile()
 {
+    profile::zone zone(__func__);
+
     bspdata_t bspdata{};
 
     bspdata.bsp = std::move(map.bsp);
@@ -493,8 +496,11 @@ static void WriteBSPFile()
 
     const size_t num_faces = std::get<mbsp_t>(bspdata.bsp).dfaces.size();
 
-    // convert to output format
-    if (!ConvertBSPFormat(&bspdata, qbsp_options.target_version)) {
+    // pick the output format; the BSP is converted a lump at a time while
+    // it's written, so it never exists in both formats at once
+    const bspversion_t *version = qbsp_options.target_version;
+
+    if (!BSPFitsFormat(&bspdata, version)) {
         const bspversion_t *extendedLimitsFormat = qbsp_options.target_version->extended_limits;
 
         if (!extendedLimitsFormat) {
@@ -506,7 +512,8 @@ static void WriteBSPFile()
         logging::print("NOTE: limits exceeded for {} - switching to {}\n", qbsp_options.target_version->name,
             extendedLimitsFormat->name);
 
-        Q_assert(ConvertBSPFormat(&bspdata, extendedLimitsFormat));
+        version = extendedLimitsFormat;
+        Q_assert(BSPFitsFormat(&bspdata, version));
     }
 
     // Formats with 16-bit marksurfaces/leaffaces have two subformats:
@@ -515,7 +522,7 @@ static void WriteBSPFile()
     //
     // We don't model these as separate bspversion_t's, but this check allows -noallowupgrade
     // to force the vanilla format.
-    if (Is16BitMarkfsurfaceFormat(bspdata.version) && num_faces > 32768) {
+    if (Is16BitMarkfsurfaceFormat(version) && num_faces > 32768) {
         if (!qbsp_options.allow_upgrade.value()) {
             FError("{} faces requires an extended-limits BSP, but allow_upgrade was disabled", num_faces);
         } else {
@@ -527,10 +534,10 @@ static void WriteBSPFile()
 
     qbsp_options.bsp_path.replace_extension("bsp");
 
-    WriteBSPFile(qbsp_options.bsp_path, &bspdata);
+    WriteBSPFile(qbsp_options.bsp_path, &bspdata, version);
     logging::print("Wrote {}\n", qbsp_options.bsp_path);
 
-    PrintBSPFileSizes(&bspdata);
+    PrintBSPFileSizes(&bspdata, version);
 }
 
 /*
@@ -576,8 +583,7 @@ void UpdateBSPFileEntitiesLump()
     bsp.dentdata = std::move(map.bsp.dentdata);
 
     // write the .bsp back to disk
-    ConvertBSPFormat(&bspdata, bspdata.loadversion);
-    WriteBSPFile(qbsp_options.bsp_path, &bspdata);
+    WriteBSPFile(qbsp_options.bsp_path, &bspdata, bspdata.loadversion);
 
     logging::print("Wrote {}\n", qbsp_options.bsp_path);
 }
@@ -1,12 +1,29 @@
 #include <nanobench.h>
 #include <gtest/gtest.h>
 #include <vis/vis.hh>
+#include <light/light.hh>
+#include <light/phong.hh>
+#include <light/trace_embree.hh>
 #include <common/qvec.hh>
 #include <common/polylib.hh>
+#include <common/bspfile.hh>
+#include <common/fs.hh>
+#include <common/parallel.hh>
+#include <qbsp/map.hh>
+#include <testmaps.hh>
+#include "test_qbsp.hh"
 
 #include <array>
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
 #include <vector>
 
+#include <fmt/format.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
 TEST(benchmark, winding)
 {
     ankerl::nanobench::Bench bench;
@@ -143,6 +160,43 @@ TEST(benchmark, visWindings)
     });
 }
 
+TEST(benchmark, visClipKernels)
+{
+    ankerl::nanobench::Rng rng;
+
+    viswinding_t w;
+    w.numpoints = 8;
+    for (size_t i = 0; i < w.size(); i++)
+        w.points[i] = {rng.uniform01() * 512, rng.uniform01() * 512, rng.uniform01() * 512};
+    w.set_winding_sphere();
+
+    std::array<qplane3d, MAX_SEPARATORS> planes;
+    for (auto &plane : planes)
+        plane = {qv::normalize(qvec3d{rng.uniform01() - 0.5, rng.uniform01() - 0.5, rng.uniform01() - 0.5}), 0};
+
+    std::array<double, MAX_SEPARATORS> dists;
+
+    ankerl::nanobench::Bench b;
+    b.relative(true);
+
+    for (auto [simd, name] : {std::pair{vis_simd_t::SCALAR, "scalar"}, std::pair{vis_simd_t::SSE2, "SSE2"},
+             std::pair{vis_simd_t::AVX2, "AVX2"}}) {
+        if (SetVisSIMD(simd) != simd)
+            continue;
+
+        b.run(fmt::format("WindingPlaneDistances, 8 points ({})", name), [&]() {
+            WindingPlaneDistances(w, planes[0], dists.data());
+            ankerl::nanobench::doNotOptimizeAway(dists);
+        });
+        b.run(fmt::format("PlanePointDistances, {} planes ({})", planes.size(), name), [&]() {
+            PlanePointDistances(planes.data(), planes.size(), w.origin, dists.data());
+            ankerl::nanobench::doNotOptimizeAway(dists);
+        });
+    }
+
+    SetVisSIMD(vis_simd_t::AUTO);
+}
+
 TEST(benchmark, vectorMath)
 {
     ankerl::nanobench::Bench b;
@@ -158,3 +212,275 @@ TEST(benchmark, vectorMath)
     b.doNotOptimizeAway(vec0);
     b.doNotOptimizeAway(vec1);
 }
+
+TEST(benchmark, visPortalScheduler)
+{
+    // each iteration hands out one portal and, like UpdateMightsee, lowers the key of another
+    constexpr size_t numportals = 100'000;
+
+    std::vector<visportal_t> portals(numportals);
+    ankerl::nanobench::Rng rng;
+    for (auto &p : portals) {
+        p.status = pstat_none;
+        p.nummightsee = rng.bounded(10'000);
+    }
+
+    ankerl::nanobench::Bench b;
+    b.title("portal_scheduler_t").relative(true).batch(numportals).unit("portal").epochs(3);
+
+    const int maxthreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int threads = 1;; threads = std::min(threads * 2, maxthreads)) {
+        portal_scheduler_t scheduler;
+        tbb::task_arena arena(threads);
+
+        b.run(fmt::format("pop + update, {} threads", threads), [&]() {
+            scheduler.reset(portals);
+            arena.execute([&]() {
+                tbb::parallel_for(size_t(0), numportals, [&](size_t i) {
+                    auto portalnum = scheduler.pop();
+                    scheduler.update((*portalnum * 7919) % numportals, static_cast<int>(i % 100));
+                });
+            });
+        });
+
+        if (threads == maxthreads)
+            break;
+    }
+}
+
+TEST(benchmark, visFull)
+{
+    // end-to-end full vis, which is where the scheduler and leaf locks actually get contended
+    LoadTestmapQ2("base1-test.map");
+
+    const auto bsp_path = fs::path(testmaps_dir) / "base1-test.bsp";
+    const auto original_bsp = fs::path(bsp_path).replace_extension("bsp.novis");
+    fs::copy_file(bsp_path, original_bsp, fs::copy_options::overwrite_existing);
+
+    ankerl::nanobench::Bench b;
+    b.title("vis").relative(true).epochs(1);
+
+    const int maxthreads = std::max(1u, std::thread::hardware_concurrency());
+    for (int threads = 1;; threads = std::min(threads * 2, maxthreads)) {
+        b.run(fmt::format("full vis, {} threads", threads), [&]() {
+            fs::copy_file(original_bsp, bsp_path, fs::copy_options::overwrite_existing);
+            vis_main(std::vector<std::string>{"", "-nostate", "-threads", std::to_string(threads), bsp_path.string()});
+        });
+
+        if (threads == maxthreads)
+            break;
+    }
+}
+
+TEST(benchmark, qbspEdgeHash)
+{
+    // replays the edge lookups and insertions EmitEdges does for a Q2 test map
+    const auto [bsp, bspx, prt] = LoadTestmapQ2("base1-test.map");
+
+    std::vector<std::pair<size_t, size_t>> face_edges;
+    for (const mface_t &face : bsp.dfaces) {
+        for (int i = 0; i < face.numedges; i++) {
+            const int32_t e = bsp.dsurfedges[face.firstedge + i];
+            const bsp2_dedge_t &edge = bsp.dedges[std::abs(e)];
+            face_edges.emplace_back(e < 0 ? edge[1] : edge[0], e < 0 ? edge[0] : edge[1]);
+        }
+    }
+
+    ankerl::nanobench::Bench b;
+    b.title("EmitEdges hash").relative(true).unit("edge").batch(face_edges.size()).epochs(5);
+
+    b.run(fmt::format("std::map, {} face edges", face_edges.size()), [&]() {
+        std::map<std::pair<size_t, size_t>, hashedge_t> edges;
+        int64_t edge_index = 0;
+        for (const auto &[v1, v2] : face_edges) {
+            if (auto it = edges.find(std::make_pair(v2, v1)); it != edges.end() && !it->second.has_been_reused) {
+                it->second.has_been_reused = true;
+                continue;
+            }
+            edges.emplace(std::make_pair(v1, v2), hashedge_t{.v1 = v1, .v2 = v2, .edge_index = edge_index++});
+        }
+        ankerl::nanobench::doNotOptimizeAway(edges);
+    });
+
+    b.run(fmt::format("edgehash_t, {} face edges", face_edges.size()), [&]() {
+        edgehash_t edges;
+        edges.reserve(bsp.dvertexes.size() * 2);
+        int64_t edge_index = 0;
+        for (const auto &[v1, v2] : face_edges) {
+            if (hashedge_t *existing = edges.find(v2, v1); existing && !existing->has_been_reused) {
+                existing->has_been_reused = true;
+                continue;
+            }
+            edges.emplace(hashedge_t{.v1 = v1, .v2 = v2, .edge_index = edge_index++});
+        }
+        ankerl::nanobench::doNotOptimizeAway(edges);
+    });
+}
+
+TEST(benchmark, visPHS)
+{
+    // same work as `vis -phsonly`, on the PVS of a Q2 test map
+    LoadTestmapQ2("base1-test.map");
+
+    auto bsp_path = fs::path(testmaps_dir) / "base1-test.bsp";
+    vis_main(std::vector<std::string>{"", "-fast", bsp_path.string()});
+
+    bspdata_t bspdata;
+    LoadBSPFile(bsp_path, &bspdata);
+    ConvertBSPFormat(&bspdata, &bspver_generic);
+    mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
+
+    portalleafs = bsp.dvis.bit_offsets.size();
+    const std::vector<uint8_t> pvs_bits = bsp.dvis.bits;
+
+    ankerl::nanobench::Bench b;
+    b.title("CalcPHS").unit("cluster").batch(portalleafs).epochs(3);
+    b.run(fmt::format("-phsonly, {} clusters", portalleafs), [&]() {
+        bsp.dvis.bits = pvs_bits;
+        CalcPHS(&bsp);
+        ankerl::nanobench::doNotOptimizeAway(bsp.dvis.bits);
+    });
+}
+
+TEST(benchmark, lightRayPackets)
+{
+    // traces against the embree scene that light leaves behind
+    auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_mountain.map", {});
+    const qvec3f mins = bsp.dmodels[0].mins, size = bsp.dmodels[0].maxs - bsp.dmodels[0].mins;
+
+    std::mt19937 engine(0);
+    std::uniform_real_distribution<float> dis(0, 1);
+    auto random_point = [&]() { return mins + size * qvec3f(dis(engine), dis(engine), dis(engine)); };
+
+    // groups of 64 neighbouring samples traced towards one light, like LightFace_Entity
+    struct test_ray_t
+    {
+        qvec3f origin, dir;
+        float dist;
+    };
+    std::vector<test_ray_t> rays;
+    for (int group = 0; group < 256; group++) {
+        const qvec3f light = random_point();
+        const qvec3f sample = random_point();
+
+        for (int i = 0; i < 64; i++) {
+            const qvec3f origin = sample + qvec3f(i % 8, i / 8, 0) * 8.0f;
+            const float dist = qv::length(light - origin);
+            rays.push_back({origin, (light - origin) / dist, dist});
+        }
+    }
+
+    raystream_occlusion_t occlusion;
+    raystream_intersection_t intersection;
+
+    auto trace = [&]() {
+        occlusion.clearPushedRays();
+        intersection.clearPushedRays();
+        for (int i = 0; i < rays.size(); i++) {
+            occlusion.pushRay(i, rays[i].origin, rays[i].dir, rays[i].dist);
+            intersection.pushRay(i, rays[i].origin, rays[i].dir, rays[i].dist);
+        }
+        occlusion.tracePushedRaysOcclusion(nullptr, CHANNEL_MASK_DEFAULT);
+        intersection.tracePushedRaysIntersection(nullptr, CHANNEL_MASK_DEFAULT);
+    };
+
+    // packets must give the same answers as single rays
+    std::vector<bool> expected_occluded;
+    std::vector<float> expected_dist;
+    for (int width : {1, 8, 16}) {
+        ray_packet_width = width;
+        trace();
+
+        std::vector<bool> occluded;
+        std::vector<float> dist;
+        for (int i = 0; i < rays.size(); i++) {
+            occluded.push_back(occlusion.getPushedRayOccluded(i));
+            dist.push_back(intersection.getPushedRayHitDist(i));
+        }
+        if (width == 1) {
+            expected_occluded = occluded;
+            expected_dist = dist;
+        } else {
+            EXPECT_EQ(expected_occluded, occluded);
+            EXPECT_EQ(expected_dist, dist);
+        }
+    }
+
+    ankerl::nanobench::Bench b;
+    b.title("raystream").unit("ray").batch(rays.size()).relative(true);
+    for (int width : {1, 8, 16}) {
+        ray_packet_width = width;
+        b.run(fmt::format("occlusion, packet width {}", width), [&]() {
+            occlusion.clearPushedRays();
+            for (int i = 0; i < rays.size(); i++) {
+                occlusion.pushRay(i, rays[i].origin, rays[i].dir, rays[i].dist);
+            }
+            occlusion.tracePushedRaysOcclusion(nullptr, CHANNEL_MASK_DEFAULT);
+            ankerl::nanobench::doNotOptimizeAway(occlusion.getPushedRayOccluded(0));
+        });
+    }
+    for (int width : {1, 8, 16}) {
+        ray_packet_width = width;
+        b.run(fmt::format("intersection, packet width {}", width), [&]() {
+            intersection.clearPushedRays();
+            for (int i = 0; i < rays.size(); i++) {
+                intersection.pushRay(i, rays[i].origin, rays[i].dir, rays[i].dist);
+            }
+            intersection.tracePushedRaysIntersection(nullptr, CHANNEL_MASK_DEFAULT);
+            ankerl::nanobench::doNotOptimizeAway(intersection.getPushedRayHitDist(0));
+        });
+    }
+    ray_packet_width = 1;
+}
+
+TEST(benchmark, parallelForOverhead)
+{
+    // bookkeeping cost per item of the parallel_for helpers, with bodies that do nothing
+    constexpr size_t count = 1'000'000;
+    std::vector<uint32_t> items(count);
+
+    // percent() still runs, it just doesn't print
+    const auto old_mask = logging::mask;
+    logging::mask &= ~(bitflags<logging::flag>(logging::flag::PERCENT) | logging::flag::CLOCK_ELAPSED);
+
+    ankerl::nanobench::Bench b;
+    b.title("parallel_for, empty body").unit("item").batch(count).relative(true).epochs(5);
+
+    b.run("per-item progress (old)", [&]() {
+        std::atomic<uint64_t> progress = 0;
+        tbb::parallel_for(size_t(0), count, [&](size_t i) {
+            logging::percent(progress++, count);
+            ankerl::nanobench::doNotOptimizeAway(items[i]);
+        });
+        logging::percent(progress, count);
+    });
+    for (size_t grainsize : {1, 256, 4096}) {
+        b.run(fmt::format("logging::parallel_for, grainsize {}", grainsize), [&]() {
+            logging::parallel_for(
+                size_t(0), count, [&](size_t i) { ankerl::nanobench::doNotOptimizeAway(items[i]); }, grainsize);
+        });
+    }
+    b.run("logging::parallel_for_each", [&]() {
+        logging::parallel_for_each(items, [](uint32_t &item) { ankerl::nanobench::doNotOptimizeAway(item); });
+    });
+
+    logging::mask = old_mask;
+}
+
+TEST(benchmark, phongSetup)
+{
+    // light leaves the texinfo flags and model info of the map loaded; turn phong on everywhere
+    auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_mountain.map", {});
+    for (auto &flags : extended_texinfo_flags) {
+        flags.phong_angle = 89;
+    }
+
+    ankerl::nanobench::Bench b;
+    b.title("CalculateVertexNormals").unit("face").batch(bsp.dfaces.size()).epochs(3);
+    b.run(fmt::format("{} faces", bsp.dfaces.size()), [&]() {
+        ResetPhong();
+        CalculateVertexNormals(&bsp);
+        ankerl::nanobench::doNotOptimizeAway(FaceCacheForFNum(0));
+    });
+    ResetPhong();
+}
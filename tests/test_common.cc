@@ -1,10 +1,13 @@
 #include <gtest/gtest.h>
 
 #include <filesystem>
+#include <fstream>
 #include <common/bspfile.hh>
 #include <common/bspfile_q1.hh>
 #include <common/bspfile_q2.hh>
 #include <common/imglib.hh>
+#include <common/mappedfile.hh>
+#include <common/profile.hh>
 #include <common/settings.hh>
 #include <testmaps.hh>
 
@@ -368,6 +371,109 @@ TEST(imglib, png)
     EXPECT_EQ(texture->height_scale, 1);
 }
 
+TEST(common, mappedFile)
+{
+    const auto path = std::filesystem::temp_directory_path() / "ericwtools_mapped_file_test.bin";
+    const std::string contents = "mapped file contents";
+    {
+        std::ofstream out(path, std::ios_base::out | std::ios_base::binary);
+        out << contents;
+    }
+
+    mapped_file_t file(path);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_EQ(file.size(), contents.size());
+    EXPECT_EQ(std::string(reinterpret_cast<const char *>(file.data()), file.size()), contents);
+
+    // ownership moves with the mapping
+    mapped_file_t moved = std::move(file);
+    EXPECT_FALSE(file.is_open());
+    EXPECT_TRUE(moved.is_open());
+
+    moved = mapped_file_t();
+    std::filesystem::remove(path);
+
+    EXPECT_FALSE(mapped_file_t(path).is_open());
+}
+
+TEST(common, writeGenericBSP)
+{
+    bspdata_t bspdata{};
+    bspdata.version = &bspver_generic;
+
+    mbsp_t &bsp = bspdata.bsp.emplace<mbsp_t>();
+    bsp.dvertexes = {{0, 0, 0}, {64, 0, 0}};
+    // too large for the 16-bit edges of bsp29
+    bsp.dedges = {{0, 1}, {1, 70000}};
+    bsp.dmodels.emplace_back();
+    bsp.dentdata = "{\n\"classname\" \"worldspawn\"\n}\n";
+
+    EXPECT_FALSE(BSPFitsFormat(&bspdata, &bspver_q1));
+    ASSERT_TRUE(BSPFitsFormat(&bspdata, &bspver_bsp2));
+
+    fs::path path = std::filesystem::temp_directory_path() / "ericwtools_write_generic_test.bsp";
+    WriteBSPFile(path, &bspdata, &bspver_bsp2);
+
+    bspdata_t loaded;
+    LoadBSPFile(path, &loaded);
+    EXPECT_EQ(&bspver_bsp2, loaded.version);
+
+    ConvertBSPFormat(&loaded, &bspver_generic);
+
+    const mbsp_t &loaded_bsp = std::get<mbsp_t>(loaded.bsp);
+    EXPECT_EQ(bsp.dvertexes, loaded_bsp.dvertexes);
+    EXPECT_EQ(bsp.dedges, loaded_bsp.dedges);
+    EXPECT_EQ(bsp.dentdata, loaded_bsp.dentdata);
+
+    // a failed write leaves the existing file alone
+    EXPECT_THROW(WriteBSPFile(path, &bspdata, &bspver_q1), ericwtools_error);
+
+    fs::path tmppath = path;
+    tmppath += ".tmp";
+    EXPECT_FALSE(fs::exists(tmppath));
+
+    bspdata_t reloaded;
+    LoadBSPFile(path, &reloaded);
+    EXPECT_EQ(&bspver_bsp2, reloaded.version);
+
+    std::filesystem::remove(path);
+}
+
+TEST(common, profileZones)
+{
+    fs::path path = std::filesystem::temp_directory_path() / "ericwtools_profile_test.json";
+    profile::begin_trace(path);
+
+    {
+        profile::zone outer("outer");
+        profile::zone inner("inner");
+    }
+
+    // zones are recorded as they end, so the inner one comes first
+    auto events = profile::thread_events();
+    ASSERT_EQ(2, events.size());
+    EXPECT_STREQ("inner", events[0].name);
+    EXPECT_STREQ("outer", events[1].name);
+    EXPECT_LE(events[1].begin, events[0].begin);
+    EXPECT_GE(events[1].end, events[0].end);
+
+    profile::end_trace();
+
+    // disabled zones record nothing
+    {
+        profile::zone ignored("ignored");
+    }
+    EXPECT_EQ(2, profile::thread_events().size());
+
+    std::ifstream f(path);
+    std::string json((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    f.close();
+    EXPECT_NE(std::string::npos, json.find("\"traceEvents\""));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"outer\",\"ph\":\"X\""));
+
+    std::filesystem::remove(path);
+}
+
 TEST(qmat, transpose)
 {
     // clang-format off
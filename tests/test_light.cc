@@ -3,8 +3,11 @@
 #include <light/light.hh>
 #include <light/trace.hh> // for clamp_texcoord
 #include <light/entities.hh>
+#include <light/ltface.hh>
+#include <light/surflight.hh>
 
 #include <random>
+#include <set>
 #include <algorithm> // for std::sort
 
 #include <common/qvec.hh>
@@ -1068,3 +1071,206 @@ TEST(LightFormats, e5bgr9pack3)
     EXPECT_LT(error[1], 0.00001);
     EXPECT_LT(error[2], 0.000025);
 }
+
+TEST(surflight, treeQuery)
+{
+    std::mt19937 engine(1234);
+    std::uniform_real_distribution<float> dis(-1024, 1024);
+
+    // a few hundred emitters, some with a bounced style as well as the direct one
+    std::vector<lightsurf_t> surfs(300);
+    std::vector<lightsurf_t *> surf_ptrs;
+    for (size_t i = 0; i < surfs.size(); i++) {
+        auto &vpl = surfs[i].vpl = std::make_unique<surfacelight_t>();
+        vpl->pos = {dis(engine), dis(engine), dis(engine)};
+        vpl->styles.emplace_back().totalintensity = 100;
+        if (i % 3 == 0) {
+            vpl->styles.emplace_back().bounce_level = 0;
+        }
+        surf_ptrs.push_back(&surfs[i]);
+    }
+
+    surflight_tree_t tree;
+    tree.build(surf_ptrs, std::nullopt);
+    EXPECT_EQ(300, tree.entries.size());
+
+    surflight_tree_t bounce_tree;
+    bounce_tree.build(surf_ptrs, 0);
+    EXPECT_EQ(100, bounce_tree.entries.size());
+
+    // entries are kept in emission order
+    for (size_t i = 0; i < bounce_tree.entries.size(); i++) {
+        EXPECT_EQ(i * 3, bounce_tree.entries[i].surfnum);
+        EXPECT_EQ(1, bounce_tree.entries[i].stylenum);
+    }
+
+    // culling nothing visits every entry once
+    std::vector<int> visits(tree.entries.size());
+    tree.query([](const surflight_tree_t::node_t &) { return false; }, [&](uint32_t i) { visits[i]++; });
+    EXPECT_EQ(std::vector<int>(tree.entries.size(), 1), visits);
+
+    // a box query returns exactly the emitters inside the box
+    const aabb3f box{{-256, -256, -256}, {512, 512, 512}};
+    std::vector<uint32_t> found;
+    tree.query([&](const surflight_tree_t::node_t &node) { return node.pos_bounds.disjoint(box); },
+        [&](uint32_t i) {
+            if (box.containsPoint(surfs[tree.entries[i].surfnum].vpl->pos)) {
+                found.push_back(i);
+            }
+        });
+    std::sort(found.begin(), found.end());
+
+    std::vector<uint32_t> expected;
+    for (uint32_t i = 0; i < tree.entries.size(); i++) {
+        if (box.containsPoint(surfs[tree.entries[i].surfnum].vpl->pos)) {
+            expected.push_back(i);
+        }
+    }
+    EXPECT_FALSE(expected.empty());
+    EXPECT_EQ(expected, found);
+}
+
+TEST(lightIndex, cullDistance)
+{
+    // default is a linear 300 light, so it stops at about 300 units
+    light_t light;
+    EXPECT_NEAR(300, LightCullDistance(light_options, &light), 1);
+
+    light.falloff.set_value(128, settings::source::MAP);
+    EXPECT_EQ(128, LightCullDistance(light_options, &light));
+
+    light_t inverse2;
+    inverse2.formula.set_value(LF_INVERSE2, settings::source::MAP);
+    EXPECT_LT(300, LightCullDistance(light_options, &inverse2));
+    EXPECT_FALSE(std::isinf(LightCullDistance(light_options, &inverse2)));
+
+    light_t infinite;
+    infinite.formula.set_value(LF_INFINITE, settings::source::MAP);
+    EXPECT_TRUE(std::isinf(LightCullDistance(light_options, &infinite)));
+
+    light_t no_atten;
+    no_atten.atten.set_value(0, settings::source::MAP);
+    EXPECT_TRUE(std::isinf(LightCullDistance(light_options, &no_atten)));
+}
+
+TEST(lightIndex, query)
+{
+    std::mt19937 engine(1234);
+    std::uniform_real_distribution<float> pos(-2048, 2048);
+    std::uniform_real_distribution<float> level(-300, 600);
+
+    std::vector<std::unique_ptr<light_t>> lights;
+    for (size_t i = 0; i < 300; i++) {
+        auto &light = lights.emplace_back(std::make_unique<light_t>());
+        light->origin.set_value({pos(engine), pos(engine), pos(engine)}, settings::source::MAP);
+        light->light.set_value(level(engine), settings::source::MAP);
+        if (i % 50 == 0) {
+            light->formula.set_value(LF_INFINITE, settings::source::MAP);
+        } else if (i % 3 == 0) {
+            light->formula.set_value(LF_INVERSE2, settings::source::MAP);
+        }
+    }
+
+    // not built yet, so everything is a candidate
+    light_index_t index;
+    std::vector<uint64_t> bits;
+    EXPECT_EQ(lights.size(), index.query(lights, {}, 16, bits));
+
+    index.build(light_options, lights);
+    EXPECT_EQ(lights.size(), index.cull_dists.size());
+    EXPECT_EQ(6, index.unbounded.size());
+
+    for (int i = 0; i < 20; i++) {
+        const qvec3f origin{pos(engine), pos(engine), pos(engine)};
+        const float radius = 64.0f * i;
+
+        const size_t count = index.query(lights, origin, radius, bits);
+
+        size_t expected_count = 0;
+        for (size_t j = 0; j < lights.size(); j++) {
+            const float dist = qv::length(lights[j]->origin.value() - origin) - radius;
+            const bool expected = dist < index.cull_dists[j];
+            const bool found = (bits[j / 64] >> (j % 64)) & 1;
+
+            EXPECT_EQ(expected, found) << "light " << j;
+            expected_count += expected;
+        }
+        EXPECT_EQ(expected_count, count);
+    }
+}
+
+TEST(sunGroups, groupSuns)
+{
+    std::vector<sun_t> suns(4);
+    suns[0].sunvec = {0, 0, -16384};
+    suns[0].sunlight = 100;
+    suns[1].sunvec = {16384, 0, 0};
+    suns[1].sunlight = 100;
+    // same direction as the first, e.g. a second sky dome
+    suns[2].sunvec = {0, 0, -8192};
+    suns[2].sunlight = 50;
+    // same direction, but negative suns are cast in a separate pass
+    suns[3].sunvec = {0, 0, -16384};
+    suns[3].sunlight = -25;
+
+    const auto groups = GroupSuns(suns);
+    ASSERT_EQ(groups.size(), 3);
+
+    EXPECT_EQ(groups[0].incoming, qvec3f(0, 0, -1));
+    EXPECT_FALSE(groups[0].negative);
+    EXPECT_EQ(groups[0].suns, (std::vector<const sun_t *>{&suns[0], &suns[2]}));
+
+    EXPECT_EQ(groups[1].incoming, qvec3f(1, 0, 0));
+    EXPECT_EQ(groups[1].suns, (std::vector<const sun_t *>{&suns[1]}));
+
+    EXPECT_TRUE(groups[2].negative);
+    EXPECT_EQ(groups[2].suns, (std::vector<const sun_t *>{&suns[3]}));
+}
+
+TEST(sunGroups, stratifySuns)
+{
+    // a ring of 8 dim suns and one bright one straight down
+    std::vector<sun_t> suns(9);
+    for (int i = 0; i < 8; i++) {
+        const float angle = DEG2RAD(45.0f * i);
+        suns[i].sunvec = qvec3f(std::cos(angle), std::sin(angle), -1) * 16384;
+        suns[i].sunlight = 10;
+        suns[i].sunlight_color = {255, 255, 255};
+    }
+    suns[8].sunvec = {0, 0, -16384};
+    suns[8].sunlight = 100;
+    suns[8].sunlight_color = {255, 255, 255};
+
+    const auto groups = GroupSuns(suns);
+
+    {
+        SCOPED_TRACE("without strata every group gets its own ray");
+        const auto strata = StratifySuns(groups, 0);
+        ASSERT_EQ(strata.size(), groups.size());
+        for (size_t i = 0; i < strata.size(); i++) {
+            EXPECT_EQ(strata[i].groups, (std::vector<const sun_group_t *>{&groups[i]}));
+            EXPECT_EQ(strata[i].cdf, (std::vector<float>{1.0f}));
+        }
+    }
+
+    {
+        SCOPED_TRACE("the bright sun keeps its own ray, the ring is split into neighbouring pairs");
+        const auto strata = StratifySuns(groups, 9);
+        ASSERT_EQ(strata.size(), 5);
+
+        EXPECT_EQ(strata[0].groups, (std::vector<const sun_group_t *>{&groups[8]}));
+
+        std::set<const sun_group_t *> seen;
+        for (size_t i = 1; i < 5; i++) {
+            ASSERT_EQ(strata[i].groups.size(), 2);
+            EXPECT_FLOAT_EQ(strata[i].cdf[0], 0.5f);
+            EXPECT_EQ(strata[i].cdf[1], 1.0f);
+
+            const float dp = qv::dot(strata[i].groups[0]->incoming, strata[i].groups[1]->incoming);
+            EXPECT_GT(dp, std::cos(DEG2RAD(45.0f)) * 0.5f + 0.5f - 0.01f);
+
+            seen.insert(strata[i].groups.begin(), strata[i].groups.end());
+        }
+        EXPECT_EQ(seen.size(), 8);
+    }
+}
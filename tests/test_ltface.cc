@@ -2,6 +2,7 @@
 
 #include <light/light.hh>
 #include <light/ltface.hh>
+#include <light/lightgrid.hh>
 #include <light/surflight.hh>
 #include <common/bspinfo.hh>
 #include <common/litfile.hh>
@@ -218,6 +219,102 @@ TEST(worldunitsperluxel, lightgrid)
     }
 }
 
+TEST(ltfaceQ2, lightgridAdaptive)
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_lightmap_custom_scale.map", {"-lightgrid"});
+    auto [adaptive_bsp, adaptive_bspx] =
+        QbspVisLight_Q2("q2_lightmap_custom_scale.map", {"-lightgrid", "-lightgrid_adaptive", "4"});
+
+    ASSERT_NE(bspx.find("LIGHTGRID_OCTREE"), bspx.end());
+    ASSERT_NE(adaptive_bspx.find("LIGHTGRID_OCTREE"), adaptive_bspx.end());
+
+    // the rooms in this map are small enough that every block touches solid, so the
+    // adaptive mode ends up lighting every point and must match the dense grid exactly
+    EXPECT_EQ(bspx.at("LIGHTGRID_OCTREE"), adaptive_bspx.at("LIGHTGRID_OCTREE"));
+}
+
+// the samples stored for each grid point of a LIGHTGRID_OCTREE lump; empty if occluded
+static std::vector<std::vector<std::pair<uint8_t, qvec3b>>> DecodeLightgridOctree(const std::vector<uint8_t> &lump)
+{
+    auto stream = imemstream(lump.data(), lump.size());
+    stream >> endianness<std::endian::little>;
+
+    qvec3f grid_dist, grid_mins;
+    qvec3i grid_size;
+    uint8_t num_styles;
+    uint32_t root_node, num_nodes;
+    stream >= grid_dist >= grid_size >= grid_mins >= num_styles >= root_node >= num_nodes;
+
+    // the nodes are only needed for lookups; every stored point is in a leaf
+    stream.seekg(num_nodes * (sizeof(qvec3i) + sizeof(uint32_t) * 8), std::ios_base::cur);
+
+    std::vector<std::vector<std::pair<uint8_t, qvec3b>>> result(grid_size[0] * grid_size[1] * grid_size[2]);
+
+    uint32_t num_leafs;
+    stream >= num_leafs;
+
+    for (uint32_t i = 0; i < num_leafs; ++i) {
+        qvec3i mins, size;
+        stream >= mins >= size;
+
+        for (int z = mins[2]; z < mins[2] + size[2]; ++z) {
+            for (int y = mins[1]; y < mins[1] + size[1]; ++y) {
+                for (int x = mins[0]; x < mins[0] + size[0]; ++x) {
+                    auto &samples = result[(grid_size[0] * grid_size[1] * z) + (grid_size[0] * y) + x];
+
+                    uint8_t style_count;
+                    stream >= style_count;
+
+                    if (style_count == 0xff) {
+                        continue;
+                    }
+
+                    for (uint8_t s = 0; s < style_count; ++s) {
+                        auto &[style, color] = samples.emplace_back();
+                        stream >= style >= color;
+                    }
+                }
+            }
+        }
+    }
+
+    EXPECT_TRUE(stream);
+    return result;
+}
+
+TEST(ltfaceQ2, lightgridAdaptiveOpenArea)
+{
+    constexpr float threshold = 16.0f;
+
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_lightgrid_open.map", {"-lightgrid"});
+    const size_t dense_traced = LightGridTracedPoints();
+
+    auto [adaptive_bsp, adaptive_bspx] =
+        QbspVisLight_Q2("q2_lightgrid_open.map", {"-lightgrid", "-lightgrid_adaptive", fmt::format("{}", threshold)});
+    const size_t adaptive_traced = LightGridTracedPoints();
+
+    // one big room with a single light, so most blocks are interpolated
+    EXPECT_LT(adaptive_traced, dense_traced / 2);
+
+    const auto dense = DecodeLightgridOctree(bspx.at("LIGHTGRID_OCTREE"));
+    const auto adaptive = DecodeLightgridOctree(adaptive_bspx.at("LIGHTGRID_OCTREE"));
+    ASSERT_EQ(dense.size(), adaptive.size());
+
+    for (size_t i = 0; i < dense.size(); ++i) {
+        SCOPED_TRACE(fmt::format("grid point {}", i));
+        ASSERT_EQ(dense[i].size(), adaptive[i].size());
+
+        for (size_t s = 0; s < dense[i].size(); ++s) {
+            EXPECT_EQ(dense[i][s].first, adaptive[i][s].first);
+
+            // both were rounded to bytes, which adds up to 1 on top of the interpolation error
+            for (int c = 0; c < 3; ++c) {
+                EXPECT_LE(std::abs(dense[i][s].second[c] - adaptive[i][s].second[c]), threshold + 1);
+            }
+        }
+    }
+}
+
 TEST(ltfaceQ2, emissiveCubeArtifacts)
 {
     // A cube with surface flags "light", value "100", placed in a hallway.
@@ -768,6 +865,34 @@ TEST(ltfaceQ2, lightSun)
     }
 }
 
+TEST(ltfaceQ1, sunstrata)
+{
+    // 65 dome suns (-sunsamples 64), sampled by 16 rays per point instead of 65
+    auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_sunlight2_open.map", {});
+    auto [bsp_strata, bspx_strata, lit_strata] = QbspVisLight_Q1("q1_sunlight2_open.map", {"-sunstrata", "16"});
+
+    ASSERT_EQ(bsp.dlightdata.size(), bsp_strata.dlightdata.size());
+    ASSERT_FALSE(bsp.dlightdata.empty());
+    EXPECT_GT(*std::max_element(bsp.dlightdata.begin(), bsp.dlightdata.end()), 0);
+
+    // each point traces one sun per stratum, so luxels at the pillar's shadow edges and on
+    // its walls are noisy; this map measures a max error of 13 and a mean of 2.1 against
+    // an average of 70, with a signed mean of 0.05, i.e. noise but no bias
+    constexpr int max_error = 16;
+    constexpr float max_mean_error = 2.5f;
+    constexpr float max_bias = 0.5f;
+
+    int64_t total_error = 0, total_signed_error = 0;
+    for (size_t i = 0; i < bsp.dlightdata.size(); i++) {
+        const int error = bsp_strata.dlightdata[i] - bsp.dlightdata[i];
+        EXPECT_LE(std::abs(error), max_error) << "at lightmap byte " << i;
+        total_error += std::abs(error);
+        total_signed_error += error;
+    }
+    EXPECT_LE(static_cast<float>(total_error) / bsp.dlightdata.size(), max_mean_error);
+    EXPECT_LE(std::abs(static_cast<float>(total_signed_error) / bsp.dlightdata.size()), max_bias);
+}
+
 TEST(ltfaceQ2, lightOriginBrushShadow)
 {
     auto [bsp, bspx] = QbspVisLight_Q2("q2_light_origin_brush_shadow.map", {});
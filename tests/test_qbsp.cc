@@ -22,6 +22,7 @@
 #include <map>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <tbb/parallel_for.h>
 #include "testutils.hh"
 #include "test_main.hh"
 
@@ -1455,6 +1456,38 @@ TEST(testmapsQ1, qbspFuncDetailVariousTypes)
     EXPECT_GT(prt->portalleafs_real, 3);
 }
 
+TEST(testmapsQ1, binaryPortalFile)
+{
+    // PRT1 and PRT2 cases; the .prtb must load to exactly what the .prt does
+    for (const char *map : {"qbsp_simple_sealed.map", "qbsp_func_detail.map"}) {
+        SCOPED_TRACE(map);
+
+        const auto [bsp, bspx, prt] = LoadTestmapQ1(map, {"-prtformat", "both"});
+        ASSERT_TRUE(prt.has_value());
+
+        const auto prtb_path = (fs::path(testmaps_dir) / map).replace_extension(".prtb");
+        const prtfile_t prtb = LoadPrtFile(prtb_path, bsp.loadversion);
+
+        EXPECT_EQ(prt->portalleafs, prtb.portalleafs);
+        EXPECT_EQ(prt->portalleafs_real, prtb.portalleafs_real);
+
+        ASSERT_EQ(prt->portals.size(), prtb.portals.size());
+        for (size_t i = 0; i < prtb.portals.size(); i++) {
+            EXPECT_EQ(prt->portals[i].leafnums[0], prtb.portals[i].leafnums[0]);
+            EXPECT_EQ(prt->portals[i].leafnums[1], prtb.portals[i].leafnums[1]);
+            ASSERT_EQ(prt->portals[i].winding.size(), prtb.portals[i].winding.size());
+            for (size_t j = 0; j < prtb.portals[i].winding.size(); j++) {
+                EXPECT_EQ(prt->portals[i].winding[j], prtb.portals[i].winding[j]);
+            }
+        }
+
+        ASSERT_EQ(prt->dleafinfos.size(), prtb.dleafinfos.size());
+        for (size_t i = 0; i < prtb.dleafinfos.size(); i++) {
+            EXPECT_EQ(prt->dleafinfos[i].cluster, prtb.dleafinfos[i].cluster);
+        }
+    }
+}
+
 TEST(testmapsQ1, angledBrush)
 {
     const auto [bsp, bspx, prt] = LoadTestmapQ1("qbsp_angled_brush.map");
@@ -2020,6 +2053,63 @@ TEST(qbsp, BrushFromBounds)
     EXPECT_EQ(found, 2);
 }
 
+TEST(qbsp, addOrFindPlane)
+{
+    map.reset();
+
+    const size_t up = map.add_or_find_plane({{0, 0, 1}, 16});
+
+    // positive planes are even, and the flipped plane is right next to it
+    EXPECT_EQ(up & 1, 0);
+    EXPECT_EQ(map.add_or_find_plane({{0, 0, -1}, -16}), up ^ 1);
+
+    // within epsilon finds the existing plane
+    EXPECT_EQ(map.add_or_find_plane({{0, 0, 1}, 16 + DIST_EPSILON * 0.25}), up);
+    EXPECT_EQ(map.add_or_find_plane({{NORMAL_EPSILON * 0.25, 0, 1}, 16}), up);
+    EXPECT_EQ(map.planes.size(), 2);
+
+    // outside of it makes a new one
+    EXPECT_NE(map.add_or_find_plane({{0, 0, 1}, 16 + DIST_EPSILON * 2}), up);
+    EXPECT_EQ(map.planes.size(), 4);
+}
+
+TEST(qbsp, addOrFindPlaneConcurrent)
+{
+    map.reset();
+
+    // every thread asks for the same set of planes; they must all agree
+    // on the numbering and no plane may be added twice
+    constexpr size_t num_planes = 500;
+    constexpr size_t num_threads = 8;
+
+    auto make_plane = [](size_t i) {
+        const double angle = i * 0.01;
+        return qplane3d{qv::normalize(qvec3d(cos(angle), sin(angle), (i % 3) * 0.5)), (i % 7) * 64.0};
+    };
+
+    std::vector<std::vector<size_t>> results(num_threads);
+
+    tbb::parallel_for(size_t(0), num_threads, [&](size_t t) {
+        results[t].resize(num_planes);
+
+        for (size_t i = 0; i < num_planes; i++) {
+            // walk the list from different starting points
+            size_t j = (i + t * 61) % num_planes;
+            results[t][j] = map.add_or_find_plane(make_plane(j));
+        }
+    });
+
+    EXPECT_EQ(map.planes.size(), num_planes * 2);
+
+    for (size_t i = 0; i < num_planes; i++) {
+        for (size_t t = 1; t < num_threads; t++) {
+            EXPECT_EQ(results[t][i], results[0][i]);
+        }
+
+        EXPECT_TRUE(qv::epsilonEqual(map.get_plane(results[0][i]), make_plane(i)));
+    }
+}
+
 // FIXME: failing because water tjuncs with walls
 TEST(qbspQ1, waterSubdivisionWithLitWaterOff)
 {
@@ -2573,6 +2663,25 @@ TEST(qbspQ1, tjuncMatrix)
     }
 }
 
+TEST(qbspQ1, tjuncVertexIndexMatchesBruteForce)
+{
+    // colinear vertices along long edges, and faces of contents that do and don't weld
+    for (const char *map : {"qbsp_tjunc_many_sided_face.map", "q1_tjunc_matrix.map"}) {
+        SCOPED_TRACE(map);
+
+        const auto [bsp, bspx, prt] = LoadTestmap(map);
+        const auto [bsp_brute, bspx_brute, prt_brute] = LoadTestmap(map, {"-tjuncbruteforce"});
+
+        ASSERT_EQ(bsp.dfaces.size(), bsp_brute.dfaces.size());
+        EXPECT_EQ(bsp.dvertexes, bsp_brute.dvertexes);
+
+        for (size_t i = 0; i < bsp.dfaces.size(); i++) {
+            EXPECT_EQ(Face_Points(&bsp, &bsp.dfaces[i]), Face_Points(&bsp_brute, &bsp_brute.dfaces[i]))
+                << "face " << i;
+        }
+    }
+}
+
 TEST(testmapsQ1, liquidIsDetail)
 {
     const auto portal_underwater =
@@ -12,6 +12,7 @@
 
 #include "test_qbsp.hh"
 #include "testutils.hh"
+#include <testmaps.hh>
 
 TEST(testmapsQ2, detail)
 {
@@ -440,6 +441,73 @@ TEST(testmapsQ2, bmodelCollision)
     EXPECT_EQ(Q2_CONTENTS_SOLID, BSP_FindLeafAtPoint(&bsp, &bsp.dmodels[1], in_bmodel)->contents);
 }
 
+TEST(testmapsQ2, openBSPFile)
+{
+    const auto [bsp, bspx, prt] = LoadTestmapQ2("q2_bmodel_collision.map");
+
+    // the lumps, read in place, match what LoadBSPFile converted
+    const bspfile_view_t view = OpenBSPFile(fs::path(testmaps_dir) / "q2_bmodel_collision.bsp");
+
+    EXPECT_EQ(&bspver_q2, view.version);
+    EXPECT_EQ(bsp.dentdata, view.entities());
+    EXPECT_EQ(bsp.dvertexes.size() * sizeof(qvec3f), view.lump(Q2_LUMP_VERTEXES).size());
+    EXPECT_EQ(bsp.dfaces.size() * sizeof(q2_dface_t), view.lump(Q2_LUMP_FACES).size());
+
+    ASSERT_EQ(bspx.size(), view.bspx.size());
+
+    for (auto &[name, data] : bspx) {
+        ASSERT_TRUE(view.bspx.contains(name));
+
+        const auto &xdata = view.bspx.at(name);
+        EXPECT_TRUE(std::equal(data.begin(), data.end(), xdata.begin(), xdata.end())) << name;
+    }
+}
+
+TEST(testmapsQ2, loadBSPLumps)
+{
+    const auto [bsp, bspx, prt] = LoadTestmapQ2("q2_bmodel_collision.map");
+
+    const bspfile_view_t view = OpenBSPFile(fs::path(testmaps_dir) / "q2_bmodel_collision.bsp");
+
+    // what findleaf reads; "texture" is a Q1 lump, so it's ignored
+    bspdata_t bspdata;
+    LoadBSPLumps(view, &bspdata, {"models", "nodes", "planes", "leafs", "texture"});
+    ASSERT_TRUE(ConvertBSPFormat(&bspdata, &bspver_generic));
+
+    const mbsp_t &partial = std::get<mbsp_t>(bspdata.bsp);
+
+    EXPECT_EQ(bsp.dmodels.size(), partial.dmodels.size());
+    EXPECT_EQ(bsp.dnodes.size(), partial.dnodes.size());
+    EXPECT_EQ(bsp.dplanes.size(), partial.dplanes.size());
+    EXPECT_EQ(bsp.dleafs.size(), partial.dleafs.size());
+
+    EXPECT_TRUE(partial.dentdata.empty());
+    EXPECT_TRUE(partial.dfaces.empty());
+    EXPECT_TRUE(partial.dvertexes.empty());
+    EXPECT_TRUE(partial.dbrushes.empty());
+
+    const qvec3d in_bmodel{-544, -312, -258};
+    ASSERT_EQ(2, partial.dmodels.size());
+    EXPECT_EQ(Q2_CONTENTS_SOLID, BSP_FindLeafAtPoint(&partial, &partial.dmodels[1], in_bmodel)->contents);
+}
+
+TEST(testmapsQ2, vertexesWelded)
+{
+    const auto [bsp, bspx, prt] = LoadTestmapQ2("q2_bmodel_collision.map");
+
+    ASSERT_EQ(2, bsp.dmodels.size());
+
+    // vertices within epsilon of an emitted one (including ones emitted
+    // for the world, when emitting the bmodel) should have been reused
+    for (size_t i = 0; i < bsp.dvertexes.size(); i++) {
+        for (size_t j = i + 1; j < bsp.dvertexes.size(); j++) {
+            const qvec3f delta = bsp.dvertexes[i] - bsp.dvertexes[j];
+
+            EXPECT_GT(qv::max(qv::abs(delta)), POINT_EQUAL_EPSILON * 0.25) << "vertexes " << i << " and " << j;
+        }
+    }
+}
+
 TEST(testmapsQ2, liquids)
 {
     const auto [bsp, bspx, prt] = LoadTestmapQ2("q2_liquids.map");
@@ -1,11 +1,15 @@
 #include <common/bsputils.hh>
 #include <common/qvec.hh>
 
+#include <array>
+#include <fstream>
+#include <random>
 #include <stdexcept>
 #include <vis/vis.hh>
 
 #include "test_qbsp.hh"
 #include "testutils.hh"
+#include <testmaps.hh>
 
 static bool q2_leaf_sees(
     const mbsp_t &bsp, const std::unordered_map<int, std::vector<uint8_t>> &vis, const mleaf_t *a, const mleaf_t *b)
@@ -181,3 +185,207 @@ TEST(vis, ClipStackWinding)
 
     FreeStackWinding(w1, stack);
 }
+
+TEST(vis, portalScheduler)
+{
+    std::vector<visportal_t> portals(5);
+    const int nummightsee[] = {7, 3, 9, 3, 5};
+    for (size_t i = 0; i < portals.size(); i++) {
+        portals[i].status = pstat_none;
+        portals[i].nummightsee = nummightsee[i];
+    }
+    portals[2].status = pstat_done; // e.g. loaded from a state file
+
+    portal_scheduler_t scheduler;
+    scheduler.reset(portals);
+    EXPECT_EQ(scheduler.size(), 4);
+
+    // ties go to the lower portal number
+    EXPECT_EQ(scheduler.pop(), 1);
+
+    // portal 0 drops below portal 3
+    scheduler.update(0, 2);
+    EXPECT_EQ(scheduler.pop(), 0);
+
+    // updating a portal that was already handed out is a no-op
+    scheduler.update(1, 0);
+    EXPECT_EQ(scheduler.pop(), 3);
+    EXPECT_EQ(scheduler.pop(), 4);
+    EXPECT_EQ(scheduler.pop(), std::nullopt);
+}
+
+TEST(vis, simdKernelsMatchScalar)
+{
+    std::mt19937 engine(1234);
+    std::uniform_real_distribution<double> dis(-4096.0, 4096.0);
+
+    viswinding_t w;
+    w.numpoints = 11; // odd, so the scalar tail of each kernel is used too
+    for (size_t i = 0; i < w.size(); i++)
+        w.points[i] = {dis(engine), dis(engine), dis(engine)};
+
+    std::array<qplane3d, 11> planes;
+    for (auto &plane : planes)
+        plane = {qv::normalize(qvec3d{dis(engine), dis(engine), dis(engine)}), dis(engine)};
+
+    for (auto simd : {vis_simd_t::SCALAR, vis_simd_t::SSE2, vis_simd_t::AVX2}) {
+        SCOPED_TRACE(static_cast<int>(SetVisSIMD(simd)));
+
+        std::array<double, 11> dists;
+        WindingPlaneDistances(w, planes[0], dists.data());
+        for (size_t i = 0; i < w.size(); i++)
+            EXPECT_EQ(dists[i], planes[0].distance_to(w[i]));
+
+        PlanePointDistances(planes.data(), planes.size(), w[0], dists.data());
+        for (size_t i = 0; i < planes.size(); i++)
+            EXPECT_EQ(dists[i], planes[i].distance_to(w[0]));
+    }
+
+    SetVisSIMD(vis_simd_t::AUTO);
+}
+
+TEST(vis, flowbitsReuse)
+{
+    // flowbits_t sizes its bitsets from these
+    const int saved_portalleafs = portalleafs, saved_numportals = numportals;
+    portalleafs = 100;
+    numportals = 40;
+
+    flowbits_t bits;
+    visstats_t stats{};
+
+    bits.prepare(stats);
+    EXPECT_EQ(stats.c_bitsetalloc, 3);
+
+    leafbits_t &first = bits.level(1, stats);
+    EXPECT_EQ(first.size(), 100);
+    bits.level(5, stats);
+    EXPECT_EQ(stats.c_bitsetalloc, 8);
+
+    // growing the stack doesn't move the levels that are in use
+    EXPECT_EQ(&bits.level(1, stats), &first);
+
+    // the next portal reuses everything
+    bits.prepare(stats);
+    bits.level(5, stats);
+    EXPECT_EQ(stats.c_bitsetalloc, 8);
+
+    portalleafs = saved_portalleafs;
+    numportals = saved_numportals;
+}
+
+TEST(vis, incremental)
+{
+    LoadTestmapQ1("q1_func_illusionary_visblocker.map");
+
+    auto bsp_path = fs::path(testmaps_dir) / "q1_func_illusionary_visblocker.bsp";
+    const auto cache_path = fs::path(bsp_path).replace_extension("vcache");
+    fs::remove(cache_path);
+
+    auto run_vis = [&]() {
+        vis_main(std::vector<std::string>{"", "-incremental", bsp_path.string()});
+
+        bspdata_t bspdata;
+        LoadBSPFile(bsp_path, &bspdata);
+        ConvertBSPFormat(&bspdata, &bspver_generic);
+        return std::get<mbsp_t>(bspdata.bsp);
+    };
+
+    // first run calculates everything and saves the cache
+    const mbsp_t full = run_vis();
+    ASSERT_TRUE(fs::exists(cache_path));
+
+    // second run reuses every portal and must produce the same PVS
+    const mbsp_t reused = run_vis();
+    EXPECT_EQ(full.dvis.bits, reused.dvis.bits);
+    EXPECT_EQ(DecompressAllVis(&full), DecompressAllVis(&reused));
+
+    fs::remove(cache_path);
+}
+
+TEST(vis, incrementalCorruptCache)
+{
+    LoadTestmapQ2("q2_detail.map");
+
+    auto bsp_path = fs::path(testmaps_dir) / "q2_detail.bsp";
+    const auto cache_path = fs::path(bsp_path).replace_extension("vcache");
+    fs::remove(cache_path);
+
+    auto run_vis = [&]() {
+        vis_main(std::vector<std::string>{"", "-incremental", bsp_path.string()});
+
+        bspdata_t bspdata;
+        LoadBSPFile(bsp_path, &bspdata);
+        ConvertBSPFormat(&bspdata, &bspver_generic);
+        return std::get<mbsp_t>(bspdata.bsp);
+    };
+
+    const mbsp_t full = run_vis();
+
+    std::vector<char> cache(fs::file_size(cache_path));
+    {
+        std::ifstream in(cache_path, std::ios_base::in | std::ios_base::binary);
+        in.read(cache.data(), cache.size());
+    }
+
+    // dincrementalstate_t, then the first portal's leaf, numpoints and vis
+    constexpr size_t header_size = 24;
+    ASSERT_GT(cache.size(), header_size + 12);
+
+    // a truncated or corrupt cache is ignored, not trusted; each run saves a
+    // fresh cache, so every case starts from a copy of the original one
+    auto run_with_cache = [&](const std::vector<char> &data) {
+        {
+            std::ofstream out(cache_path, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+            out.write(data.data(), data.size());
+        }
+        const mbsp_t result = run_vis();
+        EXPECT_EQ(DecompressAllVis(&full), DecompressAllVis(&result));
+    };
+
+    for (size_t length : {size_t(10), header_size + 6, cache.size() / 2, cache.size() - 1}) {
+        SCOPED_TRACE(fmt::format("cache truncated to {} of {} bytes", length, cache.size()));
+        run_with_cache(std::vector<char>(cache.begin(), cache.begin() + length));
+    }
+
+    auto corrupt_uint32 = [&](size_t offset, const char *what) {
+        SCOPED_TRACE(what);
+        auto corrupt = cache;
+        std::fill(corrupt.begin() + offset, corrupt.begin() + offset + 4, char(0xff));
+        run_with_cache(corrupt);
+    };
+
+    corrupt_uint32(4, "huge portal count");
+    corrupt_uint32(header_size + 4, "huge point count");
+    corrupt_uint32(header_size + 8, "huge vis size");
+
+    fs::remove(cache_path);
+}
+
+TEST(vis, stateResume)
+{
+    LoadTestmapQ1("q1_func_illusionary_visblocker.map");
+
+    auto bsp_path = fs::path(testmaps_dir) / "q1_func_illusionary_visblocker.bsp";
+    const auto state_path = fs::path(bsp_path).replace_extension("vis");
+    fs::remove(state_path);
+
+    auto run_vis = [&]() {
+        vis_main(std::vector<std::string>{"", "-noautoclean", "-stateinterval", "0", bsp_path.string()});
+
+        bspdata_t bspdata;
+        LoadBSPFile(bsp_path, &bspdata);
+        ConvertBSPFormat(&bspdata, &bspver_generic);
+        return std::get<mbsp_t>(bspdata.bsp);
+    };
+
+    // the final state is saved even without periodic checkpoints
+    const mbsp_t full = run_vis();
+    ASSERT_TRUE(fs::exists(state_path));
+
+    // resuming from it has every portal done already
+    const mbsp_t resumed = run_vis();
+    EXPECT_EQ(full.dvis.bits, resumed.dvis.bits);
+
+    fs::remove(state_path);
+}
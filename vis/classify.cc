@@ -0,0 +1,257 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <vis/vis.hh>
+#include <common/log.hh>
+
+/*
+ * Batched plane distance kernels for the vis flow.
+ *
+ * Every implementation evaluates exactly the same expression as
+ * qplane3d::distance_to, i.e. x * nx + (y * ny + z * nz) - dist, with separate
+ * multiplies and adds, so the PVS is bit-identical whichever one is selected.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VIS_HAVE_X86_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define VIS_TARGET_AVX2
+#else
+#define VIS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static_assert(sizeof(qvec3d) == sizeof(double) * 3, "kernels assume packed qvec3d");
+static_assert(sizeof(qplane3d) == sizeof(double) * 4, "kernels assume packed qplane3d");
+
+// scalar
+
+static void PointDistances_Scalar(const qvec3d *points, size_t numpoints, const qplane3d &plane, double *dists)
+{
+    for (size_t i = 0; i < numpoints; i++) {
+        dists[i] = plane.distance_to(points[i]);
+    }
+}
+
+static void PlaneDistances_Scalar(const qplane3d *planes, size_t numplanes, const qvec3d &point, double *dists)
+{
+    for (size_t i = 0; i < numplanes; i++) {
+        dists[i] = planes[i].distance_to(point);
+    }
+}
+
+#ifdef VIS_HAVE_X86_SIMD
+
+// SSE2, 2 points/planes at a time
+
+static void PointDistances_SSE2(const qvec3d *points, size_t numpoints, const qplane3d &plane, double *dists)
+{
+    const __m128d nx = _mm_set1_pd(plane.normal[0]);
+    const __m128d ny = _mm_set1_pd(plane.normal[1]);
+    const __m128d nz = _mm_set1_pd(plane.normal[2]);
+    const __m128d d = _mm_set1_pd(plane.dist);
+
+    size_t i = 0;
+    for (; i + 2 <= numpoints; i += 2) {
+        const double *p = &points[i][0];
+
+        // [x0 y0] [z0 x1] [y1 z1] -> [x0 x1] [y0 y1] [z0 z1]
+        const __m128d a = _mm_loadu_pd(p);
+        const __m128d b = _mm_loadu_pd(p + 2);
+        const __m128d c = _mm_loadu_pd(p + 4);
+        const __m128d x = _mm_shuffle_pd(a, b, 0b10);
+        const __m128d y = _mm_shuffle_pd(a, c, 0b01);
+        const __m128d z = _mm_shuffle_pd(b, c, 0b10);
+
+        const __m128d yz = _mm_add_pd(_mm_mul_pd(y, ny), _mm_mul_pd(z, nz));
+        _mm_storeu_pd(dists + i, _mm_sub_pd(_mm_add_pd(_mm_mul_pd(x, nx), yz), d));
+    }
+
+    PointDistances_Scalar(points + i, numpoints - i, plane, dists + i);
+}
+
+static void PlaneDistances_SSE2(const qplane3d *planes, size_t numplanes, const qvec3d &point, double *dists)
+{
+    const __m128d px = _mm_set1_pd(point[0]);
+    const __m128d py = _mm_set1_pd(point[1]);
+    const __m128d pz = _mm_set1_pd(point[2]);
+
+    size_t i = 0;
+    for (; i + 2 <= numplanes; i += 2) {
+        const double *p0 = &planes[i].normal[0];
+        const double *p1 = &planes[i + 1].normal[0];
+
+        const __m128d a = _mm_loadu_pd(p0);
+        const __m128d b = _mm_loadu_pd(p0 + 2);
+        const __m128d c = _mm_loadu_pd(p1);
+        const __m128d e = _mm_loadu_pd(p1 + 2);
+        const __m128d nx = _mm_unpacklo_pd(a, c);
+        const __m128d ny = _mm_unpackhi_pd(a, c);
+        const __m128d nz = _mm_unpacklo_pd(b, e);
+        const __m128d d = _mm_unpackhi_pd(b, e);
+
+        const __m128d yz = _mm_add_pd(_mm_mul_pd(py, ny), _mm_mul_pd(pz, nz));
+        _mm_storeu_pd(dists + i, _mm_sub_pd(_mm_add_pd(_mm_mul_pd(px, nx), yz), d));
+    }
+
+    PlaneDistances_Scalar(planes + i, numplanes - i, point, dists + i);
+}
+
+// AVX2, 4 points/planes at a time
+
+VIS_TARGET_AVX2 static void PointDistances_AVX2(
+    const qvec3d *points, size_t numpoints, const qplane3d &plane, double *dists)
+{
+    const __m256d nx = _mm256_set1_pd(plane.normal[0]);
+    const __m256d ny = _mm256_set1_pd(plane.normal[1]);
+    const __m256d nz = _mm256_set1_pd(plane.normal[2]);
+    const __m256d d = _mm256_set1_pd(plane.dist);
+    const __m256i stride = _mm256_set_epi64x(9, 6, 3, 0);
+
+    size_t i = 0;
+    for (; i + 4 <= numpoints; i += 4) {
+        const double *p = &points[i][0];
+
+        const __m256d x = _mm256_i64gather_pd(p, stride, 8);
+        const __m256d y = _mm256_i64gather_pd(p + 1, stride, 8);
+        const __m256d z = _mm256_i64gather_pd(p + 2, stride, 8);
+
+        const __m256d yz = _mm256_add_pd(_mm256_mul_pd(y, ny), _mm256_mul_pd(z, nz));
+        _mm256_storeu_pd(dists + i, _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(x, nx), yz), d));
+    }
+
+    PointDistances_Scalar(points + i, numpoints - i, plane, dists + i);
+}
+
+VIS_TARGET_AVX2 static void PlaneDistances_AVX2(
+    const qplane3d *planes, size_t numplanes, const qvec3d &point, double *dists)
+{
+    const __m256d px = _mm256_set1_pd(point[0]);
+    const __m256d py = _mm256_set1_pd(point[1]);
+    const __m256d pz = _mm256_set1_pd(point[2]);
+
+    size_t i = 0;
+    for (; i + 4 <= numplanes; i += 4) {
+        // 4x4 transpose of [nx ny nz d] rows
+        const __m256d r0 = _mm256_loadu_pd(&planes[i].normal[0]);
+        const __m256d r1 = _mm256_loadu_pd(&planes[i + 1].normal[0]);
+        const __m256d r2 = _mm256_loadu_pd(&planes[i + 2].normal[0]);
+        const __m256d r3 = _mm256_loadu_pd(&planes[i + 3].normal[0]);
+        const __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+        const __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+        const __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+        const __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+        const __m256d nx = _mm256_permute2f128_pd(t0, t2, 0x20);
+        const __m256d ny = _mm256_permute2f128_pd(t1, t3, 0x20);
+        const __m256d nz = _mm256_permute2f128_pd(t0, t2, 0x31);
+        const __m256d d = _mm256_permute2f128_pd(t1, t3, 0x31);
+
+        const __m256d yz = _mm256_add_pd(_mm256_mul_pd(py, ny), _mm256_mul_pd(pz, nz));
+        _mm256_storeu_pd(dists + i, _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(px, nx), yz), d));
+    }
+
+    PlaneDistances_Scalar(planes + i, numplanes - i, point, dists + i);
+}
+
+static bool CPUSupportsAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // AVX needs OS support for saving the ymm registers
+    __cpuid(info, 1);
+    constexpr int osxsave = 1 << 27, avx = 1 << 28;
+    if ((info[2] & (osxsave | avx)) != (osxsave | avx))
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+static point_distances_fn point_distances = PointDistances_Scalar;
+static plane_distances_fn plane_distances = PlaneDistances_Scalar;
+
+void WindingPlaneDistances(const viswinding_t &w, const qplane3d &plane, double *dists)
+{
+    point_distances(w.points, w.size(), plane, dists);
+}
+
+void PlanePointDistances(const qplane3d *planes, size_t numplanes, const qvec3d &point, double *dists)
+{
+    plane_distances(planes, numplanes, point, dists);
+}
+
+vis_simd_t SetVisSIMD(vis_simd_t requested)
+{
+    vis_simd_t selected = vis_simd_t::SCALAR;
+
+#ifdef VIS_HAVE_X86_SIMD
+    const bool have_avx2 = CPUSupportsAVX2();
+
+    switch (requested) {
+        case vis_simd_t::AUTO: selected = have_avx2 ? vis_simd_t::AVX2 : vis_simd_t::SSE2; break;
+        case vis_simd_t::AVX2:
+            if (have_avx2) {
+                selected = vis_simd_t::AVX2;
+            } else {
+                logging::print("WARNING: CPU doesn't support AVX2, falling back to SSE2\n");
+                selected = vis_simd_t::SSE2;
+            }
+            break;
+        case vis_simd_t::SSE2: selected = vis_simd_t::SSE2; break;
+        case vis_simd_t::SCALAR: selected = vis_simd_t::SCALAR; break;
+    }
+#else
+    if (requested == vis_simd_t::SSE2 || requested == vis_simd_t::AVX2) {
+        logging::print("WARNING: SIMD kernels are only available on x86-64, using scalar\n");
+    }
+#endif
+
+    switch (selected) {
+#ifdef VIS_HAVE_X86_SIMD
+        case vis_simd_t::AVX2:
+            point_distances = PointDistances_AVX2;
+            plane_distances = PlaneDistances_AVX2;
+            break;
+        case vis_simd_t::SSE2:
+            point_distances = PointDistances_SSE2;
+            plane_distances = PlaneDistances_SSE2;
+            break;
+#endif
+        default:
+            selected = vis_simd_t::SCALAR;
+            point_distances = PointDistances_Scalar;
+            plane_distances = PlaneDistances_Scalar;
+            break;
+    }
+
+    return selected;
+}
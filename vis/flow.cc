@@ -1,7 +1,9 @@
 #include <vis/vis.hh>
 #include <vis/leafbits.hh>
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <common/parallel.hh>
+#include <algorithm>
 #include <bit> // for std::popcount
 
 /*
@@ -27,6 +29,15 @@
 static void ClipToSeparators(visstats_t &stats, const viswinding_t *source, const qplane3d src_pl,
     const viswinding_t *pass, viswinding_t *&target, unsigned int test, pstack_t &stack)
 {
+    double src_dists[MAX_WINDING];
+    double sep_dists[MAX_WINDING];
+
+    if (pass->size() > MAX_WINDING)
+        FError("pass->numpoints > MAX_WINDING ({} > {})", pass->size(), MAX_WINDING);
+
+    // Which side of the source portal is each pass point?
+    WindingPlaneDistances(*pass, src_pl, src_dists);
+
     // check all combinations
     for (size_t i = 0; i < source->size(); i++) {
         const size_t l = (i + 1) % source->size();
@@ -41,7 +52,7 @@ static void ClipToSeparators(visstats_t &stats, const viswinding_t *source, cons
             // This also tells us which side of the separating plane has
             //  the source portal.
             bool fliptest;
-            double d = src_pl.distance_to(pass->at(j));
+            double d = src_dists[j];
             if (d < -VIS_ON_EPSILON)
                 fliptest = true;
             else if (d > VIS_ON_EPSILON)
@@ -72,12 +83,14 @@ static void ClipToSeparators(visstats_t &stats, const viswinding_t *source, cons
             // if all of the pass portal points are now on the positive side,
             // this is the separating plane
             //
+            WindingPlaneDistances(*pass, sep, sep_dists);
+
             int count = 0;
             size_t k = 0;
             for (; k < pass->size(); k++) {
                 if (k == j)
                     continue;
-                d = sep.distance_to(pass->at(k));
+                d = sep_dists[k];
                 if (d < -VIS_ON_EPSILON)
                     break;
                 else if (d > VIS_ON_EPSILON)
@@ -113,6 +126,30 @@ static void ClipToSeparators(visstats_t &stats, const viswinding_t *source, cons
     }
 }
 
+void flowbits_t::prepare(visstats_t &stats)
+{
+    if (targetcheck_mightsee.size() == static_cast<size_t>(portalleafs) &&
+        portalbits.size() == static_cast<size_t>(numportals * 2)) {
+        return;
+    }
+
+    mightsee.clear();
+    targetcheck_mightsee.resize(portalleafs);
+    portalbits.resize(numportals * 2);
+    nextportalbits.resize(numportals * 2);
+    stats.c_bitsetalloc += 3;
+}
+
+leafbits_t &flowbits_t::level(unsigned depth, visstats_t &stats)
+{
+    while (mightsee.size() < depth) {
+        mightsee.emplace_back(portalleafs);
+        stats.c_bitsetalloc++;
+    }
+
+    return mightsee[depth - 1];
+}
+
 static int CheckStack(leaf_t *leaf, threaddata_t *thread)
 {
     for (pstack_t *p = thread->pstack_head.next; p; p = p->next)
@@ -133,11 +170,8 @@ static vistest_action VisTests(
     /* TEST 0 :: source -> pass -> target */
     if (vis_options.level.value() > 0) {
         if (stack.numseparators[0]) {
-            for (int j = 0; j < stack.numseparators[0]; j++) {
-                stack.pass = ClipStackWinding(stats, stack.pass, stack, stack.separators[0][j]);
-                if (!stack.pass)
-                    break;
-            }
+            stack.pass = ClipStackWindingToPlanes(
+                stats, stack.pass, stack, stack.separators[0], stack.numseparators[0]);
         } else {
             /* Using prevstack source for separator cache correctness */
             ClipToSeparators(stats, prevstack->source, head->portalplane, prevstack->pass, stack.pass, 0, stack);
@@ -151,11 +185,8 @@ static vistest_action VisTests(
     /* TEST 1 :: pass -> source -> target */
     if (vis_options.level.value() > 1) {
         if (stack.numseparators[1]) {
-            for (int j = 0; j < stack.numseparators[1]; j++) {
-                stack.pass = ClipStackWinding(stats, stack.pass, stack, stack.separators[1][j]);
-                if (!stack.pass)
-                    break;
-            }
+            stack.pass = ClipStackWindingToPlanes(
+                stats, stack.pass, stack, stack.separators[1], stack.numseparators[1]);
         } else {
             /* Using prevstack source for separator cache correctness */
             ClipToSeparators(stats, prevstack->pass, prevstack->portalplane, prevstack->source, stack.pass, 1, stack);
@@ -195,7 +226,7 @@ static vistest_action VisTests(
   ==================
 */
 static unsigned TargetChecks(visstats_t &stats, const pstack_t *const head, const pstack_t *const prevstack,
-    leafbits_t &prevportalbits, leafbits_t &portalbits)
+    leafbits_t &prevportalbits, leafbits_t &portalbits, leafbits_t &local)
 {
     pstack_t stack;
     visportal_t *p, *q;
@@ -203,7 +234,7 @@ static unsigned TargetChecks(visstats_t &stats, const pstack_t *const head, cons
     int i, j, numchecks, numremain;
 
     if (prevstack->pass == NULL) {
-        portalbits = std::move(prevportalbits);
+        std::swap(portalbits, prevportalbits);
         return 0;
     }
 
@@ -219,7 +250,6 @@ static unsigned TargetChecks(visstats_t &stats, const pstack_t *const head, cons
     for (i = 0; i < STACK_WINDINGS; i++)
         stack.windings_used[i] = false;
 
-    leafbits_t local(portalleafs);
     local.clear();
     stack.mightsee = &local;
 
@@ -297,8 +327,10 @@ static unsigned TargetChecks(visstats_t &stats, const pstack_t *const head, cons
         FreeStackWinding(stack.pass, stack);
     }
 
-    // transfer results back to prevstack
-    *prevstack->mightsee = std::move(local);
+    // copy results back to prevstack in place; for the head that's the portal's own
+    // mightsee, which other threads may be reading
+    const size_t numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+    std::copy_n(local.data(), numblocks, prevstack->mightsee->data());
 
     return numchecks;
 }
@@ -310,24 +342,24 @@ static unsigned TargetChecks(visstats_t &stats, const pstack_t *const head, cons
   Retrace the path and reduce mightsee by clipping the targets directly
   ==================
 */
-static unsigned IterativeTargetChecks(visstats_t &stats, pstack_t *const head)
+static unsigned IterativeTargetChecks(visstats_t &stats, pstack_t *const head, flowbits_t &bits)
 {
     unsigned numchecks, numblocks;
 
     numchecks = 0;
     numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
 
-    leafbits_t portalbits(numportals * 2); // in contradiction to the typename, I know
+    leafbits_t &portalbits = bits.portalbits;
+    leafbits_t &nextportalbits = bits.nextportalbits;
     portalbits.setall();
 
     for (pstack_t *stack = head; stack; stack = stack->next) {
         if (stack->did_targetchecks)
             continue;
 
-        leafbits_t nextportalbits(numportals * 2);
         nextportalbits.clear();
-        numchecks += TargetChecks(stats, head, stack, portalbits, nextportalbits);
-        portalbits = std::move(nextportalbits);
+        numchecks += TargetChecks(stats, head, stack, portalbits, nextportalbits, bits.targetcheck_mightsee);
+        std::swap(portalbits, nextportalbits);
 
         if (stack->next) {
             pstack_t *next = stack->next;
@@ -379,7 +411,7 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
     if (vis_options.targetratio.value() > 0.0 && prevstack.num_expected_targetchecks > 0 &&
         thread->numsteps * vis_options.targetratio.value() >=
             thread->numtargetchecks + prevstack.num_expected_targetchecks) {
-        unsigned num_actual_targetchecks = IterativeTargetChecks(thread->stats, &thread->pstack_head);
+        unsigned num_actual_targetchecks = IterativeTargetChecks(thread->stats, &thread->pstack_head, thread->bits);
         thread->stats.c_targetcheck += num_actual_targetchecks;
         thread->numtargetchecks += num_actual_targetchecks;
         // prevstack.num_expected_targetchecks is zero now
@@ -396,8 +428,8 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
     for (int i = 0; i < STACK_WINDINGS; i++)
         stack.windings_used[i] = false;
 
-    leafbits_t local(portalleafs);
-    stack.mightsee = &local;
+    stack.depth = prevstack.depth + 1;
+    stack.mightsee = &thread->bits.level(stack.depth, thread->stats);
 
     const auto vis = thread->leafvis.data();
 
@@ -411,7 +443,7 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
         uint32_t *test;
 
         // if the portal can't see anything we haven't allready seen, skip it
-        if (p->status == pstat_done) {
+        if (p->load_status() == pstat_done) {
             thread->stats.c_vistest++;
             test = p->visbits.data();
         } else {
@@ -516,7 +548,13 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
 */
 visstats_t PortalFlow(visportal_t *p)
 {
-    threaddata_t data{p->visbits};
+    profile::zone zone(__func__);
+
+    // reused by every portal this thread flows
+    thread_local flowbits_t bits;
+
+    threaddata_t data{p->visbits, bits};
+    bits.prepare(data.stats);
 
     if (p->status != pstat_working)
         FError("reflowed");
@@ -646,5 +684,7 @@ static void BasePortalThread(size_t portalnum)
 */
 void BasePortalVis()
 {
+    profile::zone zone(__func__);
+
     logging::parallel_for(0, numportals * 2, BasePortalThread);
 }
@@ -18,9 +18,13 @@
 */
 
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <vis/vis.hh>
 #include <common/bsputils.hh>
 #include <common/parallel.hh>
+
+#include <atomic>
+#include <bit> // for std::countr_zero, std::popcount
 /*
 
 Some textures (sky, water, slime, lava) are considered ambien sound emiters.
@@ -58,6 +62,7 @@ static aabb3d SurfaceBBox(const mbsp_t *bsp, const mface_t *surf)
 */
 void CalcAmbientSounds(mbsp_t *bsp)
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     // fast path for -noambient
@@ -153,75 +158,114 @@ void CalcAmbientSounds(mbsp_t *bsp)
     });
 }
 
+/*
+ * Byte rows (as stored in the .bsp, after decompression) <-> leafbits_t
+ */
+static void RowToLeafBits(leafbits_t &dst, const uint8_t *src, size_t numbytes)
+{
+    dst.clear();
+
+    for (size_t i = 0; i < numbytes; i++) {
+        const uint32_t shift = (i << 3) & leafbits_t::mask;
+        dst.data()[i >> (leafbits_t::shift - 3)] |= (uint32_t)src[i] << shift;
+    }
+}
+
+static void LeafBitsToRow(uint8_t *dst, const leafbits_t &src, size_t numbytes)
+{
+    for (size_t i = 0; i < numbytes; i++) {
+        const uint32_t shift = (i << 3) & leafbits_t::mask;
+        dst[i] = (src.data()[i >> (leafbits_t::shift - 3)] >> shift) & 0xff;
+    }
+}
+
 /*
 ================
 CalcPHS
 
 Calculate the PHS (Potentially Hearable Set)
 by ORing together all the PVS visible from a leaf
+
+Every PVS row is decompressed once up front; the PHS rows are then built and
+compressed in parallel, and appended to the vis lump in cluster order.
 ================
 */
 void CalcPHS(mbsp_t *bsp)
 {
+    profile::zone zone(__func__);
     logging::funcheader();
 
     const int32_t leafbytes = (portalleafs + 7) >> 3;
-    const int32_t leaflongs = leafbytes / sizeof(long);
+    const size_t numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
 
-    // increase the bits size with approximately how much space we'll need
-    bsp->dvis.bits.reserve(bsp->dvis.bits.size() * 2);
+    logging::print("Decompressing PVS...\n");
 
-    std::vector<uint8_t> uncompressed(leafbytes);
-    std::vector<uint8_t> uncompressed_2(leafbytes);
-    std::vector<uint8_t> compressed(leafbytes * 2);
-    std::vector<uint8_t> uncompressed_orig(leafbytes);
+    std::vector<leafbits_t> pvs(portalleafs);
 
-    int32_t count = 0;
-    for (int32_t i = 0; i < portalleafs; i++) {
-        const uint8_t *scan = bsp->dvis.bits.data() + bsp->dvis.get_bit_offset(VIS_PVS, i);
+    logging::parallel_for(0, portalleafs, [&](int32_t i) {
+        std::vector<uint8_t> uncompressed(leafbytes);
 
+        const uint8_t *scan = bsp->dvis.bits.data() + bsp->dvis.get_bit_offset(VIS_PVS, i);
         DecompressVis(scan, bsp->dvis.bits.data() + bsp->dvis.bits.size(), uncompressed.data(),
             uncompressed.data() + uncompressed.size());
-        std::copy(uncompressed.begin(), uncompressed.end(), uncompressed_orig.begin());
 
-        scan = uncompressed_orig.data();
+        pvs[i].resize(portalleafs);
+        RowToLeafBits(pvs[i], uncompressed.data(), leafbytes);
 
-        for (int32_t j = 0; j < leafbytes; j++) {
-            uint8_t bitbyte = scan[j];
-            if (!bitbyte)
-                continue;
-            for (int32_t k = 0; k < 8; k++) {
-                if (!(bitbyte & nth_bit(k)))
-                    continue;
-                // OR this pvs row into the phs
-                int32_t index = ((j << 3) + k);
-                if (index >= portalleafs)
-                    FError("Bad bit in PVS"); // pad bits should be 0
-                const uint8_t *src_compressed = bsp->dvis.bits.data() + bsp->dvis.get_bit_offset(VIS_PVS, index);
-                DecompressVis(src_compressed, bsp->dvis.bits.data() + bsp->dvis.bits.size(), uncompressed_2.data(),
-                    uncompressed_2.data() + uncompressed_2.size());
-                const long *src = reinterpret_cast<long *>(uncompressed_2.data());
-                long *dest = reinterpret_cast<long *>(uncompressed.data());
-                for (int32_t l = 0; l < leaflongs; l++)
-                    dest[l] |= src[l];
+        // pad bits should be 0
+        if (portalleafs & leafbits_t::mask) {
+            if (pvs[i].data()[numblocks - 1] >> (portalleafs & leafbits_t::mask))
+                FError("Bad bit in PVS");
+        }
+    });
+
+    logging::print("Building PHS...\n");
+
+    std::vector<std::vector<uint8_t>> compressed(portalleafs);
+    std::atomic<int64_t> count = 0;
+
+    logging::parallel_for(0, portalleafs, [&](int32_t i) {
+        const leafbits_t &pvsrow = pvs[i];
+        leafbits_t phs = pvsrow;
+
+        // OR the pvs row of every visible cluster into the phs
+        for (size_t j = 0; j < numblocks; j++) {
+            uint32_t bits = pvsrow.data()[j];
+            while (bits) {
+                const int bit = std::countr_zero(bits);
+                bits &= bits - 1;
+                phs |= pvs[(j << leafbits_t::shift) + bit];
             }
         }
-        for (int32_t j = 0; j < portalleafs; j++)
-            if (uncompressed[j >> 3] & nth_bit(j & 7))
-                count++;
+
+        int64_t numhearable = 0;
+        for (size_t j = 0; j < numblocks; j++)
+            numhearable += std::popcount(phs.data()[j]);
+        count += numhearable;
 
         //
         // compress the bit string
         //
-        compressed.clear();
-        CompressRow(uncompressed.data(), leafbytes, std::back_inserter(compressed));
+        std::vector<uint8_t> uncompressed(leafbytes);
+        LeafBitsToRow(uncompressed.data(), phs, leafbytes);
+
+        compressed[i].reserve(leafbytes);
+        CompressRow(uncompressed.data(), leafbytes, std::back_inserter(compressed[i]));
+    });
+
+    size_t phssize = 0;
+    for (auto &row : compressed)
+        phssize += row.size();
 
+    bsp->dvis.bits.reserve(bsp->dvis.bits.size() + phssize);
+
+    for (int32_t i = 0; i < portalleafs; i++) {
         bsp->dvis.set_bit_offset(VIS_PHS, i, bsp->dvis.bits.size());
 
-        std::copy(compressed.begin(), compressed.end(), std::back_inserter(bsp->dvis.bits));
+        std::copy(compressed[i].begin(), compressed[i].end(), std::back_inserter(bsp->dvis.bits));
     }
 
     fmt::print("Average clusters hearable: {}\n", count / portalleafs);
 
     bsp->dvis.bits.shrink_to_fit();
-}
\ No newline at end of file
+}
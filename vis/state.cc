@@ -17,6 +17,7 @@
     See file, 'COPYING', for details.
 */
 
+#include <cmath>
 #include <cstdint>
 // #include <cstdio>
 
@@ -28,9 +29,17 @@
 #include <common/cmdlib.hh>
 #include "common/fs.hh"
 #include <common/log.hh>
+#include <common/mappedfile.hh>
+#include <algorithm>
+#include <condition_variable>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
 
-constexpr uint32_t VIS_STATE_VERSION = ('T' << 24 | 'Y' << 16 | 'R' << 8 | '1');
+constexpr uint32_t VIS_STATE_VERSION = ('T' << 24 | 'Y' << 16 | 'R' << 8 | '2');
+constexpr uint32_t VIS_INCREMENTAL_VERSION = ('T' << 24 | 'Y' << 16 | 'I' << 8 | '1');
 
 struct dvisstate_t
 {
@@ -43,18 +52,38 @@ struct dvisstate_t
     auto stream_data() { return std::tie(version, numportals, numleafs, testlevel, time_elapsed); }
 };
 
+struct dincrementalstate_t
+{
+    uint32_t version;
+    uint32_t numportals;
+    uint32_t numleafs;
+    uint32_t testlevel;
+    double visdist;
+
+    auto stream_data() { return std::tie(version, numportals, numleafs, testlevel, visdist); }
+};
+
+struct dincrementalportal_t
+{
+    uint32_t leaf;
+    uint32_t numpoints;
+    uint32_t vis;
+
+    auto stream_data() { return std::tie(leaf, numpoints, vis); }
+};
+
 struct dportal_t
 {
-    uint32_t status;
+    uint64_t offset; // of the portal's bits in the journal, 0 until it's done
     uint32_t might;
     uint32_t vis;
     uint32_t nummightsee;
     uint32_t numcansee;
 
-    auto stream_data() { return std::tie(status, might, vis, nummightsee, numcansee); }
+    auto stream_data() { return std::tie(offset, might, vis, nummightsee, numcansee); }
 };
 
-static int CompressBits(uint8_t *out, const leafbits_t &in)
+static int CompressBits(uint8_t *out, const uint32_t *in)
 {
     int i, rep, shift, numbytes;
     uint8_t val, repval, *dst;
@@ -63,7 +92,7 @@ static int CompressBits(uint8_t *out, const leafbits_t &in)
     numbytes = (portalleafs + 7) >> 3;
     for (i = 0; i < numbytes && dst - out < numbytes; i++) {
         shift = (i << 3) & leafbits_t::mask;
-        val = (in.data()[i >> (leafbits_t::shift - 3)] >> shift) & 0xff;
+        val = (in[i >> (leafbits_t::shift - 3)] >> shift) & 0xff;
         *dst++ = val;
         if (val != 0 && val != 0xff)
             continue;
@@ -73,7 +102,7 @@ static int CompressBits(uint8_t *out, const leafbits_t &in)
         rep = 1;
         for (i++; i < numbytes; i++) {
             shift = (i << 3) & leafbits_t::mask;
-            repval = (in.data()[i >> (leafbits_t::shift - 3)] >> shift) & 0xff;
+            repval = (in[i >> (leafbits_t::shift - 3)] >> shift) & 0xff;
             if (repval != val || rep == 255)
                 break;
             rep++;
@@ -89,16 +118,16 @@ static int CompressBits(uint8_t *out, const leafbits_t &in)
     dst = out;
     for (i = 0; i < numbytes; i++) {
         shift = (i << 3) & leafbits_t::mask;
-        *dst++ = (in.data()[i >> (leafbits_t::shift - 3)] >> shift) & 0xff;
+        *dst++ = (in[i >> (leafbits_t::shift - 3)] >> shift) & 0xff;
     }
     return numbytes;
 }
 
-static void DecompressBits(leafbits_t &dst, const uint8_t *src)
+static void DecompressBits(leafbits_t &dst, const uint8_t *src, size_t numleafs)
 {
-    const size_t numbytes = (portalleafs + 7) >> 3;
+    const size_t numbytes = (numleafs + 7) >> 3;
 
-    dst.resize(portalleafs);
+    dst.resize(numleafs);
 
     for (size_t i = 0; i < numbytes; i++) {
         uint8_t val = *src++;
@@ -131,50 +160,116 @@ static void CopyLeafBits(leafbits_t &dst, const uint8_t *src, size_t numleafs)
     }
 }
 
-void SaveVisState()
+/*
+ * State checkpoints
+ *
+ * The state file is a header, a fixed size index with a dportal_t per portal,
+ * and a journal the compressed bits of each portal are appended to once it's
+ * done. A checkpoint appends the portals completed since the last one, then
+ * fills in their index entries and finally the header, so it costs
+ * O(newly completed portals) and a checkpoint cut short leaves the previous
+ * one intact. Portals that aren't done restart from their base vis mightsee
+ * when vis resumes.
+ *
+ * A worker takes a snapshot of which portals are done and a background thread
+ * writes them out while the workers carry on; done portals never change again,
+ * so their bits are read in place.
+ */
+constexpr size_t VIS_STATE_HEADER_SIZE = sizeof(uint32_t) * 5;
+constexpr size_t VIS_STATE_PORTAL_SIZE = sizeof(uint64_t) + sizeof(uint32_t) * 4;
+
+/* The bits of a completed portal, copied out while its leaf is locked */
+struct vis_snapshot_portal_t
 {
-    int vis_len, might_len;
-    dvisstate_t state;
-    dportal_t pstate;
+    size_t portalnum;
+    int nummightsee;
+    int numcansee;
+    std::vector<uint8_t> might, vis; // compressed
+};
 
-    std::ofstream out(statetmpfile, std::ios_base::out | std::ios_base::binary);
-    out << endianness<std::endian::little>;
+struct vis_snapshot_t
+{
+    uint32_t time_elapsed = 0;
+    std::vector<vis_snapshot_portal_t> completed;
+};
 
-    /* Write out a header */
-    state.version = VIS_STATE_VERSION;
-    state.numportals = numportals;
-    state.numleafs = portalleafs;
-    state.testlevel = vis_options.visdist.value();
-    state.time_elapsed = (uint32_t)(statetime - starttime).count();
+/* What's already in the state file; only touched by whichever thread is writing it */
+struct vis_state_journal_t
+{
+    bool created = false;
+    uint64_t end = 0; // where the next portal's bits are appended
+    std::vector<bool> written;
+};
+
+static vis_state_journal_t state_journal;
+
+static uint64_t VisStateJournalStart()
+{
+    return VIS_STATE_HEADER_SIZE + VIS_STATE_PORTAL_SIZE * portals.size();
+}
 
-    out <= state;
+/*
+ * Copies out the portals completed since the last write, so the writer never reads
+ * the live portals. Must not run while a write is in progress (the journal is read).
+ */
+static void TakeVisSnapshot(vis_snapshot_t &snapshot, time_point now)
+{
+    snapshot.time_elapsed = (uint32_t)(now - starttime).count();
+    snapshot.completed.clear();
 
     /* Allocate memory for compressed bitstrings */
     std::vector<uint8_t> might((portalleafs + 7) >> 3);
     std::vector<uint8_t> vis((portalleafs + 7) >> 3);
 
-    for (const auto &p : portals) {
-        might_len = CompressBits(might.data(), p.mightsee);
-        if (p.status == pstat_done) {
-            vis_len = CompressBits(vis.data(), p.visbits);
-        } else {
-            vis_len = 0;
+    for (size_t i = 0; i < portals.size(); i++) {
+        if (state_journal.created && state_journal.written[i]) {
+            continue;
         }
 
-        pstate.status = p.status;
-        pstate.might = might_len;
-        pstate.vis = vis_len;
+        const visportal_t &p = portals[i];
+        auto lock = LockPortalSourceLeaf(&p);
+
+        if (p.load_status() != pstat_done) {
+            continue;
+        }
+
+        vis_snapshot_portal_t &pstate = snapshot.completed.emplace_back();
+        pstate.portalnum = i;
         pstate.nummightsee = p.nummightsee;
         pstate.numcansee = p.numcansee;
+        pstate.might.assign(might.begin(), might.begin() + CompressBits(might.data(), p.mightsee.data()));
+        pstate.vis.assign(vis.begin(), vis.begin() + CompressBits(vis.data(), p.visbits.data()));
+    }
+}
 
-        out <= pstate;
-        out.write((const char *)might.data(), might_len);
-        if (vis_len) {
-            out.write((const char *)vis.data(), vis_len);
+static dvisstate_t VisStateHeader(uint32_t time_elapsed)
+{
+    dvisstate_t state;
+    state.version = VIS_STATE_VERSION;
+    state.numportals = numportals;
+    state.numleafs = portalleafs;
+    state.testlevel = vis_options.visdist.value();
+    state.time_elapsed = time_elapsed;
+    return state;
+}
+
+/* Starts a new state file with an empty index */
+static void CreateVisState(uint32_t time_elapsed)
+{
+    {
+        std::ofstream out(statetmpfile, std::ios_base::out | std::ios_base::binary);
+        out << endianness<std::endian::little>;
+
+        out <= VisStateHeader(time_elapsed);
+
+        const dportal_t empty{};
+        for (size_t i = 0; i < portals.size(); i++) {
+            out <= empty;
         }
-    }
 
-    out.close();
+        if (!out)
+            FError("error writing {}", statetmpfile);
+    }
 
     std::error_code ec;
 
@@ -185,6 +280,156 @@ void SaveVisState()
     fs::rename(statetmpfile, statefile, ec);
     if (ec)
         FError("error renaming state file ({})", ec.message());
+
+    state_journal.created = true;
+    state_journal.end = VisStateJournalStart();
+    state_journal.written.assign(portals.size(), false);
+}
+
+static void WriteVisState(const vis_snapshot_t &snapshot)
+{
+    if (!state_journal.created) {
+        CreateVisState(snapshot.time_elapsed);
+    }
+
+    std::fstream out(statefile, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+    if (!out)
+        FError("error opening {}", statefile);
+    out << endianness<std::endian::little>;
+
+    /* Append the bits of the newly completed portals */
+    std::vector<std::pair<size_t, dportal_t>> appended;
+    uint64_t end = state_journal.end;
+
+    out.seekp(end);
+
+    for (const vis_snapshot_portal_t &p : snapshot.completed) {
+        if (state_journal.written[p.portalnum]) {
+            continue;
+        }
+
+        dportal_t pstate;
+        pstate.offset = end;
+        pstate.might = static_cast<uint32_t>(p.might.size());
+        pstate.vis = static_cast<uint32_t>(p.vis.size());
+        pstate.nummightsee = p.nummightsee;
+        pstate.numcansee = p.numcansee;
+
+        out.write((const char *)p.might.data(), pstate.might);
+        out.write((const char *)p.vis.data(), pstate.vis);
+        end += pstate.might + pstate.vis;
+
+        appended.emplace_back(p.portalnum, pstate);
+    }
+
+    /* Only index them once their bits are in the file */
+    out.flush();
+
+    for (const auto &[i, pstate] : appended) {
+        out.seekp(VIS_STATE_HEADER_SIZE + VIS_STATE_PORTAL_SIZE * i);
+        out <= pstate;
+    }
+
+    out.flush();
+
+    out.seekp(0);
+    out <= VisStateHeader(snapshot.time_elapsed);
+
+    out.close();
+    if (!out)
+        FError("error writing {}", statefile);
+
+    state_journal.end = end;
+    for (const auto &[i, pstate] : appended) {
+        state_journal.written[i] = true;
+    }
+}
+
+void SaveVisState()
+{
+    vis_snapshot_t snapshot;
+    TakeVisSnapshot(snapshot, I_FloatTime());
+    WriteVisState(snapshot);
+}
+
+struct vis_state_writer_t
+{
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool pending = false; // snapshot is waiting to be, or being, written
+    bool quit = false;
+    vis_snapshot_t snapshot;
+};
+
+static vis_state_writer_t state_writer;
+
+static void VisStateWriterThread()
+{
+    std::unique_lock lock(state_writer.lock);
+
+    while (true) {
+        state_writer.wake.wait(lock, [] { return state_writer.pending || state_writer.quit; });
+
+        if (!state_writer.pending) {
+            return;
+        }
+
+        lock.unlock();
+        try {
+            WriteVisState(state_writer.snapshot);
+        } catch (const std::exception &e) {
+            // a failed checkpoint only costs progress if vis is interrupted later
+            logging::print("WARNING: couldn't write vis state checkpoint: {}\n", e.what());
+        }
+        lock.lock();
+
+        state_writer.pending = false;
+    }
+}
+
+vis_state_writer_scope::vis_state_writer_scope()
+{
+    state_writer.pending = false;
+    state_writer.quit = false;
+    state_writer.thread = std::thread(VisStateWriterThread);
+}
+
+bool QueueVisState(time_point now)
+{
+    {
+        std::unique_lock lock(state_writer.lock);
+        if (state_writer.pending) {
+            return false;
+        }
+    }
+
+    /* The writer doesn't touch the snapshot until it's pending */
+    TakeVisSnapshot(state_writer.snapshot, now);
+
+    {
+        std::unique_lock lock(state_writer.lock);
+        state_writer.pending = true;
+    }
+    state_writer.wake.notify_one();
+
+    return true;
+}
+
+/* Also runs when a worker's error unwinds out of the parallel_for */
+vis_state_writer_scope::~vis_state_writer_scope()
+{
+    {
+        std::unique_lock lock(state_writer.lock);
+        state_writer.quit = true;
+    }
+    state_writer.wake.notify_one();
+
+    if (state_writer.thread.joinable()) {
+        state_writer.thread.join();
+    }
+
+    state_writer.snapshot = {};
 }
 
 void CleanVisState()
@@ -192,6 +437,8 @@ void CleanVisState()
     if (fs::exists(statefile)) {
         fs::remove(statefile);
     }
+
+    state_journal = {};
 }
 
 bool LoadVisState()
@@ -201,6 +448,8 @@ bool LoadVisState()
     dvisstate_t state;
     dportal_t pstate;
 
+    state_journal = {};
+
     if (vis_options.nostate.value()) {
         return false;
     }
@@ -226,58 +475,372 @@ bool LoadVisState()
         return false;
     }
 
-    std::ifstream in(statefile, std::ios_base::in | std::ios_base::binary);
+    const mapped_file_t file(statefile);
+    if (!file.is_open() || file.size() < VIS_STATE_HEADER_SIZE) {
+        return false;
+    }
+
+    imemstream in(file.data(), file.size());
     in >> endianness<std::endian::little>;
 
     in >= state;
 
     /* Sanity check the headers */
     if (state.version != VIS_STATE_VERSION) {
-        FError("state file version does not match");
+        logging::print("State file is from a different version of vis, will be overwritten\n");
+        return false;
     }
     if (state.numportals != numportals || state.numleafs != portalleafs) {
         FError("state file {} does not match portal file {}", statefile, portalfile);
     }
+    if (file.size() < VisStateJournalStart()) {
+        logging::print("State file is truncated, will be overwritten\n");
+        return false;
+    }
 
     /* Move back the start time to simulate already elapsed time */
     starttime -= duration(state.time_elapsed);
 
     numbytes = (portalleafs + 7) >> 3;
-    std::vector<uint8_t> compressed(numbytes);
 
-    /* Update the portal information */
-    for (auto &p : portals) {
+    state_journal.created = true;
+    state_journal.end = VisStateJournalStart();
+    state_journal.written.assign(portals.size(), false);
+
+    /* Restore the completed portals, straight from the mapped journal */
+    for (size_t i = 0; i < portals.size(); i++) {
         in >= pstate;
 
-        p.status = static_cast<pstatus_t>(pstate.status);
+        if (!pstate.offset || pstate.offset + pstate.might + pstate.vis > file.size()) {
+            continue;
+        }
+
+        visportal_t &p = portals[i];
+        const uint8_t *might = file.data() + pstate.offset;
+        const uint8_t *vis = might + pstate.might;
+
+        p.status = pstat_done;
         p.nummightsee = pstate.nummightsee;
         p.numcansee = pstate.numcansee;
 
-        in.read((char *)compressed.data(), pstate.might);
         p.mightsee.resize(portalleafs);
-
         if (pstate.might < numbytes) {
-            DecompressBits(p.mightsee, compressed.data());
+            DecompressBits(p.mightsee, might, portalleafs);
         } else {
-            CopyLeafBits(p.mightsee, compressed.data(), portalleafs);
+            CopyLeafBits(p.mightsee, might, portalleafs);
         }
 
         p.visbits.resize(portalleafs);
+        if (pstate.vis < numbytes) {
+            DecompressBits(p.visbits, vis, portalleafs);
+        } else {
+            CopyLeafBits(p.visbits, vis, portalleafs);
+        }
 
-        if (pstate.vis) {
-            in.read((char *)compressed.data(), pstate.vis);
-            if (pstate.vis < numbytes) {
-                DecompressBits(p.visbits, compressed.data());
-            } else {
-                CopyLeafBits(p.visbits, compressed.data(), portalleafs);
+        state_journal.written[i] = true;
+        state_journal.end = std::max(state_journal.end, pstate.offset + pstate.might + pstate.vis);
+    }
+
+    return true;
+}
+
+/*
+ * Incremental vis
+ *
+ * After a complete vis, the winding and final visbits of every portal are
+ * saved. The next run matches its portals against them by geometry; a portal
+ * whose whole mightsee region is unchanged flows exactly as it did last time,
+ * so its visbits are carried over (with the leaf numbers remapped) instead of
+ * being recalculated.
+ */
+
+void SaveIncrementalVis()
+{
+    // written to a temp file first, so an interrupted run leaves the previous cache intact
+    fs::path tmpfile = incrementalfile;
+    tmpfile += ".tmp";
+
+    {
+        std::ofstream out(tmpfile, std::ios_base::out | std::ios_base::binary);
+        out << endianness<std::endian::little>;
+
+        dincrementalstate_t state;
+        state.version = VIS_INCREMENTAL_VERSION;
+        state.numportals = numportals;
+        state.numleafs = portalleafs;
+        state.testlevel = vis_options.level.value();
+        state.visdist = vis_options.visdist.value();
+
+        out <= state;
+
+        std::vector<uint8_t> vis((portalleafs + 7) >> 3);
+
+        for (const auto &p : portals) {
+            dincrementalportal_t pstate;
+            pstate.leaf = p.leaf;
+            pstate.numpoints = p.winding->size();
+            pstate.vis = CompressBits(vis.data(), p.visbits.data());
+
+            out <= pstate;
+            for (size_t i = 0; i < p.winding->size(); i++) {
+                out <= p.winding->at(i);
             }
+            out.write((const char *)vis.data(), pstate.vis);
         }
 
-        /* Portals that were in progress need to be started again */
-        if (p.status == pstat_working) {
-            p.status = pstat_none;
+        if (!out) {
+            logging::print("WARNING: error writing {}, incremental vis data not saved\n", tmpfile);
+            return;
         }
     }
 
+    std::error_code ec;
+
+    fs::remove(incrementalfile, ec);
+    fs::rename(tmpfile, incrementalfile, ec);
+    if (ec)
+        logging::print("WARNING: error renaming {} ({}), incremental vis data not saved\n", tmpfile, ec.message());
+}
+
+struct incremental_portal_t
+{
+    int leaf;
+    std::vector<qvec3d> points;
+    std::vector<uint8_t> vis;
+};
+
+// portals are matched on their quantized bounding sphere origin, then point by point
+using incremental_key_t = std::tuple<int64_t, int64_t, int64_t, size_t>;
+
+static incremental_key_t IncrementalKey(const qvec3d &origin, size_t numpoints)
+{
+    return {static_cast<int64_t>(std::llround(origin[0] * 8.0)), static_cast<int64_t>(std::llround(origin[1] * 8.0)),
+        static_cast<int64_t>(std::llround(origin[2] * 8.0)), numpoints};
+}
+
+static qvec3d IncrementalOrigin(const std::vector<qvec3d> &points)
+{
+    qvec3d origin{};
+    for (auto &point : points)
+        origin += point;
+    return origin / points.size();
+}
+
+static bool IncrementalWindingsEqual(const incremental_portal_t &old, const viswinding_t &w)
+{
+    if (old.points.size() != w.size())
+        return false;
+
+    for (size_t i = 0; i < w.size(); i++) {
+        if (!qv::epsilonEqual(old.points[i], w[i], VIS_EQUAL_EPSILON))
+            return false;
+    }
+
     return true;
 }
+
+int LoadIncrementalVis()
+{
+    if (!fs::exists(incrementalfile)) {
+        logging::print("No previous incremental vis data, calculating everything\n");
+        return 0;
+    }
+
+    std::ifstream in(incrementalfile, std::ios_base::in | std::ios_base::binary);
+    in >> endianness<std::endian::little>;
+
+    dincrementalstate_t state;
+    in >= state;
+
+    if (!in || state.version != VIS_INCREMENTAL_VERSION) {
+        logging::print("WARNING: {} is not a valid incremental vis file, ignoring it\n", incrementalfile);
+        return 0;
+    }
+    if (state.testlevel != vis_options.level.value() || state.visdist != vis_options.visdist.value()) {
+        logging::print("Previous incremental vis used different settings, calculating everything\n");
+        return 0;
+    }
+
+    // every portal takes at least its header and one point, so a corrupt count
+    // can be rejected before allocating anything for it
+    constexpr size_t min_portal_size = sizeof(uint32_t) * 3 + sizeof(double) * 3;
+    std::error_code ec;
+    const uintmax_t file_size = fs::file_size(incrementalfile, ec);
+    const uintmax_t header_size = sizeof(uint32_t) * 4 + sizeof(double);
+
+    if (ec || file_size < header_size ||
+        static_cast<uintmax_t>(state.numportals) * 2 > (file_size - header_size) / min_portal_size) {
+        logging::print("WARNING: {} is truncated, ignoring it\n", incrementalfile);
+        return 0;
+    }
+
+    const size_t max_vis = (static_cast<size_t>(state.numleafs) + 7) >> 3;
+
+    std::vector<incremental_portal_t> oldportals(static_cast<size_t>(state.numportals) * 2);
+    for (auto &old : oldportals) {
+        dincrementalportal_t pstate{};
+        in >= pstate;
+
+        if (!in || pstate.leaf >= state.numleafs || pstate.numpoints == 0 || pstate.numpoints > MAX_WINDING ||
+            pstate.vis > max_vis) {
+            in.setstate(std::ios_base::failbit);
+            break;
+        }
+
+        old.leaf = pstate.leaf;
+        old.points.resize(pstate.numpoints);
+        for (auto &point : old.points)
+            in >= point;
+        old.vis.resize(pstate.vis);
+        in.read((char *)old.vis.data(), pstate.vis);
+
+        if (!in)
+            break;
+    }
+
+    if (!in) {
+        logging::print("WARNING: {} is truncated, ignoring it\n", incrementalfile);
+        return 0;
+    }
+
+    /* match every portal against one from the previous run */
+    std::map<incremental_key_t, std::vector<size_t>> oldportal_lookup;
+    for (size_t i = 0; i < oldportals.size(); i++) {
+        auto &old = oldportals[i];
+        oldportal_lookup[IncrementalKey(IncrementalOrigin(old.points), old.points.size())].push_back(i);
+    }
+
+    std::vector<int> match(portals.size(), -1);
+    std::vector<bool> oldmatched(oldportals.size(), false);
+
+    for (size_t i = 0; i < portals.size(); i++) {
+        const viswinding_t &w = *portals[i].winding;
+        auto it = oldportal_lookup.find(IncrementalKey(w.origin, w.size()));
+        if (it == oldportal_lookup.end())
+            continue;
+        for (size_t candidate : it->second) {
+            if (!oldmatched[candidate] && IncrementalWindingsEqual(oldportals[candidate], w)) {
+                oldmatched[candidate] = true;
+                match[i] = candidate;
+                break;
+            }
+        }
+    }
+
+    /*
+     * Work out which leafs are unchanged: all of their portals must match,
+     * must agree on the old leaf number on both sides, and the old leaf must
+     * not have had any other portals.
+     */
+    std::vector<int> newtoold(portalleafs, -1);
+    std::vector<int> oldtonew(state.numleafs, -1);
+    std::vector<bool> stable(portalleafs, true);
+    std::vector<int> oldleafportals(state.numleafs, 0);
+
+    for (size_t i = 0; i < oldportals.size(); i++) {
+        oldleafportals[oldportals[i ^ 1].leaf]++;
+    }
+
+    auto map_leaf = [&](int newleaf, int oldleaf) {
+        if (newtoold[newleaf] == -1) {
+            newtoold[newleaf] = oldleaf;
+        } else if (newtoold[newleaf] != oldleaf) {
+            stable[newleaf] = false;
+        }
+    };
+
+    for (size_t i = 0; i < portals.size(); i++) {
+        const int srcleaf = portals[i ^ 1].leaf;
+        if (match[i] == -1) {
+            stable[srcleaf] = false;
+            stable[portals[i].leaf] = false;
+            continue;
+        }
+        map_leaf(srcleaf, oldportals[match[i] ^ 1].leaf);
+        map_leaf(portals[i].leaf, oldportals[match[i]].leaf);
+    }
+
+    for (int i = 0; i < portalleafs; i++) {
+        if (newtoold[i] == -1) {
+            stable[i] = false;
+            continue;
+        }
+        if (leafs[i].portals.size() != oldleafportals[newtoold[i]])
+            stable[i] = false;
+
+        // two new leafs claiming the same old one
+        int &other = oldtonew[newtoold[i]];
+        if (other == -1) {
+            other = i;
+        } else {
+            stable[i] = false;
+            stable[other] = false;
+        }
+    }
+
+    leafbits_t unstable(portalleafs);
+    int numstable = 0;
+    for (int i = 0; i < portalleafs; i++) {
+        if (stable[i])
+            numstable++;
+        else
+            unstable[i] = true;
+    }
+    for (uint32_t i = 0; i < state.numleafs; i++) {
+        if (oldtonew[i] != -1 && !stable[oldtonew[i]])
+            oldtonew[i] = -1;
+    }
+
+    /* carry over the portals that can only see unchanged leafs */
+    const size_t numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+    const size_t oldnumbytes = (state.numleafs + 7) >> 3;
+    int reused = 0;
+
+    for (size_t i = 0; i < portals.size(); i++) {
+        visportal_t &p = portals[i];
+        if (match[i] == -1 || p.status != pstat_none)
+            continue;
+
+        size_t j;
+        for (j = 0; j < numblocks; j++) {
+            if (p.mightsee.data()[j] & unstable.data()[j])
+                break;
+        }
+        if (j != numblocks)
+            continue;
+
+        const auto &old = oldportals[match[i]];
+        leafbits_t oldvis(state.numleafs);
+        if (old.vis.size() < oldnumbytes) {
+            DecompressBits(oldvis, old.vis.data(), state.numleafs);
+        } else {
+            CopyLeafBits(oldvis, old.vis.data(), state.numleafs);
+        }
+
+        leafbits_t visbits(portalleafs);
+        int numcansee = 0;
+        bool ok = true;
+        for (uint32_t k = 0; k < state.numleafs; k++) {
+            if (!oldvis[k])
+                continue;
+            if (oldtonew[k] == -1) {
+                ok = false;
+                break;
+            }
+            visbits[oldtonew[k]] = true;
+            numcansee++;
+        }
+        if (!ok)
+            continue;
+
+        p.visbits = std::move(visbits);
+        p.numcansee = numcansee;
+        p.status = pstat_done;
+        reused++;
+    }
+
+    logging::print("Incremental vis: {} of {} clusters unchanged, reusing {} of {} portals\n", numstable,
+        portalleafs, reused, portals.size());
+
+    return reused;
+}
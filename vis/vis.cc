@@ -2,6 +2,7 @@
 
 #include <vis/leafbits.hh>
 #include <common/log.hh>
+#include <common/profile.hh>
 #include <common/bsputils.hh>
 #include <common/fs.hh>
 #include <common/parallel.hh>
@@ -62,7 +63,7 @@ void vis_settings::initialize(int argc, const char **argv)
 
 settings::vis_settings vis_options;
 
-fs::path portalfile, statefile, statetmpfile;
+fs::path portalfile, statefile, statetmpfile, incrementalfile;
 
 /*
   ==================
@@ -106,38 +107,28 @@ void FreeStackWinding(viswinding_t *&w, pstack_t &stack)
 
 /*
   ==================
-  ClipStackWinding
+  ClipStackWindingPoints
 
-  Clips the winding to the plane, returning the new winding on the positive
-  side. Frees the input winding (if on stack). If the resulting winding would
-  have too many points, the clip operation is aborted and the original winding
-  is returned.
+  ClipStackWinding without the bounding sphere fast test.
   ==================
 */
-viswinding_t *ClipStackWinding(visstats_t &stats, viswinding_t *in, pstack_t &stack, const qplane3d &split)
+static viswinding_t *ClipStackWindingPoints(
+    visstats_t &stats, viswinding_t *in, pstack_t &stack, const qplane3d &split)
 {
     double dists[MAX_WINDING + 1];
     int sides[MAX_WINDING + 1];
     size_t i;
 
-    /* Fast test first */
-    double dot = split.distance_to(in->origin);
-    if (dot < -in->radius) {
-        FreeStackWinding(in, stack);
-        return nullptr;
-    } else if (dot > in->radius) {
-        return in;
-    }
-
     if (in->size() > MAX_WINDING)
         FError("in->numpoints > MAX_WINDING ({} > {})", in->size(), MAX_WINDING);
 
+    WindingPlaneDistances(*in, split, dists);
+
     int counts[3] = {0, 0, 0};
 
     /* determine sides for each point */
     for (i = 0; i < in->size(); i++) {
-        dot = split.distance_to((*in)[i]);
-        dists[i] = dot;
+        const double dot = dists[i];
         if (dot > VIS_ON_EPSILON)
             sides[i] = SIDE_FRONT;
         else if (dot < -VIS_ON_EPSILON)
@@ -217,13 +208,206 @@ noclip:
     return in;
 }
 
+/*
+  ==================
+  ClipStackWinding
+
+  Clips the winding to the plane, returning the new winding on the positive
+  side. Frees the input winding (if on stack). If the resulting winding would
+  have too many points, the clip operation is aborted and the original winding
+  is returned.
+  ==================
+*/
+viswinding_t *ClipStackWinding(visstats_t &stats, viswinding_t *in, pstack_t &stack, const qplane3d &split)
+{
+    /* Fast test first */
+    double dot = split.distance_to(in->origin);
+    if (dot < -in->radius) {
+        FreeStackWinding(in, stack);
+        return nullptr;
+    } else if (dot > in->radius) {
+        return in;
+    }
+
+    return ClipStackWindingPoints(stats, in, stack, split);
+}
+
+/*
+  ==================
+  ClipStackWindingToPlanes
+
+  Same as calling ClipStackWinding for each plane in turn. Clipping never
+  changes the bounding sphere, so the fast tests against all of the planes are
+  done as one batch up front.
+  ==================
+*/
+viswinding_t *ClipStackWindingToPlanes(
+    visstats_t &stats, viswinding_t *in, pstack_t &stack, const qplane3d *planes, size_t numplanes)
+{
+    double dots[MAX_SEPARATORS];
+
+    if (numplanes > MAX_SEPARATORS)
+        FError("numplanes > MAX_SEPARATORS ({} > {})", numplanes, MAX_SEPARATORS);
+
+    PlanePointDistances(planes, numplanes, in->origin, dots);
+
+    for (size_t i = 0; i < numplanes; i++) {
+        if (dots[i] < -in->radius) {
+            FreeStackWinding(in, stack);
+            return nullptr;
+        }
+    }
+
+    for (size_t i = 0; i < numplanes; i++) {
+        if (dots[i] > in->radius)
+            continue;
+        in = ClipStackWindingPoints(stats, in, stack, planes[i]);
+        if (!in)
+            return nullptr;
+    }
+
+    return in;
+}
+
 //============================================================================
 
+void portal_scheduler_t::set_entry(size_t index, const entry_t &entry)
+{
+    heap[index] = entry;
+    positions[entry.portalnum] = index;
+}
+
+void portal_scheduler_t::sift_up(size_t index)
+{
+    const entry_t entry = heap[index];
+
+    while (index > 0) {
+        const size_t parent = (index - 1) / 2;
+        if (!(entry < heap[parent]))
+            break;
+        set_entry(index, heap[parent]);
+        index = parent;
+    }
+
+    set_entry(index, entry);
+}
+
+void portal_scheduler_t::sift_down(size_t index)
+{
+    const entry_t entry = heap[index];
+
+    while (true) {
+        size_t child = index * 2 + 1;
+        if (child >= heap.size())
+            break;
+        if (child + 1 < heap.size() && heap[child + 1] < heap[child])
+            child++;
+        if (!(heap[child] < entry))
+            break;
+        set_entry(index, heap[child]);
+        index = child;
+    }
+
+    set_entry(index, entry);
+}
+
+void portal_scheduler_t::reset(const std::vector<visportal_t> &portals)
+{
+    std::unique_lock guard(lock);
+
+    heap.clear();
+    positions.assign(portals.size(), -1);
+
+    for (size_t i = 0; i < portals.size(); i++) {
+        if (portals[i].status != pstat_none)
+            continue;
+        positions[i] = heap.size();
+        heap.push_back({portals[i].nummightsee, static_cast<uint32_t>(i)});
+    }
+
+    // heapify
+    for (size_t i = heap.size() / 2; i-- > 0;) {
+        sift_down(i);
+    }
+}
+
+void portal_scheduler_t::clear()
+{
+    std::unique_lock guard(lock);
+
+    heap.clear();
+    positions.clear();
+}
+
+std::optional<size_t> portal_scheduler_t::pop()
+{
+    std::unique_lock guard(lock);
+
+    if (heap.empty())
+        return std::nullopt;
+
+    const size_t portalnum = heap[0].portalnum;
+    positions[portalnum] = -1;
+
+    const entry_t last = heap.back();
+    heap.pop_back();
+
+    if (!heap.empty()) {
+        set_entry(0, last);
+        sift_down(0);
+    }
+
+    return portalnum;
+}
+
+void portal_scheduler_t::update(size_t portalnum, int nummightsee)
+{
+    std::unique_lock guard(lock);
+
+    const int32_t index = positions[portalnum];
+    if (index == -1)
+        return;
+
+    if (nummightsee >= heap[index].key)
+        return;
+
+    heap[index].key = nummightsee;
+    sift_up(index);
+}
+
+size_t portal_scheduler_t::size()
+{
+    std::unique_lock guard(lock);
+
+    return heap.size();
+}
+
 #include <mutex>
 
-static std::mutex portal_mutex;
+static portal_scheduler_t portal_scheduler;
+
+/*
+ * Guards the mightsee/nummightsee of the portals leading out of each leaf while they
+ * are still pstat_none, and the pstat_none -> pstat_working transition of those portals.
+ */
+static std::vector<std::mutex> leaf_mutexes;
+
+/* Only one thread writes a state checkpoint at a time */
+static std::mutex state_mutex;
+
 static std::atomic_int64_t portalIndex;
 
+/* The leaf a portal leads out of (portals are stored in front/back pairs) */
+static inline size_t PortalSourceLeaf(const visportal_t *p)
+{
+    return portals[(p - portals.data()) ^ 1].leaf;
+}
+
+std::unique_lock<std::mutex> LockPortalSourceLeaf(const visportal_t *p)
+{
+    return std::unique_lock(leaf_mutexes[PortalSourceLeaf(p)]);
+}
+
 /*
   =============
   GetNextPortal
@@ -235,23 +419,14 @@ static std::atomic_int64_t portalIndex;
 */
 visportal_t *GetNextPortal()
 {
-    visportal_t *ret = nullptr;
-    uint32_t min = INT_MAX;
-
-    portal_mutex.lock();
-
-    for (auto &p : portals) {
-        if (p.nummightsee < min && p.status == pstat_none) {
-            min = p.nummightsee;
-            ret = &p;
-        }
-    }
+    const auto portalnum = portal_scheduler.pop();
+    if (!portalnum)
+        return nullptr;
 
-    if (ret) {
-        ret->status = pstat_working;
-    }
+    visportal_t *ret = &portals[*portalnum];
 
-    portal_mutex.unlock();
+    std::unique_lock lock(leaf_mutexes[PortalSourceLeaf(ret)]);
+    ret->store_status(pstat_working);
 
     return ret;
 }
@@ -265,20 +440,22 @@ visportal_t *GetNextPortal()
   must also be true. Update mightsee for any portals on the source leaf which
   haven't yet started processing.
 
-  Called with the lock held.
+  Takes the source leaf's lock.
   =============
 */
 static void UpdateMightsee(visstats_t &stats, const leaf_t &source, const leaf_t &dest)
 {
     size_t leafnum = &dest - leafs.data();
+    std::unique_lock lock(leaf_mutexes[&source - leafs.data()]);
     for (visportal_t *p : source.portals) {
-        if (p->status != pstat_none) {
+        if (p->load_status() != pstat_none) {
             continue;
         }
         if (p->mightsee[leafnum]) {
             p->mightsee[leafnum] = false;
             p->nummightsee--;
             stats.c_mightseeupdate++;
+            portal_scheduler.update(p - portals.data(), p->nummightsee);
         }
     }
 }
@@ -289,68 +466,81 @@ static void UpdateMightsee(visstats_t &stats, const leaf_t &source, const leaf_t
 
   Mark the portal completed and propogate new vis information across
   to the complementry portals.
-
-  Called with the lock held.
   =============
 */
 static void PortalCompleted(visstats_t &stats, visportal_t *completed)
 {
-    portal_mutex.lock();
+    completed->store_status(pstat_done);
 
-    completed->status = pstat_done;
+    // leafs to call UpdateMightsee for, gathered under myleaf's lock and applied after
+    // releasing it, since UpdateMightsee takes the lock of the leaf it updates
+    thread_local std::vector<int> updates;
+    updates.clear();
 
     /*
      * For each portal on the leaf, check the leafs we eliminated from
      * mightsee during the full vis so far.
      */
     const leaf_t &myleaf = leafs[completed->leaf];
-    for (int i = 0; i < myleaf.portals.size(); i++) {
-        const visportal_t *p = myleaf.portals[i];
-        if (p->status != pstat_done)
-            continue;
-
-        auto might = p->mightsee.data();
-        auto vis = p->visbits.data();
-        int numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
-        for (int j = 0; j < numblocks; j++) {
-            uint32_t changed = might[j] & ~vis[j];
-            if (!changed)
+    {
+        // the mightsee of myleaf's pstat_none portals can be cleared by UpdateMightsee
+        // on another thread, and they can be picked up by GetNextPortal, until we
+        // hold this
+        std::unique_lock lock(leaf_mutexes[completed->leaf]);
+
+        for (int i = 0; i < myleaf.portals.size(); i++) {
+            const visportal_t *p = myleaf.portals[i];
+            if (p->load_status() != pstat_done)
                 continue;
 
-            /*
-             * If any of these changed bits are still visible from another
-             * portal, we can't update yet.
-             */
-            for (int k = 0; k < myleaf.portals.size(); k++) {
-                if (k == i)
-                    continue;
-                const visportal_t *p2 = myleaf.portals[k];
-                if (p2->status == pstat_done)
-                    changed &= ~p2->visbits.data()[j];
-                else
-                    changed &= ~p2->mightsee.data()[j];
+            auto might = p->mightsee.data();
+            auto vis = p->visbits.data();
+            int numblocks = (portalleafs + leafbits_t::mask) >> leafbits_t::shift;
+            for (int j = 0; j < numblocks; j++) {
+                uint32_t changed = might[j] & ~vis[j];
                 if (!changed)
-                    break;
-            }
+                    continue;
 
-            /*
-             * Update mightsee for any of the changed bits that survived
-             */
-            while (changed) {
-                int bit = std::countr_zero(changed);
-                changed &= ~nth_bit(bit);
-                int leafnum = (j << leafbits_t::shift) + bit;
-                UpdateMightsee(stats, leafs[leafnum], myleaf);
+                /*
+                 * If any of these changed bits are still visible from another
+                 * portal, we can't update yet.
+                 */
+                for (int k = 0; k < myleaf.portals.size(); k++) {
+                    if (k == i)
+                        continue;
+                    const visportal_t *p2 = myleaf.portals[k];
+                    if (p2->load_status() == pstat_done)
+                        changed &= ~p2->visbits.data()[j];
+                    else
+                        changed &= ~p2->mightsee.data()[j];
+                    if (!changed)
+                        break;
+                }
+
+                /*
+                 * Update mightsee for any of the changed bits that survived
+                 */
+                while (changed) {
+                    int bit = std::countr_zero(changed);
+                    changed &= ~nth_bit(bit);
+                    updates.push_back((j << leafbits_t::shift) + bit);
+                }
             }
         }
     }
 
-    portal_mutex.unlock();
+    for (int leafnum : updates) {
+        UpdateMightsee(stats, leafs[leafnum], myleaf);
+    }
 }
 
 time_point starttime, endtime, statetime;
 static duration stateinterval;
 
+/* How long the workers that took state snapshots were held up; guarded by state_mutex */
+static int statecheckpoints;
+static duration statestall, statestallmax;
+
 /*
   ==============
   LeafThread
@@ -358,14 +548,22 @@ static duration stateinterval;
 */
 static visstats_t LeafThread()
 {
-    portal_mutex.lock();
-    /* Save state if sufficient time has elapsed */
-    auto now = I_FloatTime();
-    if (now > statetime + stateinterval) {
-        statetime = now;
-        SaveVisState();
+    /*
+     * Checkpoint the state if sufficient time has elapsed; this thread only takes a
+     * snapshot, which is written out in the background while everyone keeps working
+     */
+    if (stateinterval > duration::zero() && state_mutex.try_lock()) {
+        auto now = I_FloatTime();
+        if (now > statetime + stateinterval && QueueVisState(now)) {
+            statetime = now;
+
+            const duration stall = I_FloatTime() - now;
+            statecheckpoints++;
+            statestall += stall;
+            statestallmax = std::max(statestallmax, stall);
+        }
+        state_mutex.unlock();
     }
-    portal_mutex.unlock();
 
     visportal_t *p = GetNextPortal();
     if (!p)
@@ -488,6 +686,8 @@ static void ClusterFlow(int clusternum, leafbits_t &buffer, mbsp_t *bsp)
 */
 visstats_t CalcPortalVis(const mbsp_t *bsp)
 {
+    profile::zone zone(__func__);
+
     // fastvis just uses mightsee for a very loose bound
     if (vis_options.fast.value()) {
         for (auto &p : portals) {
@@ -509,20 +709,45 @@ visstats_t CalcPortalVis(const mbsp_t *bsp)
 
     portalIndex = startcount;
 
+    leaf_mutexes = std::vector<std::mutex>(portalleafs);
+    portal_scheduler.reset(portals);
+
     std::vector<visstats_t> stats_perportal;
     stats_perportal.resize(numportals * 2);
 
-    logging::parallel_for(startcount, numportals * 2, [&](size_t i) { stats_perportal[i] = LeafThread(); });
+    /*
+     * Portals carried over from a previous run only come with their own bits, so
+     * pass on what they eliminated to the portals that are still to be done
+     */
+    if (startcount) {
+        visstats_t loadstats{};
+        for (auto &p : portals) {
+            if (p.status == pstat_done) {
+                PortalCompleted(loadstats, &p);
+            }
+        }
+    }
+
+    {
+        vis_state_writer_scope state_writer;
+        logging::parallel_for(startcount, numportals * 2, [&](size_t i) { stats_perportal[i] = LeafThread(); });
+    }
 
     const visstats_t stats = std::accumulate(stats_perportal.begin(), stats_perportal.end(), visstats_t{});
 
     SaveVisState();
 
+    if (statecheckpoints) {
+        logging::print("{} state checkpoints, snapshots stalled a worker for {:.1f} ms total, {:.1f} ms max\n",
+            statecheckpoints, statestall.count() * 1000.0, statestallmax.count() * 1000.0);
+    }
+
     logging::print(logging::flag::VERBOSE, "portalcheck: {}  portaltest: {}  portalpass: {}\n", stats.c_portalcheck,
         stats.c_portaltest, stats.c_portalpass);
     logging::print(logging::flag::VERBOSE, "c_vistest: {}  c_mighttest: {}  c_mightseeupdate {}\n", stats.c_vistest,
         stats.c_mighttest, stats.c_mightseeupdate);
     logging::print(logging::flag::VERBOSE, "c_targetcheck: {}\n", stats.c_targetcheck);
+    logging::print(logging::flag::VERBOSE, "c_bitsetalloc: {}\n", stats.c_bitsetalloc);
 
     return stats;
 }
@@ -534,16 +759,25 @@ visstats_t CalcPortalVis(const mbsp_t *bsp)
 */
 visstats_t CalcVis(mbsp_t *bsp)
 {
+    profile::zone zone(__func__);
+
+    // saved state only holds the completed portals, the rest start from their base vis
+    logging::print("Calculating Base Vis:\n");
+    BasePortalVis();
+
     if (LoadVisState()) {
         logging::print("Loaded previous state. Resuming progress...\n");
-    } else {
-        logging::print("Calculating Base Vis:\n");
-        BasePortalVis();
+    } else if (vis_options.incremental.value() && !vis_options.fast.value()) {
+        LoadIncrementalVis();
     }
 
     logging::print("Calculating Full Vis:\n");
     auto stats = CalcPortalVis(bsp);
 
+    if (vis_options.incremental.value() && !vis_options.fast.value()) {
+        SaveIncrementalVis();
+    }
+
     //
     // assemble the leaf vis lists by oring and compressing the portal lists
     //
@@ -697,14 +931,20 @@ void vis_reset()
     portalfile = fs::path();
     statefile = fs::path();
     statetmpfile = fs::path();
+    incrementalfile = fs::path();
 
     portalIndex = 0;
 
+    portal_scheduler.clear();
+    leaf_mutexes.clear();
+
     starttime = time_point();
     endtime = time_point();
     statetime = time_point();
 
     stateinterval = duration();
+    statecheckpoints = 0;
+    statestall = statestallmax = duration();
 
     totalvis = 0;
     compressed.clear();
@@ -730,7 +970,11 @@ int vis_main(int argc, const char **argv)
 
     vis_options.print_summary();
 
-    stateinterval = std::chrono::minutes(5); /* 5 minutes */
+    const vis_simd_t simd = SetVisSIMD(vis_options.simd.value());
+    logging::print(logging::flag::VERBOSE, "using {} winding clipping\n",
+        simd == vis_simd_t::AVX2 ? "AVX2" : simd == vis_simd_t::SSE2 ? "SSE2" : "scalar");
+
+    stateinterval = duration(vis_options.stateinterval.value());
     starttime = statetime = I_FloatTime();
 
     LoadBSPFile(vis_options.sourceMap, &bspdata);
@@ -755,11 +999,21 @@ int vis_main(int argc, const char **argv)
             originalvismapsize = portalleafs * ((portalleafs + 7) / 8);
         }
     } else {
+        // qbsp -prtformat binary/both writes a .prtb; LoadPrtFile detects the format from the header.
+        // when there's also a .prt, use whichever is newer so a stale .prtb doesn't win
         portalfile = fs::path(vis_options.sourceMap).replace_extension("prt");
+        if (const auto prtb = fs::path(portalfile).replace_extension("prtb"); fs::exists(prtb)) {
+            if (!fs::exists(portalfile) || fs::last_write_time(prtb) >= fs::last_write_time(portalfile)) {
+                portalfile = prtb;
+            } else {
+                logging::print("WARNING: {} is older than {}, ignoring it\n", prtb, portalfile);
+            }
+        }
         LoadPortals(portalfile, &bsp);
 
         statefile = fs::path(vis_options.sourceMap).replace_extension("vis");
         statetmpfile = fs::path(vis_options.sourceMap).replace_extension("vi0");
+        incrementalfile = fs::path(vis_options.sourceMap).replace_extension("vcache");
 
         if (bsp.loadversion->game->id != GAME_QUAKE_II) {
             uncompressed.resize(portalleafs * leafbytes_real);
@@ -784,10 +1038,8 @@ int vis_main(int argc, const char **argv)
         CalcPHS(&bsp);
     }
 
-    /* Convert data format back if necessary */
-    ConvertBSPFormat(&bspdata, loadversion);
-
-    WriteBSPFile(vis_options.sourceMap, &bspdata);
+    /* Convert data format back while writing */
+    WriteBSPFile(vis_options.sourceMap, &bspdata, loadversion);
 
     endtime = I_FloatTime();
     logging::print("{:.2} elapsed\n", (endtime - starttime));